@@ -0,0 +1,275 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Allocation helpers for build and trace temporaries, the CPU side of the
+// scratch buffers CreateBottomLevelAS / CreateTopLevelAS allocate per build.
+//
+// LinearArena is a bump allocator: memory is handed out from large chunks and
+// only given back all at once by Reset. When a frame needed more than one
+// chunk, Reset merges them into one chunk of the total size, so after the
+// first frames a steady workload allocates nothing at all. FrameArena keeps
+// one LinearArena per worker thread, padded apart, and resets them together.
+// ArenaAllocator<T> lets standard containers draw from an arena; without one
+// it falls back to the heap, so "LinearArena* scratch = nullptr" parameters
+// keep their old behavior.
+//
+// NodePool<T> holds fixed-size BVH build nodes in blocks that survive
+// between builds. Threads claim node indices with one atomic add; blocks are
+// only allocated the first time an index reaches them.
+
+// Bytes of the first chunk of a LinearArena
+static const size_t kArenaChunkBytes = size_t(1) << 20;
+
+// Nodes per NodePool block
+static const uint32_t kNodePoolBlock = 4096;
+
+class LinearArena
+{
+    public:
+        explicit LinearArena(size_t chunkBytes = kArenaChunkBytes) : _chunkBytes(chunkBytes) {}
+        ~LinearArena() { Release(); }
+
+        LinearArena(const LinearArena&) = delete;
+        LinearArena& operator=(const LinearArena&) = delete;
+
+        void* Allocate(size_t bytes, size_t alignment = alignof(max_align_t))
+        {
+            uintptr_t p = (_cursor + alignment - 1) & ~uintptr_t(alignment - 1);
+            if (_chunks.empty() || p + bytes > _end)
+            {
+                // Chunks at least double, so a frame needs few of them
+                size_t size = std::max(bytes + alignment, _chunks.empty() ? _chunkBytes : 2 * _chunks.back().bytes);
+                NewChunk(size);
+                p = (_cursor + alignment - 1) & ~uintptr_t(alignment - 1);
+            }
+            _cursor = p + bytes;
+            _used += bytes;
+            _highWater = std::max(_highWater, _used);
+            return reinterpret_cast<void*>(p);
+        }
+
+        template <typename T>
+        T* Allocate(size_t count) { return static_cast<T*>(Allocate(count * sizeof(T), alignof(T))); }
+
+        // Gives back everything allocated since the last reset
+        void Reset()
+        {
+            if (_chunks.size() > 1)
+            {
+                size_t total = 0;
+                for (const Chunk& chunk : _chunks) total += chunk.bytes;
+                Release();
+                NewChunk(total);
+            }
+            else if (!_chunks.empty())
+            {
+                _cursor = reinterpret_cast<uintptr_t>(_chunks.back().memory);
+            }
+            _used = 0;
+        }
+
+        size_t Used() const { return _used; }
+        size_t HighWater() const { return _highWater; }
+        size_t Capacity() const
+        {
+            size_t total = 0;
+            for (const Chunk& chunk : _chunks) total += chunk.bytes;
+            return total;
+        }
+        // Chunks taken from the heap over the arena's lifetime
+        uint64_t Allocations() const { return _allocations; }
+
+    private:
+        struct Chunk
+        {
+            void* memory;
+            size_t bytes;
+        };
+
+        void NewChunk(size_t bytes)
+        {
+            _chunks.reserve(16);
+            _chunks.push_back(Chunk { ::operator new(bytes), bytes });
+            _cursor = reinterpret_cast<uintptr_t>(_chunks.back().memory);
+            _end = _cursor + bytes;
+            _allocations++;
+        }
+
+        void Release()
+        {
+            for (const Chunk& chunk : _chunks) ::operator delete(chunk.memory);
+            _chunks.clear();
+            _cursor = _end = 0;
+        }
+
+        size_t _chunkBytes;
+        std::vector<Chunk> _chunks;
+        uintptr_t _cursor = 0;
+        uintptr_t _end = 0;
+        size_t _used = 0;
+        size_t _highWater = 0;
+        uint64_t _allocations = 0;
+};
+
+// One arena per worker, reset together once per frame. Each arena is its own
+// padded allocation, so workers bumping their cursors do not share lines.
+class FrameArena
+{
+    public:
+        explicit FrameArena(int threads, size_t chunkBytes = kArenaChunkBytes)
+        {
+            for (int t = 0; t < std::max(1, threads); t++) _arenas.emplace_back(new PaddedArena(chunkBytes));
+        }
+
+        int Threads() const { return static_cast<int>(_arenas.size()); }
+        LinearArena& Thread(int worker) { return _arenas[worker]->arena; }
+
+        void Reset()
+        {
+            for (auto& arena : _arenas) arena->arena.Reset();
+        }
+
+        uint64_t Allocations() const
+        {
+            uint64_t total = 0;
+            for (const auto& arena : _arenas) total += arena->arena.Allocations();
+            return total;
+        }
+        size_t HighWater() const
+        {
+            size_t total = 0;
+            for (const auto& arena : _arenas) total += arena->arena.HighWater();
+            return total;
+        }
+
+    private:
+        struct PaddedArena
+        {
+            explicit PaddedArena(size_t chunkBytes) : arena(chunkBytes) {}
+            LinearArena arena;
+            char padding[64];
+        };
+
+        std::vector<std::unique_ptr<PaddedArena>> _arenas;
+};
+
+// Standard allocator over a LinearArena, or over the heap when arena is
+// null. Freeing into an arena does nothing; the memory comes back on Reset.
+template <typename T>
+struct ArenaAllocator
+{
+    typedef T value_type;
+
+    LinearArena* arena;
+
+    ArenaAllocator(LinearArena* a = nullptr) : arena(a) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n)
+    {
+        if (arena) return arena->Allocate<T>(n);
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t)
+    {
+        if (!arena) ::operator delete(p);
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+// Fixed-size nodes addressed by index. Prepare sizes the block table for the
+// most nodes a build can claim; Allocate can then run on any number of
+// threads. Blocks are kept from one build to the next, so rebuilding a tree
+// of the same size reuses them.
+template <typename T>
+class NodePool
+{
+    static_assert(std::is_trivially_destructible<T>::value, "NodePool never runs destructors");
+
+    public:
+        NodePool() : _blocks(nullptr), _blockCount(0), _count(0) {}
+        ~NodePool() { Release(); }
+
+        NodePool(const NodePool&) = delete;
+        NodePool& operator=(const NodePool&) = delete;
+
+        // Single threaded, before a build: room for maxNodes, count back to 0
+        void Prepare(size_t maxNodes)
+        {
+            const size_t blocks = (maxNodes + kNodePoolBlock - 1) / kNodePoolBlock;
+            if (blocks > _blockCount)
+            {
+                std::atomic<T*>* table = new std::atomic<T*>[blocks];
+                for (size_t b = 0; b < blocks; b++) table[b].store(b < _blockCount ? _blocks[b].load(std::memory_order_relaxed) : nullptr, std::memory_order_relaxed);
+                delete[] _blocks;
+                _blocks = table;
+                _blockCount = blocks;
+                _allocations++;
+            }
+            _count.store(0, std::memory_order_relaxed);
+        }
+
+        // Claims the next node, default constructed
+        uint32_t Allocate()
+        {
+            const uint32_t index = _count.fetch_add(1, std::memory_order_relaxed);
+            std::atomic<T*>& slot = _blocks[index / kNodePoolBlock];
+            T* block = slot.load(std::memory_order_acquire);
+            if (!block)
+            {
+                // Whoever loses the race frees its block and takes the winner's
+                T* fresh = static_cast<T*>(::operator new(kNodePoolBlock * sizeof(T)));
+                if (slot.compare_exchange_strong(block, fresh, std::memory_order_acq_rel))
+                {
+                    block = fresh;
+                    _allocations++;
+                }
+                else
+                {
+                    ::operator delete(fresh);
+                }
+            }
+            new (&block[index % kNodePoolBlock]) T();
+            return index;
+        }
+
+        T& operator[](uint32_t index) { return _blocks[index / kNodePoolBlock].load(std::memory_order_relaxed)[index % kNodePoolBlock]; }
+        const T& operator[](uint32_t index) const { return _blocks[index / kNodePoolBlock].load(std::memory_order_relaxed)[index % kNodePoolBlock]; }
+
+        uint32_t Count() const { return _count.load(std::memory_order_relaxed); }
+        size_t Bytes() const
+        {
+            size_t blocks = 0;
+            for (size_t b = 0; b < _blockCount; b++) blocks += _blocks[b].load(std::memory_order_relaxed) != nullptr;
+            return blocks * kNodePoolBlock * sizeof(T);
+        }
+        // Blocks and block tables taken from the heap
+        uint64_t Allocations() const { return _allocations.load(std::memory_order_relaxed); }
+
+    private:
+        void Release()
+        {
+            for (size_t b = 0; b < _blockCount; b++) ::operator delete(_blocks[b].load(std::memory_order_relaxed));
+            delete[] _blocks;
+            _blocks = nullptr;
+            _blockCount = 0;
+        }
+
+        std::atomic<T*>* _blocks;
+        size_t _blockCount;
+        std::atomic<uint32_t> _count;
+        std::atomic<uint64_t> _allocations { 0 };
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "Bvh.h"
+#include "CompactVertex.h"
+#include "RayPacket.h"
+#include "WideBvh.h"
+
+// CPU counterpart of CreateBottomLevelAS: takes the same vertex buffers and
+// builds a BVH over their triangles. Besides the binary tree it keeps the
+// 8-wide collapse of it, for the AVX2 single ray traversal; all three trace
+// paths share the triangles. With TriangleFormat::Quantized16 the triangles
+// are kept as 16-bit positions in the BLAS bounds and decoded per test; the
+// tree is built over the decoded triangles, so it bounds exactly what is
+// intersected.
+class BottomLevelAS
+{
+    public:
+        void Build(const std::vector<VertexBufferDesc>& vertexBuffers, const BvhBuildOptions& options = BvhBuildOptions(),
+                   TriangleFormat format = TriangleFormat::Float, const BvhScratch& scratch = BvhScratch())
+        {
+            std::vector<Triangle, ArenaAllocator<Triangle>> triangles = GatherTriangles(vertexBuffers, ArenaAllocator<Triangle>(scratch.arena));
+            Build(triangles.data(), triangles.size(), options, format, scratch);
+        }
+
+        void Build(const std::vector<Triangle>& input, const BvhBuildOptions& options = BvhBuildOptions(), TriangleFormat format = TriangleFormat::Float,
+                   const BvhScratch& scratch = BvhScratch())
+        {
+            Build(input.data(), input.size(), options, format, scratch);
+        }
+
+        // The build temporaries (bounds, decoded and quantized triangles, the
+        // builder's own) come from scratch when it has an arena and a pool
+        void Build(const Triangle* input, size_t count, const BvhBuildOptions& options, TriangleFormat format, const BvhScratch& scratch)
+        {
+            _format = format;
+            _quantized.clear();
+            std::vector<Triangle, ArenaAllocator<Triangle>> decoded(ArenaAllocator<Triangle>(scratch.arena));
+            std::vector<QuantizedTriangle, ArenaAllocator<QuantizedTriangle>> quantized(ArenaAllocator<QuantizedTriangle>(scratch.arena));
+            if (format == TriangleFormat::Quantized16)
+            {
+                Aabb bounds;
+                for (size_t i = 0; i < count; i++) bounds.Grow(input[i].Bounds());
+                _quantization = PositionQuantization(bounds);
+
+                quantized.resize(count);
+                decoded.resize(count);
+                for (size_t i = 0; i < count; i++)
+                {
+                    _quantization.Encode(input[i].v0, quantized[i].v[0]);
+                    _quantization.Encode(input[i].v1, quantized[i].v[1]);
+                    _quantization.Encode(input[i].v2, quantized[i].v[2]);
+                    decoded[i] = Decode(quantized[i]);
+                }
+            }
+            const Triangle* triangles = format == TriangleFormat::Quantized16 ? decoded.data() : input;
+
+            std::vector<Aabb, ArenaAllocator<Aabb>> boxes(count, Aabb(), ArenaAllocator<Aabb>(scratch.arena));
+            for (size_t i = 0; i < count; i++) boxes[i] = triangles[i].Bounds();
+            BvhBuilder().Build(boxes.data(), static_cast<uint32_t>(count), options, _nodes, _primitives, scratch);
+            _wide.Build(_nodes);
+
+            // Triangles are stored in leaf order so a leaf reads one contiguous run
+            if (format == TriangleFormat::Quantized16)
+            {
+                std::vector<Triangle>().swap(_triangles);
+                _quantized.resize(quantized.size());
+                for (size_t i = 0; i < quantized.size(); i++) _quantized[i] = quantized[_primitives[i]];
+            }
+            else
+            {
+                _triangles.resize(count);
+                for (size_t i = 0; i < count; i++) _triangles[i] = triangles[_primitives[i]];
+            }
+        }
+
+        // Closest hit along the ray; hit.t bounds the search and is updated
+        bool Intersect(const Ray& ray, Hit& hit) const
+        {
+            return TraverseBvh(_nodes, ray, hit, [&](uint32_t first, uint32_t count) {
+                return IntersectLeaf(ray, first, count, hit);
+            });
+        }
+
+        // Same as Intersect through the 8-wide tree; needs AVX2
+        bool IntersectWide(const Ray& ray, Hit& hit) const
+        {
+            return _wide.Traverse(ray, hit, [&](uint32_t first, uint32_t count) {
+                return IntersectLeaf(ray, first, count, hit);
+            });
+        }
+
+        // Intersect for the lanes of mask, eight rays at a time. Returns the
+        // lanes that found a closer hit. Needs AVX2.
+        __attribute__((target("avx2")))
+        int IntersectPacket(const RayPacket8& packet, HitPacket8& hits, int mask) const
+        {
+            PacketRays rays;
+            LoadPacketRays(packet, mask, rays);
+            return TraversePacket(_nodes, rays, hits, mask, [&](uint32_t first, uint32_t count, int active) __attribute__((target("avx2"))) {
+                int found = 0;
+                for (uint32_t i = first; i < first + count; i++)
+                {
+                    found |= IntersectTrianglePacket(rays, TriangleAt(i), _primitives[i], hits, active);
+                }
+                return found;
+            });
+        }
+
+        float SahCost() const { return BvhSahCost(_nodes); }
+        int Depth() const { return BvhDepth(_nodes); }
+        int WideDepth() const { return _wide.Depth(); }
+
+        Aabb Bounds() const { return _nodes.empty() ? Aabb() : Aabb(_nodes[0].bmin, _nodes[0].bmax); }
+        size_t NodeCount() const { return _nodes.empty() ? 0 : _nodes.size() - 1; }
+        size_t WideNodeCount() const { return _wide.NodeCount(); }
+        size_t TriangleCount() const { return _primitives.size(); }
+        size_t TriangleBytes() const { return _triangles.size() * sizeof(Triangle) + _quantized.size() * sizeof(QuantizedTriangle); }
+        size_t Bytes() const
+        {
+            return _nodes.size() * sizeof(BvhNode) + _wide.Bytes() + TriangleBytes() + _primitives.size() * sizeof(uint32_t);
+        }
+        TriangleFormat Format() const { return _format; }
+
+        // Flattened layout, for code that converts or walks the tree
+        const BvhNodeArray& Nodes() const { return _nodes; }
+        // Triangle i in leaf order as intersected, and the input index of each
+        Triangle TriangleAt(size_t i) const { return _format == TriangleFormat::Quantized16 ? Decode(_quantized[i]) : _triangles[i]; }
+        const std::vector<uint32_t>& Primitives() const { return _primitives; }
+
+    private:
+        bool IntersectLeaf(const Ray& ray, uint32_t first, uint32_t count, Hit& hit) const
+        {
+            bool found = false;
+            for (uint32_t i = first; i < first + count; i++)
+            {
+                found |= IntersectTriangle(ray, TriangleAt(i), _primitives[i], hit);
+            }
+            return found;
+        }
+
+        Triangle Decode(const QuantizedTriangle& tri) const
+        {
+            return Triangle { _quantization.Decode(tri.v[0]), _quantization.Decode(tri.v[1]), _quantization.Decode(tri.v[2]) };
+        }
+
+        BvhNodeArray _nodes;
+        WideBvh _wide;
+        TriangleFormat _format = TriangleFormat::Float;
+        std::vector<Triangle> _triangles;
+        std::vector<QuantizedTriangle> _quantized;
+        PositionQuantization _quantization;
+        std::vector<uint32_t> _primitives;
+};
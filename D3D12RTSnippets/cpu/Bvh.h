@@ -0,0 +1,534 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "Arena.h"
+#include "Geometry.h"
+
+// BVH construction and traversal shared by BottomLevelAS (triangles) and
+// TopLevelAS (instances), so the DXR acceleration structures can be traced,
+// timed and inspected on any machine.
+//
+// The build uses binned SAH: node centroids are sorted into kSahBins bins per
+// axis and the split plane with the lowest surface area cost is taken, or the
+// node becomes a leaf when splitting costs more than intersecting everything.
+// Large nodes are binned by several threads, and the subtrees near the root
+// are built in parallel.
+//
+// Builds can borrow their temporaries through BvhScratch: the per-primitive
+// arrays from a LinearArena and the build nodes from a NodePool, so a
+// structure rebuilt every frame stops hitting the heap.
+//
+// The result is a flat array of 32-byte nodes where both children of a node
+// are stored next to each other, so one 64-byte line holds the pair the
+// traversal tests together. Slot 1 is left empty so every pair starts on an
+// even index.
+
+static const int kSahBins = 16;
+static const int kMaxBvhDepth = 64;
+
+// SAH cost of visiting a node, relative to intersecting one triangle
+static const float kTraversalCost = 1.0f;
+static const float kIntersectionCost = 1.0f;
+
+// Nodes with at least this many triangles are binned by several threads
+static const uint32_t kParallelBinThreshold = 1 << 16;
+
+// Subtrees with at least this many triangles are handed to another thread
+static const uint32_t kParallelBuildGrain = 1 << 12;
+
+struct BvhNode
+{
+    Float3 bmin;
+    uint32_t leftFirst; // leaf: first triangle, interior: left child (right is leftFirst + 1)
+    Float3 bmax;
+    uint32_t count;     // triangles in a leaf, 0 for interior nodes
+
+    bool IsLeaf() const { return count > 0; }
+};
+static_assert(sizeof(BvhNode) == 32, "BvhNode must stay 32 bytes, two per cache line");
+
+enum class BvhSplit
+{
+    Sah,
+    Median, // object median on the longest axis, as a quality baseline
+};
+
+struct BvhBuildOptions
+{
+    BvhSplit split = BvhSplit::Sah;
+    int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    uint32_t maxLeafSize = 8;
+};
+
+// Allocator returning 64-byte aligned memory, so node pairs do not straddle
+// cache lines
+template <typename T>
+struct CacheAlignedAllocator
+{
+    typedef T value_type;
+
+    CacheAlignedAllocator() {}
+    template <typename U>
+    CacheAlignedAllocator(const CacheAlignedAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        void* p = nullptr;
+        if (posix_memalign(&p, 64, n * sizeof(T)) != 0) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t) { free(p); }
+
+    template <typename U>
+    bool operator==(const CacheAlignedAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const CacheAlignedAllocator<U>&) const { return false; }
+};
+
+// Slab test. Returns the entry distance, or infinity when the box is missed
+// or entered at or after tMax.
+inline float IntersectAabb(const Ray& ray, const Float3& invDir, const Float3& bmin, const Float3& bmax, float tMax)
+{
+    float tx1 = (bmin.x - ray.origin.x) * invDir.x, tx2 = (bmax.x - ray.origin.x) * invDir.x;
+    float tNear = std::min(tx1, tx2), tFar = std::max(tx1, tx2);
+    float ty1 = (bmin.y - ray.origin.y) * invDir.y, ty2 = (bmax.y - ray.origin.y) * invDir.y;
+    tNear = std::max(tNear, std::min(ty1, ty2));
+    tFar = std::min(tFar, std::max(ty1, ty2));
+    float tz1 = (bmin.z - ray.origin.z) * invDir.z, tz2 = (bmax.z - ray.origin.z) * invDir.z;
+    tNear = std::max(tNear, std::min(tz1, tz2));
+    tFar = std::min(tFar, std::max(tz1, tz2));
+
+    tNear = std::max(tNear, ray.tMin);
+    tFar = std::min(tFar, tMax);
+    return tNear <= tFar ? tNear : std::numeric_limits<float>::infinity();
+}
+
+// Axis aligned rays (like the (0, 0, -1) RayGen rays) have zero components;
+// a huge finite reciprocal keeps the slab test free of 0 * inf NaNs
+inline Float3 SafeInverse(const Float3& d)
+{
+    auto inv = [](float c) { return fabsf(c) > 1e-20f ? 1.0f / c : copysignf(1e20f, c); };
+    return Float3(inv(d.x), inv(d.y), inv(d.z));
+}
+
+typedef std::vector<BvhNode, CacheAlignedAllocator<BvhNode>> BvhNodeArray;
+
+// Node of the pointer tree a build makes before flattening it
+struct BvhBuildNode
+{
+    Aabb box;
+    uint32_t left, right;
+    uint32_t first, count; // count > 0 for leaves
+};
+
+// Where a build takes its temporaries from; null members mean the heap
+struct BvhScratch
+{
+    LinearArena* arena = nullptr;
+    NodePool<BvhBuildNode>* nodes = nullptr;
+
+    BvhScratch(LinearArena* a = nullptr, NodePool<BvhBuildNode>* n = nullptr) : arena(a), nodes(n) {}
+};
+
+// Builds the flat node array over a set of primitive boxes. Leaves refer to
+// [leftFirst, leftFirst + count) of order, which lists the primitive indices
+// in leaf order. Shared by the bottom and top level structures.
+class BvhBuilder
+{
+    public:
+        void Build(const std::vector<Aabb>& boxes, const BvhBuildOptions& options, BvhNodeArray& nodes, std::vector<uint32_t>& order,
+                   const BvhScratch& scratch = BvhScratch())
+        {
+            Build(boxes.data(), static_cast<uint32_t>(boxes.size()), options, nodes, order, scratch);
+        }
+
+        void Build(const Aabb* boxes, uint32_t n, const BvhBuildOptions& options, BvhNodeArray& nodes, std::vector<uint32_t>& order,
+                   const BvhScratch& scratch = BvhScratch())
+        {
+            _options = options;
+            nodes.clear();
+            order.clear();
+            if (n == 0) return;
+
+            std::vector<BuildRef, ArenaAllocator<BuildRef>> refs(n, BuildRef(), ArenaAllocator<BuildRef>(scratch.arena));
+            _refs = refs.data();
+            for (uint32_t i = 0; i < n; i++)
+            {
+                _refs[i].box = boxes[i];
+                _refs[i].centroid = boxes[i].Center();
+                _refs[i].primitive = i;
+            }
+
+            // A tree over n primitives has fewer than 2n nodes
+            _buildNodes = scratch.nodes ? scratch.nodes : &_ownNodes;
+            _buildNodes->Prepare(2 * size_t(n));
+            int parallelDepth = 0;
+            while ((1 << parallelDepth) < 2 * options.threads) parallelDepth++;
+            uint32_t root = BuildSubtree(0, n, 0, options.threads > 1 ? parallelDepth : 0);
+
+            // Flatten the pointer tree into sibling pairs, in depth first order
+            // of the pairs so subtrees stay contiguous
+            _nodes = &nodes;
+            nodes.resize(_buildNodes->Count() + 1);
+            _nodesUsed = 2;
+            Flatten(root, 0);
+            nodes.resize(_nodesUsed);
+
+            order.resize(n);
+            for (uint32_t i = 0; i < n; i++) order[i] = _refs[i].primitive;
+            _refs = nullptr;
+        }
+
+    private:
+        // Primitive bounds, moved around by the partitioning so every node
+        // scans a contiguous range
+        struct BuildRef
+        {
+            Aabb box;
+            Float3 centroid;
+            uint32_t primitive;
+        };
+
+        // Plain floats rather than an Aabb so a set of bins needs no
+        // construction; only the bins a node uses are reset
+        struct Bin
+        {
+            float bmin[3], bmax[3];
+            uint32_t count;
+
+            void Reset()
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    bmin[k] = std::numeric_limits<float>::max();
+                    bmax[k] = -std::numeric_limits<float>::max();
+                }
+                count = 0;
+            }
+
+            void Grow(const Bin& other)
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    bmin[k] = std::min(bmin[k], other.bmin[k]);
+                    bmax[k] = std::max(bmax[k], other.bmax[k]);
+                }
+                count += other.count;
+            }
+
+            float HalfArea() const
+            {
+                if (count == 0) return 0.0f;
+                float x = bmax[0] - bmin[0], y = bmax[1] - bmin[1], z = bmax[2] - bmin[2];
+                return x * y + y * z + z * x;
+            }
+        };
+
+        // Small nodes get fewer bins, there is little to choose from anyway
+        struct Bins
+        {
+            int count;
+            float lo[3];
+            float scale[3]; // 0 on axes where every centroid is equal
+            Bin bins[3][kSahBins];
+
+            Bins(uint32_t refs, const Aabb& centroids) : count(static_cast<int>(std::min<uint32_t>(kSahBins, std::max<uint32_t>(refs, 2))))
+            {
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    float extent = centroids.bmax[axis] - centroids.bmin[axis];
+                    lo[axis] = centroids.bmin[axis];
+                    scale[axis] = extent > 0.0f ? count / extent : 0.0f;
+                    for (int b = 0; b < count; b++) bins[axis][b].Reset();
+                }
+            }
+
+            int Index(int axis, float c) const
+            {
+                return std::min(count - 1, std::max(0, static_cast<int>((c - lo[axis]) * scale[axis])));
+            }
+        };
+
+        void FillBins(uint32_t first, uint32_t last, Bins& out) const
+        {
+            for (uint32_t i = first; i < last; i++)
+            {
+                const BuildRef& ref = _refs[i];
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    if (out.scale[axis] == 0.0f) continue;
+
+                    Bin& bin = out.bins[axis][out.Index(axis, ref.centroid[axis])];
+                    for (int k = 0; k < 3; k++)
+                    {
+                        bin.bmin[k] = std::min(bin.bmin[k], ref.box.bmin[k]);
+                        bin.bmax[k] = std::max(bin.bmax[k], ref.box.bmax[k]);
+                    }
+                    bin.count++;
+                }
+            }
+        }
+
+        void FillBinsParallel(uint32_t first, uint32_t count, Bins& out) const
+        {
+            const int threads = _options.threads;
+            std::vector<Bins> partial(threads, out);
+            std::vector<std::thread> workers;
+            for (int t = 1; t < threads; t++)
+            {
+                workers.emplace_back([&, t]() {
+                    FillBins(first + uint64_t(count) * t / threads, first + uint64_t(count) * (t + 1) / threads, partial[t]);
+                });
+            }
+            FillBins(first, first + count / threads, partial[0]);
+            for (std::thread& worker : workers) worker.join();
+
+            for (const Bins& bins : partial)
+            {
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    for (int b = 0; b < out.count; b++) out.bins[axis][b].Grow(bins.bins[axis][b]);
+                }
+            }
+        }
+
+        // Finds the cheapest bin boundary over all three axes: the split puts
+        // the refs in bins [0, bestBin) of bins.bins[bestAxis] on the left.
+        // Returns its cost relative to the intersection cost, or infinity if
+        // nothing splits.
+        float FindSahSplit(uint32_t first, uint32_t count, Bins& bins, int& bestAxis, int& bestBin) const
+        {
+            if (count >= kParallelBinThreshold && _options.threads > 1) FillBinsParallel(first, count, bins);
+            else FillBins(first, first + count, bins);
+
+            float bestCost = std::numeric_limits<float>::infinity();
+            for (int axis = 0; axis < 3; axis++)
+            {
+                if (bins.scale[axis] == 0.0f) continue;
+
+                // Sweep from the right to get the cost of every right side,
+                // then from the left to combine both
+                float rightCost[kSahBins];
+                Bin side;
+                side.Reset();
+                for (int b = bins.count - 1; b > 0; b--)
+                {
+                    side.Grow(bins.bins[axis][b]);
+                    rightCost[b] = side.HalfArea() * side.count;
+                }
+
+                side.Reset();
+                for (int b = 0; b < bins.count - 1; b++)
+                {
+                    side.Grow(bins.bins[axis][b]);
+                    if (side.count == 0 || side.count == count) continue;
+
+                    float cost = side.HalfArea() * side.count + rightCost[b + 1];
+                    if (cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestBin = b + 1;
+                    }
+                }
+            }
+            return bestCost;
+        }
+
+        uint32_t MakeLeaf(uint32_t index, uint32_t first, uint32_t count)
+        {
+            (*_buildNodes)[index].first = first;
+            (*_buildNodes)[index].count = count;
+            return index;
+        }
+
+        uint32_t BuildSubtree(uint32_t first, uint32_t count, int depth, int parallelDepth)
+        {
+            const uint32_t index = _buildNodes->Allocate();
+            BvhBuildNode& node = (*_buildNodes)[index];
+
+            Aabb centroids;
+            for (uint32_t i = first; i < first + count; i++)
+            {
+                node.box.Grow(_refs[i].box);
+                centroids.Grow(_refs[i].centroid);
+            }
+            node.count = 0;
+            if (count == 1) return MakeLeaf(index, first, count);
+
+            BuildRef* begin = _refs + first;
+            BuildRef* end = begin + count;
+            BuildRef* mid = nullptr;
+
+            // Deep trees would overflow the traversal stack, median splits
+            // bound the depth of what is left
+            bool median = _options.split == BvhSplit::Median || depth >= kMaxBvhDepth - 24;
+            if (!median)
+            {
+                int axis = 0, bin = 0;
+                Bins bins(count, centroids);
+                float splitCost = FindSahSplit(first, count, bins, axis, bin);
+                float leafCost = count * kIntersectionCost;
+                float area = node.box.HalfArea();
+                splitCost = kTraversalCost + (area > 0.0f ? splitCost / area : splitCost) * kIntersectionCost;
+
+                if (splitCost < std::numeric_limits<float>::infinity())
+                {
+                    if (splitCost >= leafCost && count <= _options.maxLeafSize) return MakeLeaf(index, first, count);
+
+                    mid = std::partition(begin, end, [&](const BuildRef& ref) {
+                        return bins.Index(axis, ref.centroid[axis]) < bin;
+                    });
+                }
+                else if (count <= _options.maxLeafSize)
+                {
+                    // Every centroid is in the same spot
+                    return MakeLeaf(index, first, count);
+                }
+            }
+            if (mid == nullptr)
+            {
+                if (count <= _options.maxLeafSize) return MakeLeaf(index, first, count);
+
+                int axis = centroids.LongestAxis();
+                mid = begin + count / 2;
+                std::nth_element(begin, mid, end, [&](const BuildRef& a, const BuildRef& b) {
+                    return a.centroid[axis] < b.centroid[axis];
+                });
+            }
+
+            uint32_t leftCount = static_cast<uint32_t>(mid - begin);
+            if (parallelDepth > 0 && count >= kParallelBuildGrain)
+            {
+                std::future<uint32_t> left = std::async(std::launch::async, [=]() {
+                    return BuildSubtree(first, leftCount, depth + 1, parallelDepth - 1);
+                });
+                uint32_t right = BuildSubtree(first + leftCount, count - leftCount, depth + 1, parallelDepth - 1);
+                node.left = left.get();
+                node.right = right;
+            }
+            else
+            {
+                uint32_t left = BuildSubtree(first, leftCount, depth + 1, 0);
+                uint32_t right = BuildSubtree(first + leftCount, count - leftCount, depth + 1, 0);
+                node.left = left;
+                node.right = right;
+            }
+            return index;
+        }
+
+        void Flatten(uint32_t buildIndex, uint32_t flatIndex)
+        {
+            const BvhBuildNode& src = (*_buildNodes)[buildIndex];
+            BvhNode& dst = (*_nodes)[flatIndex];
+            dst.bmin = src.box.bmin;
+            dst.bmax = src.box.bmax;
+            if (src.count > 0)
+            {
+                dst.leftFirst = src.first;
+                dst.count = src.count;
+                return;
+            }
+
+            uint32_t pair = _nodesUsed;
+            _nodesUsed += 2;
+            dst.leftFirst = pair;
+            dst.count = 0;
+            Flatten(src.left, pair);
+            Flatten(src.right, pair + 1);
+        }
+
+        BvhBuildOptions _options;
+        BvhNodeArray* _nodes;
+        BuildRef* _refs = nullptr;
+        NodePool<BvhBuildNode>* _buildNodes = nullptr;
+        NodePool<BvhBuildNode> _ownNodes; // used when the scratch has no pool
+        uint32_t _nodesUsed;
+};
+
+inline float BvhNodeArea(const BvhNode& node) { return Aabb(node.bmin, node.bmax).HalfArea(); }
+
+// Expected cost of a random ray hitting the root, in primitive
+// intersections: the surface area heuristic summed over the tree
+inline float BvhSahCost(const BvhNodeArray& nodes)
+{
+    if (nodes.empty()) return 0.0f;
+
+    const float rootArea = BvhNodeArea(nodes[0]);
+    float cost = 0.0f;
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        if (i == 1) continue;
+        const BvhNode& node = nodes[i];
+        float ratio = rootArea > 0.0f ? BvhNodeArea(node) / rootArea : 1.0f;
+        cost += ratio * (node.IsLeaf() ? kIntersectionCost * node.count : kTraversalCost);
+    }
+    return cost;
+}
+
+inline int BvhDepth(const BvhNodeArray& nodes, uint32_t index = 0)
+{
+    if (nodes.empty()) return 0;
+
+    const BvhNode& node = nodes[index];
+    if (node.IsLeaf()) return 1;
+    return 1 + std::max(BvhDepth(nodes, node.leftFirst), BvhDepth(nodes, node.leftFirst + 1));
+}
+
+// Closest hit traversal shared by both levels. intersectLeaf(first, count)
+// tests the primitives of a leaf against the ray, shrinking hit.t, and
+// returns whether it found a closer hit.
+template <typename LeafFn>
+bool TraverseBvh(const BvhNodeArray& nodes, const Ray& ray, Hit& hit, LeafFn intersectLeaf)
+{
+    if (nodes.empty()) return false;
+
+    const Float3 invDir = SafeInverse(ray.direction);
+    const float kMiss = std::numeric_limits<float>::infinity();
+    if (IntersectAabb(ray, invDir, nodes[0].bmin, nodes[0].bmax, std::min(ray.tMax, hit.t)) == kMiss) return false;
+
+    uint32_t stack[kMaxBvhDepth];
+    int top = 0;
+    uint32_t index = 0;
+    bool found = false;
+    while (true)
+    {
+        const BvhNode& node = nodes[index];
+        if (node.IsLeaf())
+        {
+            found |= intersectLeaf(node.leftFirst, node.count);
+            if (top == 0) break;
+            index = stack[--top];
+            continue;
+        }
+
+        // Visit the nearer child first, keep the other one for later
+        uint32_t near = node.leftFirst, far = node.leftFirst + 1;
+        float tMax = std::min(ray.tMax, hit.t);
+        float dNear = IntersectAabb(ray, invDir, nodes[near].bmin, nodes[near].bmax, tMax);
+        float dFar = IntersectAabb(ray, invDir, nodes[far].bmin, nodes[far].bmax, tMax);
+        if (dFar < dNear)
+        {
+            std::swap(near, far);
+            std::swap(dNear, dFar);
+        }
+
+        if (dNear == kMiss)
+        {
+            if (top == 0) break;
+            index = stack[--top];
+            continue;
+        }
+        index = near;
+        if (dFar != kMiss) stack[top++] = far;
+    }
+    return found;
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "Geometry.h"
+
+// 12-byte alternative to Vertex (STriVertex, 28 bytes) for large meshes:
+// positions as 16-bit fractions of the mesh bounds, RGBA8 color and a unit
+// normal in 16-bit octahedral encoding. What it saves is memory, not time:
+// decoding converts and scales every component, and in BenchmarkVertexFetch
+// that costs more than the smaller layout saves in cache misses. Scans take
+// about as long as with Vertex, random triangle fetches about a third longer.
+//
+// Worst case errors, checked by main.cpp:
+//   position: half a quantization step, extent / 65535 / 2 per axis
+//   color:    0.5 / 255 per channel
+//   normal:   kOctahedralMaxErrorDegrees
+//
+// BottomLevelAS can keep its triangles in the same 16-bit form
+// (TriangleFormat::Quantized16), 18 instead of 36 bytes per triangle.
+
+static const float kOctahedralMaxErrorDegrees = 1.5f;
+
+struct CompactVertex
+{
+    uint16_t position[3];
+    uint8_t color[4];
+    uint16_t normal; // octahedral, x in the low byte
+};
+static_assert(sizeof(CompactVertex) == 12, "CompactVertex must stay 12 bytes");
+
+// Maps positions inside the mesh bounds to 16-bit integers and back. Axes
+// where the mesh is flat get scale 0 and decode to the bound.
+struct PositionQuantization
+{
+    Float3 origin;
+    Float3 step;    // size of one quantization step
+    Float3 invStep; // 1 / step, 0 on flat axes
+
+    PositionQuantization() {}
+    explicit PositionQuantization(const Aabb& bounds) : origin(bounds.bmin)
+    {
+        Float3 extent = bounds.Extent();
+        for (int axis = 0; axis < 3; axis++)
+        {
+            step[axis] = extent[axis] / 65535.0f;
+            invStep[axis] = extent[axis] > 0.0f ? 65535.0f / extent[axis] : 0.0f;
+        }
+    }
+
+    void Encode(const Float3& p, uint16_t* q) const
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float x = (p[axis] - origin[axis]) * invStep[axis];
+            q[axis] = static_cast<uint16_t>(std::min(65535.0f, std::max(0.0f, x + 0.5f)));
+        }
+    }
+
+    Float3 Decode(const uint16_t* q) const
+    {
+        return Float3(origin.x + q[0] * step.x, origin.y + q[1] * step.y, origin.z + q[2] * step.z);
+    }
+};
+
+inline uint8_t EncodeUnorm8(float x) { return static_cast<uint8_t>(std::min(1.0f, std::max(0.0f, x)) * 255.0f + 0.5f); }
+inline float DecodeUnorm8(uint8_t x) { return x * (1.0f / 255.0f); }
+
+inline uint8_t EncodeSnorm8(float x) { return static_cast<uint8_t>(static_cast<int8_t>(lrintf(std::min(1.0f, std::max(-1.0f, x)) * 127.0f))); }
+inline float DecodeSnorm8(uint8_t x) { return std::max(-1.0f, static_cast<int8_t>(x) / 127.0f); }
+
+// Octahedral normal encoding: project onto the octahedron |x| + |y| + |z| = 1,
+// fold the lower half over the diagonals, store x and y as snorm8
+inline uint16_t EncodeOctahedral(const Float3& n)
+{
+    float sum = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    float x = n.x / sum, y = n.y / sum;
+    if (n.z < 0.0f)
+    {
+        float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+    return static_cast<uint16_t>(EncodeSnorm8(x) | (EncodeSnorm8(y) << 8));
+}
+
+inline Float3 DecodeOctahedral(uint16_t e)
+{
+    float x = DecodeSnorm8(static_cast<uint8_t>(e & 0xFF)), y = DecodeSnorm8(static_cast<uint8_t>(e >> 8));
+    float z = 1.0f - fabsf(x) - fabsf(y);
+    if (z < 0.0f)
+    {
+        float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+    return Normalize(Float3(x, y, z));
+}
+
+// Vertex normals for a triangle list (indices null) or an indexed mesh: the
+// area weighted sum of the face normals around each vertex
+inline std::vector<Float3> ComputeVertexNormals(const Vertex* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount)
+{
+    std::vector<Float3> normals(vertexCount);
+    const size_t count = indices ? indexCount : vertexCount;
+    for (size_t i = 0; i + 2 < count; i += 3)
+    {
+        uint32_t k[3];
+        for (int c = 0; c < 3; c++) k[c] = indices ? indices[i + c] : static_cast<uint32_t>(i + c);
+        Float3 face = Cross(vertices[k[1]].position - vertices[k[0]].position, vertices[k[2]].position - vertices[k[0]].position);
+        for (int c = 0; c < 3; c++) normals[k[c]] = normals[k[c]] + face;
+    }
+    for (Float3& n : normals) n = Length(n) > 0.0f ? Normalize(n) : Float3(0.0f, 0.0f, 1.0f);
+    return normals;
+}
+
+// A vertex buffer in compact form, with the quantization to decode it
+struct CompactVertexBuffer
+{
+    PositionQuantization quantization;
+    std::vector<CompactVertex> vertices;
+
+    CompactVertexBuffer() {}
+    CompactVertexBuffer(const Vertex* source, size_t count, const uint32_t* indices = nullptr, size_t indexCount = 0)
+    {
+        Aabb bounds;
+        for (size_t i = 0; i < count; i++) bounds.Grow(source[i].position);
+        quantization = PositionQuantization(bounds);
+
+        std::vector<Float3> normals = ComputeVertexNormals(source, count, indices, indexCount);
+        vertices.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            quantization.Encode(source[i].position, vertices[i].position);
+            const Float4& c = source[i].color;
+            vertices[i].color[0] = EncodeUnorm8(c.x);
+            vertices[i].color[1] = EncodeUnorm8(c.y);
+            vertices[i].color[2] = EncodeUnorm8(c.z);
+            vertices[i].color[3] = EncodeUnorm8(c.w);
+            vertices[i].normal = EncodeOctahedral(normals[i]);
+        }
+    }
+
+    Float3 Position(size_t i) const { return quantization.Decode(vertices[i].position); }
+    Float4 Color(size_t i) const
+    {
+        const uint8_t* c = vertices[i].color;
+        return Float4(DecodeUnorm8(c[0]), DecodeUnorm8(c[1]), DecodeUnorm8(c[2]), DecodeUnorm8(c[3]));
+    }
+    Float3 Normal(size_t i) const { return DecodeOctahedral(vertices[i].normal); }
+
+    size_t Bytes() const { return vertices.size() * sizeof(CompactVertex); }
+};
+
+// How BottomLevelAS stores the triangles it intersects
+enum class TriangleFormat
+{
+    Float,       // three Float3, 36 bytes
+    Quantized16, // three 16-bit positions in the BLAS bounds, 18 bytes
+};
+
+struct QuantizedTriangle
+{
+    uint16_t v[3][3];
+};
+static_assert(sizeof(QuantizedTriangle) == 18, "QuantizedTriangle must stay 18 bytes");
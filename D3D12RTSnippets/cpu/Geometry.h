@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Math.h"
+
+// Same layout as the Vertex used by CreatePlaneVB / CreateMengerSpongeVB
+// and STriVertex in Hit.hlsl: a position and an RGBA color
+struct Vertex
+{
+    Float3 position;
+    Float4 color;
+};
+
+// Vertex buffer and vertex count, as passed to CreateBottomLevelAS. Every
+// three consecutive vertices form a triangle.
+typedef std::pair<const Vertex*, uint32_t> VertexBufferDesc;
+
+struct Triangle
+{
+    Float3 v0, v1, v2;
+
+    Aabb Bounds() const
+    {
+        Aabb box;
+        box.Grow(v0);
+        box.Grow(v1);
+        box.Grow(v2);
+        return box;
+    }
+
+    Float3 Centroid() const { return (v0 + v1 + v2) * (1.0f / 3.0f); }
+};
+
+static const uint32_t kNoHit = 0xFFFFFFFFu;
+
+// Closest hit found so far. (u, v) are the barycentric weights of v1 and v2,
+// as in the DXR built-in triangle attributes. primitive is PrimitiveIndex()
+// within the BLAS, instance the index of the instance in the TLAS.
+struct Hit
+{
+    float t;
+    float u, v;
+    uint32_t primitive;
+    uint32_t instance;
+
+    Hit() : t(std::numeric_limits<float>::max()), u(0.0f), v(0.0f), primitive(kNoHit), instance(kNoHit) {}
+
+    bool Valid() const { return primitive != kNoHit; }
+};
+
+// Moller-Trumbore, two sided. Updates hit and returns true when the triangle
+// is hit in [ray.tMin, min(ray.tMax, hit.t)). A hit at exactly hit.t (an edge
+// shared with the current triangle) goes to the lower primitive index, so the
+// result does not depend on the order triangles are tested in.
+inline bool IntersectTriangle(const Ray& ray, const Triangle& tri, uint32_t primitive, Hit& hit)
+{
+    const float kEpsilon = 1e-9f;
+
+    Float3 e1 = tri.v1 - tri.v0;
+    Float3 e2 = tri.v2 - tri.v0;
+    Float3 p = Cross(ray.direction, e2);
+    float det = Dot(e1, p);
+    if (fabsf(det) < kEpsilon) return false;
+
+    float invDet = 1.0f / det;
+    Float3 s = ray.origin - tri.v0;
+    float u = Dot(s, p) * invDet;
+    if (u < 0.0f || u > 1.0f) return false;
+
+    Float3 q = Cross(s, e1);
+    float v = Dot(ray.direction, q) * invDet;
+    if (v < 0.0f || u + v > 1.0f) return false;
+
+    float t = Dot(e2, q) * invDet;
+    if (t < ray.tMin || t >= ray.tMax || t > hit.t) return false;
+    if (t == hit.t && primitive >= hit.primitive) return false;
+
+    hit.t = t;
+    hit.u = u;
+    hit.v = v;
+    hit.primitive = primitive;
+    return true;
+}
+
+// Flattens vertex buffers into triangles, in buffer order, so primitive i
+// is vertices 3i .. 3i + 2 of the concatenated buffers. alloc lets build
+// temporaries come from a scratch arena.
+template <typename Alloc = std::allocator<Triangle>>
+inline std::vector<Triangle, Alloc> GatherTriangles(const std::vector<VertexBufferDesc>& vertexBuffers, const Alloc& alloc = Alloc())
+{
+    size_t count = 0;
+    for (const VertexBufferDesc& buffer : vertexBuffers) count += buffer.second / 3;
+
+    std::vector<Triangle, Alloc> triangles(alloc);
+    triangles.reserve(count);
+    for (const VertexBufferDesc& buffer : vertexBuffers)
+    {
+        for (uint32_t i = 0; i + 2 < buffer.second; i += 3)
+        {
+            triangles.push_back(Triangle { buffer.first[i].position, buffer.first[i + 1].position, buffer.first[i + 2].position });
+        }
+    }
+    return triangles;
+}
+
+// Same for an indexed buffer pair: primitive i is indices 3i .. 3i + 2
+inline std::vector<Triangle> GatherTriangles(const Vertex* vertices, const uint32_t* indices, size_t indexCount)
+{
+    std::vector<Triangle> triangles;
+    triangles.reserve(indexCount / 3);
+    for (size_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        triangles.push_back(Triangle { vertices[indices[i]].position, vertices[indices[i + 1]].position, vertices[indices[i + 2]].position });
+    }
+    return triangles;
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "Renderer.h"
+#include "TileScheduler.h"
+
+// Renderer that keeps the previous frame and re-traces only the tiles whose
+// pixels can have changed. Each frame it compares every instance transform
+// with the one it last rendered; for a moved instance it marks the screen
+// tiles under its old and its new world box. The camera is the orthographic
+// RayGen one, so a box covers the pixels of its x / y extent whatever its
+// depth. With shadows on, a box also darkens everything behind it along the
+// light, so the box is swept away from the light through the scene bounds
+// first. Marked tiles go through the same RenderTile calls as a full frame,
+// so the image is the same one Renderer would draw, and frame time follows
+// the area that changed rather than the resolution.
+//
+// Transforms are the only change detected. Rebuilding a BLAS, editing hit
+// groups or swapping the TLAS needs Invalidate or InvalidateAll first.
+
+class IncrementalRenderer
+{
+    public:
+        explicit IncrementalRenderer(int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency())), int tileSize = 16,
+                                     TraceMode mode = TraceMode::Single)
+            : _threads(std::max(1, threads)), _tileSize(tileSize), _mode(HasAvx2() ? mode : TraceMode::Single), _full(true)
+        {
+        }
+
+        // Brings image up to date with scene. image has to hold the previous
+        // frame; the first frame, and any frame after InvalidateAll or a
+        // change of size, light or instance count, is drawn in full.
+        RenderStats Render(const Scene& scene, Image& image)
+        {
+            auto start = std::chrono::steady_clock::now();
+            const int tilesX = (image.width + _tileSize - 1) / _tileSize;
+            const int tilesY = (image.height + _tileSize - 1) / _tileSize;
+            const uint32_t count = static_cast<uint32_t>(scene.tlas->InstanceCount());
+
+            if (tilesX != _tilesX || tilesY != _tilesY || count != _transforms.size() || scene.shadows != _shadows
+                || memcmp(&scene.toLight, &_toLight, sizeof(Float3)) != 0)
+            {
+                _full = true;
+            }
+            _tilesX = tilesX;
+            _tilesY = tilesY;
+            _shadows = scene.shadows;
+            _toLight = scene.toLight;
+            _transforms.resize(count);
+            _bounds.resize(count);
+            _invalid.resize(count, 0);
+            _dirty.assign(size_t(tilesX) * tilesY, _full ? 1 : 0);
+
+            for (uint32_t i = 0; i < count; i++)
+            {
+                const Matrix34& transform = scene.tlas->GetInstance(i).transform;
+                if (!_full && !_invalid[i] && memcmp(&transform, &_transforms[i], sizeof(Matrix34)) == 0) continue;
+
+                if (!_full)
+                {
+                    MarkBox(scene, image, _bounds[i]);
+                    MarkBox(scene, image, scene.tlas->WorldBounds(i));
+                }
+                _transforms[i] = transform;
+                _bounds[i] = scene.tlas->WorldBounds(i);
+                _invalid[i] = 0;
+            }
+            _full = false;
+
+            _tiles.clear();
+            for (int tile = 0; tile < tilesX * tilesY; tile++)
+            {
+                if (_dirty[tile]) _tiles.push_back(tile);
+            }
+
+            uint64_t rays = 0;
+            TileScheduler scheduler(static_cast<int>(_tiles.size()), _threads);
+            scheduler.Run([&](int index, int) {
+                int tile = _tiles[index];
+                int x0 = (tile % tilesX) * _tileSize, y0 = (tile / tilesX) * _tileSize;
+                Renderer::RenderTile(scene, image, x0, y0, std::min(image.width, x0 + _tileSize), std::min(image.height, y0 + _tileSize), _mode);
+            });
+            for (int tile : _tiles)
+            {
+                int x0 = (tile % tilesX) * _tileSize, y0 = (tile / tilesX) * _tileSize;
+                rays += uint64_t(std::min(image.width, x0 + _tileSize) - x0) * (std::min(image.height, y0 + _tileSize) - y0);
+            }
+
+            RenderStats stats;
+            stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            stats.rays = rays;
+            return stats;
+        }
+
+        // Re-traces the area of instance next frame even if it did not move,
+        // e.g. after its BLAS was rebuilt
+        void Invalidate(uint32_t instance)
+        {
+            if (instance < _invalid.size()) _invalid[instance] = 1;
+        }
+
+        void InvalidateAll() { _full = true; }
+
+        // Tiles traced by the last Render, out of TileCount()
+        int DirtyTiles() const { return static_cast<int>(_tiles.size()); }
+        int TileCount() const { return _tilesX * _tilesY; }
+        TraceMode Mode() const { return _mode; }
+
+    private:
+        // Marks the tiles under box as seen by the RayGen camera, with a pixel
+        // to spare on each side for rays that graze the box edges
+        void MarkBox(const Scene& scene, const Image& image, Aabb box)
+        {
+            if (box.Empty()) return;
+            if (scene.shadows && !SweepFromLight(scene, box))
+            {
+                std::fill(_dirty.begin(), _dirty.end(), 1);
+                return;
+            }
+
+            // RayGen: world x = ((x + 0.5) / width) * 2 - 1, world y the same
+            // with y flipped
+            int x0 = static_cast<int>(floorf((box.bmin.x + 1.0f) * 0.5f * image.width - 0.5f)) - 1;
+            int x1 = static_cast<int>(ceilf((box.bmax.x + 1.0f) * 0.5f * image.width - 0.5f)) + 1;
+            int y0 = static_cast<int>(floorf((1.0f - box.bmax.y) * 0.5f * image.height - 0.5f)) - 1;
+            int y1 = static_cast<int>(ceilf((1.0f - box.bmin.y) * 0.5f * image.height - 0.5f)) + 1;
+            x0 = std::max(x0, 0);
+            y0 = std::max(y0, 0);
+            x1 = std::min(x1, image.width - 1);
+            y1 = std::min(y1, image.height - 1);
+            if (x0 > x1 || y0 > y1) return;
+
+            for (int ty = y0 / _tileSize; ty <= y1 / _tileSize; ty++)
+            {
+                for (int tx = x0 / _tileSize; tx <= x1 / _tileSize; tx++) _dirty[size_t(ty) * _tilesX + tx] = 1;
+            }
+        }
+
+        // Grows box by the points it can shadow: those behind it along the
+        // light, down to the far side of the scene. False when that does not
+        // end (light parallel to the view plane).
+        static bool SweepFromLight(const Scene& scene, Aabb& box)
+        {
+            const Float3& l = scene.toLight;
+            Aabb sceneBounds = scene.tlas->Bounds();
+            float reach;
+            if (l.z > 0.0f) reach = (box.bmax.z - sceneBounds.bmin.z) / l.z;
+            else if (l.z < 0.0f) reach = (sceneBounds.bmax.z - box.bmin.z) / -l.z;
+            else return false;
+
+            Float3 shift = l * std::max(0.0f, reach);
+            box.Grow(Aabb(box.bmin - shift, box.bmax - shift));
+            return true;
+        }
+
+        int _threads;
+        int _tileSize;
+        TraceMode _mode;
+        bool _full;
+
+        int _tilesX = 0;
+        int _tilesY = 0;
+        bool _shadows = false;
+        Float3 _toLight;
+
+        // State of the last frame per instance
+        std::vector<Matrix34> _transforms;
+        std::vector<Aabb> _bounds;
+        std::vector<uint8_t> _invalid;
+
+        std::vector<uint8_t> _dirty;
+        std::vector<int> _tiles;
+};
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <math.h>
+#include <algorithm>
+#include <limits>
+
+// Minimal float3 / float4 math for the CPU port of the DXR sample, named
+// after the HLSL types the shaders use.
+
+struct Float3
+{
+    float x, y, z;
+
+    Float3() : x(0.0f), y(0.0f), z(0.0f) {}
+    Float3(float x_, float y_, float z_) : x(x_), y(y_), z(z_) {}
+    explicit Float3(float s) : x(s), y(s), z(s) {}
+
+    float operator[](int axis) const { return (&x)[axis]; }
+    float& operator[](int axis) { return (&x)[axis]; }
+};
+
+inline Float3 operator+(const Float3& a, const Float3& b) { return Float3(a.x + b.x, a.y + b.y, a.z + b.z); }
+inline Float3 operator-(const Float3& a, const Float3& b) { return Float3(a.x - b.x, a.y - b.y, a.z - b.z); }
+inline Float3 operator*(const Float3& a, const Float3& b) { return Float3(a.x * b.x, a.y * b.y, a.z * b.z); }
+inline Float3 operator*(const Float3& a, float s) { return Float3(a.x * s, a.y * s, a.z * s); }
+inline Float3 operator*(float s, const Float3& a) { return a * s; }
+inline Float3 operator-(const Float3& a) { return Float3(-a.x, -a.y, -a.z); }
+
+inline float Dot(const Float3& a, const Float3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Float3 Cross(const Float3& a, const Float3& b)
+{
+    return Float3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+inline float Length(const Float3& a) { return sqrtf(Dot(a, a)); }
+inline Float3 Normalize(const Float3& a) { return a * (1.0f / Length(a)); }
+
+inline Float3 Min(const Float3& a, const Float3& b)
+{
+    return Float3(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z));
+}
+inline Float3 Max(const Float3& a, const Float3& b)
+{
+    return Float3(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z));
+}
+
+struct Float4
+{
+    float x, y, z, w;
+
+    Float4() : x(0.0f), y(0.0f), z(0.0f), w(0.0f) {}
+    Float4(float x_, float y_, float z_, float w_) : x(x_), y(y_), z(z_), w(w_) {}
+};
+
+inline Float4 operator+(const Float4& a, const Float4& b) { return Float4(a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w); }
+inline Float4 operator*(const Float4& a, float s) { return Float4(a.x * s, a.y * s, a.z * s, a.w * s); }
+
+// Axis aligned box, empty (min > max) by default so growing it by the
+// first point gives that point
+struct Aabb
+{
+    Float3 bmin;
+    Float3 bmax;
+
+    Aabb() : bmin(std::numeric_limits<float>::max()), bmax(-std::numeric_limits<float>::max()) {}
+    Aabb(const Float3& lo, const Float3& hi) : bmin(lo), bmax(hi) {}
+
+    void Grow(const Float3& p)
+    {
+        bmin = Min(bmin, p);
+        bmax = Max(bmax, p);
+    }
+
+    void Grow(const Aabb& box)
+    {
+        bmin = Min(bmin, box.bmin);
+        bmax = Max(bmax, box.bmax);
+    }
+
+    bool Empty() const { return bmin.x > bmax.x; }
+    Float3 Center() const { return (bmin + bmax) * 0.5f; }
+    Float3 Extent() const { return bmax - bmin; }
+
+    // Half the surface area, which is all the SAH ratios need
+    float HalfArea() const
+    {
+        if (Empty()) return 0.0f;
+        Float3 e = Extent();
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+
+    int LongestAxis() const
+    {
+        Float3 e = Extent();
+        return e.x > e.y && e.x > e.z ? 0 : (e.y > e.z ? 1 : 2);
+    }
+};
+
+// Same fields as the HLSL RayDesc
+struct Ray
+{
+    Float3 origin;
+    float tMin;
+    Float3 direction;
+    float tMax;
+};
+
+// Affine transform stored as the top three rows of a 4x4 matrix, the same
+// 3x4 layout as D3D12_RAYTRACING_INSTANCE_DESC::Transform. Points are column
+// vectors: p' = M * (p, 1).
+struct Matrix34
+{
+    float m[3][4];
+
+    static Matrix34 Identity() { return Translation(0.0f, 0.0f, 0.0f); }
+
+    // Same as XMMatrixTranslation
+    static Matrix34 Translation(float x, float y, float z)
+    {
+        Matrix34 r = { { { 1.0f, 0.0f, 0.0f, x }, { 0.0f, 1.0f, 0.0f, y }, { 0.0f, 0.0f, 1.0f, z } } };
+        return r;
+    }
+
+    static Matrix34 RotationY(float angle)
+    {
+        float c = cosf(angle), s = sinf(angle);
+        Matrix34 r = { { { c, 0.0f, s, 0.0f }, { 0.0f, 1.0f, 0.0f, 0.0f }, { -s, 0.0f, c, 0.0f } } };
+        return r;
+    }
+
+    static Matrix34 Scaling(float s)
+    {
+        Matrix34 r = { { { s, 0.0f, 0.0f, 0.0f }, { 0.0f, s, 0.0f, 0.0f }, { 0.0f, 0.0f, s, 0.0f } } };
+        return r;
+    }
+
+    Float3 TransformPoint(const Float3& p) const
+    {
+        return Float3(m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+                      m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+                      m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]);
+    }
+
+    Float3 TransformVector(const Float3& v) const
+    {
+        return Float3(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+                      m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                      m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+    }
+
+    // Box around the transformed box (Arvo): each output axis takes the
+    // smaller / larger product per input axis
+    Aabb TransformBox(const Aabb& box) const
+    {
+        Aabb r;
+        for (int i = 0; i < 3; i++)
+        {
+            r.bmin[i] = r.bmax[i] = m[i][3];
+            for (int j = 0; j < 3; j++)
+            {
+                float a = m[i][j] * box.bmin[j], b = m[i][j] * box.bmax[j];
+                r.bmin[i] += std::min(a, b);
+                r.bmax[i] += std::max(a, b);
+            }
+        }
+        return r;
+    }
+
+    Matrix34 Inverse() const
+    {
+        // Inverse of the 3x3 part by cofactors, then the translation
+        float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+        float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+        float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+        float invDet = 1.0f / (m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02);
+
+        Matrix34 r;
+        r.m[0][0] = c00 * invDet;
+        r.m[1][0] = c01 * invDet;
+        r.m[2][0] = c02 * invDet;
+        r.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * invDet;
+        r.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invDet;
+        r.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * invDet;
+        r.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invDet;
+        r.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * invDet;
+        r.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invDet;
+        for (int i = 0; i < 3; i++)
+        {
+            r.m[i][3] = -(r.m[i][0] * m[0][3] + r.m[i][1] * m[1][3] + r.m[i][2] * m[2][3]);
+        }
+        return r;
+    }
+};
+
+inline Matrix34 operator*(const Matrix34& a, const Matrix34& b)
+{
+    Matrix34 r;
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + (j == 3 ? a.m[i][3] : 0.0f);
+        }
+    }
+    return r;
+}
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Geometry.h"
+
+// Native replacement for the GenerateMengerSponge call of
+// CreateMengerSpongeVB. The sponge of level L is the 3^L grid of cells whose
+// base-3 coordinates never have the middle digit on two axes at the same
+// position; GenerateMengerSponge emits each of its 20^L cubes separately.
+//
+// GenerateMengerSponge here only emits the faces between a solid and an
+// empty cell, the ones a ray can ever hit, and welds their corners on the
+// lattice of cell corners into one indexed vertex buffer. The grid is split
+// into x slabs, one per thread. A first pass counts each slab's faces and
+// marks the used lattice points in a shared bitmap; after a prefix count over
+// the bitmap gives every used point its vertex index, a second pass writes
+// the indices straight into the slab's range of the index buffer. The output
+// does not depend on the thread count.
+//
+// MengerInstancing keeps a level L sponge as 20^(L - B) translated copies of
+// one level B sponge, which is what a TLAS can express.
+
+// Vertex and index buffer pair, three indices per triangle, like m_mengerVB /
+// m_mengerIB
+struct IndexedMesh
+{
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+
+    size_t TriangleCount() const { return indices.size() / 3; }
+    size_t Bytes() const { return vertices.size() * sizeof(Vertex) + indices.size() * sizeof(uint32_t); }
+};
+
+// Whether cell (x, y, z) of the 3^level grid is part of the sponge
+inline bool MengerCellSolid(uint32_t x, uint32_t y, uint32_t z)
+{
+    while (x | y | z)
+    {
+        if ((x % 3 == 1) + (y % 3 == 1) + (z % 3 == 1) >= 2) return false;
+        x /= 3;
+        y /= 3;
+        z /= 3;
+    }
+    return true;
+}
+
+inline uint32_t MengerGridSize(int level)
+{
+    uint32_t n = 1;
+    for (int l = 0; l < level; l++) n *= 3;
+    return n;
+}
+
+// Colors follow the position, so vertices that share a position share a
+// color and can be welded
+inline Vertex MengerVertex(const Float3& unit, float size)
+{
+    return Vertex { (unit - Float3(0.5f)) * size, Float4(unit.x, unit.y, unit.z, 1.0f) };
+}
+
+// The reference layout: every solid cube with all six faces and its own 24
+// vertices, built on one thread
+inline IndexedMesh GenerateMengerSpongeNaive(int level, float size)
+{
+    const uint32_t n = MengerGridSize(level);
+    const float cell = 1.0f / n;
+
+    IndexedMesh mesh;
+    for (uint32_t x = 0; x < n; x++)
+    {
+        for (uint32_t y = 0; y < n; y++)
+        {
+            for (uint32_t z = 0; z < n; z++)
+            {
+                if (!MengerCellSolid(x, y, z)) continue;
+
+                const uint32_t c[3] = { x, y, z };
+                for (int face = 0; face < 6; face++)
+                {
+                    const int axis = face / 2, u = (axis + 1) % 3, v = (axis + 2) % 3;
+                    const uint32_t base = static_cast<uint32_t>(mesh.vertices.size());
+                    for (int corner = 0; corner < 4; corner++)
+                    {
+                        const int k = face % 2 ? corner : (4 - corner) % 4;
+                        Float3 p;
+                        p[axis] = (c[axis] + face % 2) * cell;
+                        p[u] = (c[u] + (k == 1 || k == 2)) * cell;
+                        p[v] = (c[v] + (k >= 2)) * cell;
+                        mesh.vertices.push_back(MengerVertex(p, size));
+                    }
+                    const uint32_t quad[6] = { 0, 1, 2, 0, 2, 3 };
+                    for (uint32_t k : quad) mesh.indices.push_back(base + k);
+                }
+            }
+        }
+    }
+    return mesh;
+}
+
+inline IndexedMesh GenerateMengerSponge(int level, float size, int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency())))
+{
+    const uint32_t n = MengerGridSize(level);
+    const uint32_t m = n + 1; // lattice points per axis
+    const uint64_t points = uint64_t(m) * m * m;
+    const size_t words = static_cast<size_t>((points + 63) / 64);
+    const float cell = 1.0f / n;
+    threads = std::max(1, std::min<int>(threads, n));
+
+    auto parallel = [&](auto body) {
+        std::vector<std::thread> workers;
+        for (int t = 1; t < threads; t++) workers.emplace_back(body, t);
+        body(0);
+        for (std::thread& worker : workers) worker.join();
+    };
+    auto slabBegin = [&](int t) { return static_cast<uint32_t>(uint64_t(n) * t / threads); };
+
+    auto solid = [&](int64_t x, int64_t y, int64_t z) {
+        return x >= 0 && y >= 0 && z >= 0 && x < n && y < n && z < n && MengerCellSolid(uint32_t(x), uint32_t(y), uint32_t(z));
+    };
+
+    // Calls face(corners) for every face between a solid cell of
+    // slab t and an empty one; corners are the lattice indices in winding
+    // order, counter clockwise seen from outside
+    auto forEachFace = [&](int t, auto face) {
+        for (uint32_t x = slabBegin(t); x < slabBegin(t + 1); x++)
+        {
+            for (uint32_t y = 0; y < n; y++)
+            {
+                for (uint32_t z = 0; z < n; z++)
+                {
+                    if (!MengerCellSolid(x, y, z)) continue;
+
+                    const int64_t c[3] = { x, y, z };
+                    for (int f = 0; f < 6; f++)
+                    {
+                        const int axis = f / 2, side = f % 2, u = (axis + 1) % 3, v = (axis + 2) % 3;
+                        int64_t neighbour[3] = { c[0], c[1], c[2] };
+                        neighbour[axis] += side ? 1 : -1;
+                        if (solid(neighbour[0], neighbour[1], neighbour[2])) continue;
+
+                        uint64_t corners[4];
+                        for (int corner = 0; corner < 4; corner++)
+                        {
+                            // The +axis face runs u then v, the -axis face the other way round
+                            const int k = side ? corner : (4 - corner) % 4;
+                            uint64_t p[3];
+                            p[axis] = c[axis] + side;
+                            p[u] = c[u] + (k == 1 || k == 2);
+                            p[v] = c[v] + (k >= 2);
+                            corners[corner] = (p[0] * m + p[1]) * m + p[2];
+                        }
+                        face(corners);
+                    }
+                }
+            }
+        }
+    };
+
+    // Pass 1: faces per slab, used lattice points
+    std::unique_ptr<std::atomic<uint64_t>[]> used(new std::atomic<uint64_t>[words]);
+    for (size_t w = 0; w < words; w++) used[w].store(0, std::memory_order_relaxed);
+    std::vector<uint64_t> slabFaces(threads + 1, 0);
+    parallel([&](int t) {
+        uint64_t faces = 0;
+        forEachFace(t, [&](const uint64_t* corners) {
+            faces++;
+            for (int k = 0; k < 4; k++) used[corners[k] / 64].fetch_or(uint64_t(1) << (corners[k] % 64), std::memory_order_relaxed);
+        });
+        slabFaces[t + 1] = faces;
+    });
+    for (int t = 0; t < threads; t++) slabFaces[t + 1] += slabFaces[t];
+
+    // Vertex index of every used point: used points before its word, plus
+    // the ones below it in the word
+    std::vector<uint32_t> rank(words + 1, 0);
+    std::vector<uint32_t> chunkCount(threads + 1, 0);
+    auto chunkBegin = [&](int t) { return static_cast<size_t>(uint64_t(words) * t / threads); };
+    parallel([&](int t) {
+        uint32_t count = 0;
+        for (size_t w = chunkBegin(t); w < chunkBegin(t + 1); w++) count += __builtin_popcountll(used[w].load(std::memory_order_relaxed));
+        chunkCount[t + 1] = count;
+    });
+    for (int t = 0; t < threads; t++) chunkCount[t + 1] += chunkCount[t];
+
+    IndexedMesh mesh;
+    mesh.vertices.resize(chunkCount[threads]);
+    mesh.indices.resize(slabFaces[threads] * 6);
+    parallel([&](int t) {
+        uint32_t index = chunkCount[t];
+        for (size_t w = chunkBegin(t); w < chunkBegin(t + 1); w++)
+        {
+            rank[w] = index;
+            for (uint64_t bits = used[w].load(std::memory_order_relaxed); bits; bits &= bits - 1)
+            {
+                uint64_t point = uint64_t(w) * 64 + __builtin_ctzll(bits);
+                Float3 p(float(point / (uint64_t(m) * m)), float(point / m % m), float(point % m));
+                mesh.vertices[index++] = MengerVertex(p * cell, size);
+            }
+        }
+    });
+
+    // Pass 2: the same faces again, now as indices
+    parallel([&](int t) {
+        uint32_t* out = mesh.indices.data() + slabFaces[t] * 6;
+        forEachFace(t, [&](const uint64_t* corners) {
+            uint32_t index[4];
+            for (int k = 0; k < 4; k++)
+            {
+                const uint64_t word = used[corners[k] / 64].load(std::memory_order_relaxed);
+                const uint64_t below = word & ((uint64_t(1) << (corners[k] % 64)) - 1);
+                index[k] = rank[corners[k] / 64] + __builtin_popcountll(below);
+            }
+            const uint32_t quad[6] = { index[0], index[1], index[2], index[0], index[2], index[3] };
+            out = std::copy(quad, quad + 6, out);
+        });
+    });
+    return mesh;
+}
+
+// Number of solid cubes and exposed faces of a level sponge, for sizing
+// without generating: 20^level cubes, 2 * 20^level + 4 * 8^level faces
+inline uint64_t MengerCubeCount(int level)
+{
+    uint64_t cubes = 1;
+    for (int l = 0; l < level; l++) cubes *= 20;
+    return cubes;
+}
+
+inline uint64_t MengerFaceCount(int level)
+{
+    uint64_t eights = 1;
+    for (int l = 0; l < level; l++) eights *= 8;
+    return 2 * MengerCubeCount(level) + 4 * eights;
+}
+
+// A level sponge as translated copies of one smaller sponge. The description
+// is the base mesh plus the 20 sub-cube offsets that every level repeats at a
+// third of the scale, so it does not grow with the number of cubes. DXR has a
+// single instance level, so Transforms expands it into the flat TLAS list.
+// Faces between neighbouring copies cannot be culled; every copy keeps its
+// outside.
+class MengerInstancing
+{
+    public:
+        MengerInstancing(int level, float size, int baseLevel, int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency())))
+            : _depth(std::max(0, level - baseLevel)), _size(size)
+        {
+            _base = GenerateMengerSponge(std::min(level, baseLevel), size / MengerGridSize(_depth), threads);
+            for (uint32_t x = 0; x < 3; x++)
+            {
+                for (uint32_t y = 0; y < 3; y++)
+                {
+                    for (uint32_t z = 0; z < 3; z++)
+                    {
+                        if (MengerCellSolid(x, y, z)) _offsets.push_back(Float3(float(x) - 1.0f, float(y) - 1.0f, float(z) - 1.0f));
+                    }
+                }
+            }
+        }
+
+        const IndexedMesh& Base() const { return _base; }
+        int Depth() const { return _depth; }
+        uint64_t InstanceCount() const { return MengerCubeCount(_depth); }
+
+        // Where each copy of the base goes, 20^Depth translations
+        std::vector<Matrix34> Transforms() const
+        {
+            std::vector<Float3> centers(1, Float3());
+            float step = _size / 3.0f;
+            for (int d = 0; d < _depth; d++)
+            {
+                std::vector<Float3> next;
+                next.reserve(centers.size() * _offsets.size());
+                for (const Float3& center : centers)
+                {
+                    for (const Float3& offset : _offsets) next.push_back(center + offset * step);
+                }
+                centers.swap(next);
+                step /= 3.0f;
+            }
+
+            std::vector<Matrix34> transforms;
+            transforms.reserve(centers.size());
+            for (const Float3& c : centers) transforms.push_back(Matrix34::Translation(c.x, c.y, c.z));
+            return transforms;
+        }
+
+        // The hierarchical description: base mesh and offsets
+        size_t Bytes() const { return _base.Bytes() + _offsets.size() * sizeof(Float3) + sizeof(*this); }
+
+    private:
+        int _depth;
+        float _size;
+        IndexedMesh _base;
+        std::vector<Float3> _offsets;
+};
@@ -0,0 +1,346 @@
+#pragma once
+
+#include <stdint.h>
+#include <immintrin.h>
+#include <algorithm>
+
+#include "Bvh.h"
+
+// Eight rays traced together through the binary BVH with AVX2, one lane per
+// ray. The RayGen rays of a 4x2 pixel block start next to each other and
+// share a direction, so they visit almost the same nodes and one traversal
+// step serves all of them.
+//
+// A node is first tested against the whole packet with interval arithmetic
+// (the box of the lane origins times the range of the inverse directions),
+// which rejects it with a handful of scalar operations. Only nodes that pass
+// get the per-lane slab test. The interval test needs every lane to go the
+// same way on each axis; packets that do not are still traced correctly, just
+// without it.
+//
+// The lane tests do the same float operations in the same order as
+// IntersectAabb and IntersectTriangle, and are built for AVX2 without FMA,
+// so a packet finds exactly the hits the single rays would.
+
+static const int kPacketWidth = 8;
+static const int kFullPacket = (1 << kPacketWidth) - 1;
+
+struct alignas(32) RayPacket8
+{
+    float ox[kPacketWidth], oy[kPacketWidth], oz[kPacketWidth];
+    float dx[kPacketWidth], dy[kPacketWidth], dz[kPacketWidth];
+    float tMin[kPacketWidth], tMax[kPacketWidth];
+
+    void Set(int lane, const Ray& ray)
+    {
+        ox[lane] = ray.origin.x;
+        oy[lane] = ray.origin.y;
+        oz[lane] = ray.origin.z;
+        dx[lane] = ray.direction.x;
+        dy[lane] = ray.direction.y;
+        dz[lane] = ray.direction.z;
+        tMin[lane] = ray.tMin;
+        tMax[lane] = ray.tMax;
+    }
+
+    Ray Get(int lane) const
+    {
+        Ray ray;
+        ray.origin = Float3(ox[lane], oy[lane], oz[lane]);
+        ray.direction = Float3(dx[lane], dy[lane], dz[lane]);
+        ray.tMin = tMin[lane];
+        ray.tMax = tMax[lane];
+        return ray;
+    }
+};
+
+// Closest hit per lane, the fields of Hit in the same SoA layout
+struct alignas(32) HitPacket8
+{
+    float t[kPacketWidth], u[kPacketWidth], v[kPacketWidth];
+    uint32_t primitive[kPacketWidth], instance[kPacketWidth];
+
+    HitPacket8()
+    {
+        for (int lane = 0; lane < kPacketWidth; lane++)
+        {
+            t[lane] = std::numeric_limits<float>::max();
+            u[lane] = v[lane] = 0.0f;
+            primitive[lane] = instance[lane] = kNoHit;
+        }
+    }
+
+    Hit Get(int lane) const
+    {
+        Hit hit;
+        hit.t = t[lane];
+        hit.u = u[lane];
+        hit.v = v[lane];
+        hit.primitive = primitive[lane];
+        hit.instance = instance[lane];
+        return hit;
+    }
+};
+
+// Whether the lanes in mask all point the same way on every axis (by the sign
+// of SafeInverse, so -0 and +0 differ), which the interval test needs
+inline bool IsCoherent(const RayPacket8& packet, int mask)
+{
+    const float* d[3] = { packet.dx, packet.dy, packet.dz };
+    for (int axis = 0; axis < 3; axis++)
+    {
+        int negative = 0, positive = 0;
+        for (int lane = 0; lane < kPacketWidth; lane++)
+        {
+            if (!(mask & (1 << lane))) continue;
+            if (signbit(d[axis][lane])) negative++;
+            else positive++;
+        }
+        if (negative && positive) return false;
+    }
+    return true;
+}
+
+// Everything a packet traversal keeps constant: the rays in registers and,
+// for coherent packets, the bounds the interval test works with
+struct PacketRays
+{
+    __m256 ox, oy, oz;
+    __m256 dx, dy, dz;
+    __m256 ix, iy, iz;
+    __m256 tMin, tMax;
+
+    Float3 direction; // of the first active lane, to order children
+    bool coherent;
+    float oMin[3], oMax[3];
+    float invMin[3], invMax[3];
+    bool negative[3];
+    float tMinLo, tMaxHi;
+};
+
+__attribute__((target("avx2")))
+inline void LoadPacketRays(const RayPacket8& packet, int mask, PacketRays& rays)
+{
+    alignas(32) float inv[3][kPacketWidth];
+    for (int lane = 0; lane < kPacketWidth; lane++)
+    {
+        Float3 i = SafeInverse(Float3(packet.dx[lane], packet.dy[lane], packet.dz[lane]));
+        inv[0][lane] = i.x;
+        inv[1][lane] = i.y;
+        inv[2][lane] = i.z;
+    }
+
+    rays.ox = _mm256_load_ps(packet.ox);
+    rays.oy = _mm256_load_ps(packet.oy);
+    rays.oz = _mm256_load_ps(packet.oz);
+    rays.dx = _mm256_load_ps(packet.dx);
+    rays.dy = _mm256_load_ps(packet.dy);
+    rays.dz = _mm256_load_ps(packet.dz);
+    rays.ix = _mm256_load_ps(inv[0]);
+    rays.iy = _mm256_load_ps(inv[1]);
+    rays.iz = _mm256_load_ps(inv[2]);
+    rays.tMin = _mm256_load_ps(packet.tMin);
+    rays.tMax = _mm256_load_ps(packet.tMax);
+
+    const int first = mask ? __builtin_ctz(mask) : 0;
+    rays.direction = Float3(packet.dx[first], packet.dy[first], packet.dz[first]);
+    rays.coherent = mask != 0 && IsCoherent(packet, mask);
+
+    const float* o[3] = { packet.ox, packet.oy, packet.oz };
+    rays.tMinLo = std::numeric_limits<float>::max();
+    rays.tMaxHi = -std::numeric_limits<float>::max();
+    for (int axis = 0; axis < 3; axis++)
+    {
+        rays.oMin[axis] = rays.invMin[axis] = std::numeric_limits<float>::max();
+        rays.oMax[axis] = rays.invMax[axis] = -std::numeric_limits<float>::max();
+        rays.negative[axis] = inv[axis][first] < 0.0f;
+    }
+    for (int lane = 0; lane < kPacketWidth; lane++)
+    {
+        if (!(mask & (1 << lane))) continue;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            rays.oMin[axis] = std::min(rays.oMin[axis], o[axis][lane]);
+            rays.oMax[axis] = std::max(rays.oMax[axis], o[axis][lane]);
+            rays.invMin[axis] = std::min(rays.invMin[axis], inv[axis][lane]);
+            rays.invMax[axis] = std::max(rays.invMax[axis], inv[axis][lane]);
+        }
+        rays.tMinLo = std::min(rays.tMinLo, packet.tMin[lane]);
+        rays.tMaxHi = std::max(rays.tMaxHi, packet.tMax[lane]);
+    }
+}
+
+// Smallest / largest product of a value in [a0, a1] and one in [b0, b1].
+// Rounding is monotonic, so these bound every product computed per lane.
+inline float ProductLo(float a0, float a1, float b0, float b1)
+{
+    return std::min(std::min(a0 * b0, a0 * b1), std::min(a1 * b0, a1 * b1));
+}
+
+inline float ProductHi(float a0, float a1, float b0, float b1)
+{
+    return std::max(std::max(a0 * b0, a0 * b1), std::max(a1 * b0, a1 * b1));
+}
+
+// Mask of the lanes in mask whose ray enters the box in [tMin, tMax]; tMax
+// holds the per-lane limit, the ray's tMax clamped by its current hit
+__attribute__((target("avx2")))
+inline int IntersectAabbPacket(const PacketRays& rays, __m256 tMax, const Float3& bmin, const Float3& bmax, int mask)
+{
+    if (rays.coherent)
+    {
+        // The earliest any lane can enter and the latest any can leave; if
+        // even those miss each other, every lane misses
+        float entryLo = rays.tMinLo, exitHi = rays.tMaxHi;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float entry = rays.negative[axis] ? bmax[axis] : bmin[axis];
+            float exit = rays.negative[axis] ? bmin[axis] : bmax[axis];
+            entryLo = std::max(entryLo, ProductLo(entry - rays.oMax[axis], entry - rays.oMin[axis], rays.invMin[axis], rays.invMax[axis]));
+            exitHi = std::min(exitHi, ProductHi(exit - rays.oMax[axis], exit - rays.oMin[axis], rays.invMin[axis], rays.invMax[axis]));
+        }
+        if (entryLo > exitHi) return 0;
+    }
+
+    __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bmin.x), rays.ox), rays.ix);
+    __m256 t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bmax.x), rays.ox), rays.ix);
+    __m256 tNear = _mm256_min_ps(t1, t2), tFar = _mm256_max_ps(t1, t2);
+    t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bmin.y), rays.oy), rays.iy);
+    t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bmax.y), rays.oy), rays.iy);
+    tNear = _mm256_max_ps(tNear, _mm256_min_ps(t1, t2));
+    tFar = _mm256_min_ps(tFar, _mm256_max_ps(t1, t2));
+    t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bmin.z), rays.oz), rays.iz);
+    t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bmax.z), rays.oz), rays.iz);
+    tNear = _mm256_max_ps(_mm256_max_ps(tNear, _mm256_min_ps(t1, t2)), rays.tMin);
+    tFar = _mm256_min_ps(_mm256_min_ps(tFar, _mm256_max_ps(t1, t2)), tMax);
+    return _mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ)) & mask;
+}
+
+// IntersectTriangle on eight lanes. Returns the lanes of mask that got a
+// closer hit; their hits entries are updated.
+__attribute__((target("avx2")))
+inline int IntersectTrianglePacket(const PacketRays& rays, const Triangle& tri, uint32_t primitive, HitPacket8& hits, int mask)
+{
+    const Float3 e1 = tri.v1 - tri.v0;
+    const Float3 e2 = tri.v2 - tri.v0;
+    const __m256 e1x = _mm256_set1_ps(e1.x), e1y = _mm256_set1_ps(e1.y), e1z = _mm256_set1_ps(e1.z);
+    const __m256 e2x = _mm256_set1_ps(e2.x), e2y = _mm256_set1_ps(e2.y), e2z = _mm256_set1_ps(e2.z);
+
+    // p = Cross(direction, e2), det = Dot(e1, p)
+    __m256 px = _mm256_sub_ps(_mm256_mul_ps(rays.dy, e2z), _mm256_mul_ps(rays.dz, e2y));
+    __m256 py = _mm256_sub_ps(_mm256_mul_ps(rays.dz, e2x), _mm256_mul_ps(rays.dx, e2z));
+    __m256 pz = _mm256_sub_ps(_mm256_mul_ps(rays.dx, e2y), _mm256_mul_ps(rays.dy, e2x));
+    __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    __m256 absDet = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det);
+    __m256 keep = _mm256_cmp_ps(absDet, _mm256_set1_ps(1e-9f), _CMP_NLT_UQ);
+    __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+    // s = origin - v0, u = Dot(s, p) / det
+    __m256 sx = _mm256_sub_ps(rays.ox, _mm256_set1_ps(tri.v0.x));
+    __m256 sy = _mm256_sub_ps(rays.oy, _mm256_set1_ps(tri.v0.y));
+    __m256 sz = _mm256_sub_ps(rays.oz, _mm256_set1_ps(tri.v0.z));
+    __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), invDet);
+    keep = _mm256_and_ps(keep, _mm256_cmp_ps(u, _mm256_setzero_ps(), _CMP_NLT_UQ));
+    keep = _mm256_and_ps(keep, _mm256_cmp_ps(u, _mm256_set1_ps(1.0f), _CMP_NGT_UQ));
+
+    // q = Cross(s, e1), v = Dot(direction, q) / det
+    __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+    __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+    __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+    __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(rays.dx, qx), _mm256_mul_ps(rays.dy, qy)), _mm256_mul_ps(rays.dz, qz)), invDet);
+    keep = _mm256_and_ps(keep, _mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_NLT_UQ));
+    keep = _mm256_and_ps(keep, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_NGT_UQ));
+
+    // t = Dot(e2, q) / det
+    __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+    __m256 closest = _mm256_load_ps(hits.t);
+    keep = _mm256_and_ps(keep, _mm256_cmp_ps(t, rays.tMin, _CMP_NLT_UQ));
+    keep = _mm256_and_ps(keep, _mm256_cmp_ps(t, rays.tMax, _CMP_NGE_UQ));
+    keep = _mm256_and_ps(keep, _mm256_cmp_ps(t, closest, _CMP_NGT_UQ));
+
+    // Ties at hits.t go to the lower primitive index; the sign flip makes the
+    // signed compare an unsigned one
+    const __m256i bias = _mm256_set1_epi32(static_cast<int>(0x80000000u));
+    __m256i lower = _mm256_cmpgt_epi32(_mm256_xor_si256(_mm256_load_si256(reinterpret_cast<const __m256i*>(hits.primitive)), bias),
+                                       _mm256_xor_si256(_mm256_set1_epi32(static_cast<int>(primitive)), bias));
+    __m256 tie = _mm256_cmp_ps(t, closest, _CMP_EQ_OQ);
+    keep = _mm256_andnot_ps(_mm256_andnot_ps(_mm256_castsi256_ps(lower), tie), keep);
+
+    const int hitMask = _mm256_movemask_ps(keep) & mask;
+    if (hitMask == 0) return 0;
+
+    const __m256 select = _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+        _mm256_and_si256(_mm256_set1_epi32(hitMask), _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128)), _mm256_setzero_si256()));
+    _mm256_store_ps(hits.t, _mm256_blendv_ps(closest, t, select));
+    _mm256_store_ps(hits.u, _mm256_blendv_ps(_mm256_load_ps(hits.u), u, select));
+    _mm256_store_ps(hits.v, _mm256_blendv_ps(_mm256_load_ps(hits.v), v, select));
+    for (int bits = hitMask; bits; bits &= bits - 1) hits.primitive[__builtin_ctz(bits)] = primitive;
+    return hitMask;
+}
+
+// Closest hit packet traversal over a binary BVH, the packet version of
+// TraverseBvh. intersectLeaf(first, count, mask) tests the lanes in mask
+// against a leaf and returns the lanes that found a closer hit; so does the
+// traversal. Each node carries the lanes still inside it, so lanes that
+// leave the packet's path stop costing triangle tests.
+template <typename LeafFn>
+__attribute__((target("avx2")))
+int TraversePacket(const BvhNodeArray& nodes, const PacketRays& rays, HitPacket8& hits, int mask, LeafFn intersectLeaf)
+{
+    if (nodes.empty() || mask == 0) return 0;
+
+    auto laneTMax = [&]() __attribute__((target("avx2"))) { return _mm256_min_ps(rays.tMax, _mm256_load_ps(hits.t)); };
+    int active = IntersectAabbPacket(rays, laneTMax(), nodes[0].bmin, nodes[0].bmax, mask);
+    if (active == 0) return 0;
+
+    struct Entry
+    {
+        uint32_t index;
+        int mask;
+    };
+    Entry stack[kMaxBvhDepth];
+    int top = 0;
+    uint32_t index = 0;
+    int found = 0;
+    while (true)
+    {
+        const BvhNode& node = nodes[index];
+        if (node.IsLeaf())
+        {
+            found |= intersectLeaf(node.leftFirst, node.count, active);
+            active = 0;
+        }
+        else
+        {
+            const __m256 tMax = laneTMax();
+            uint32_t near = node.leftFirst, far = node.leftFirst + 1;
+            int nearMask = IntersectAabbPacket(rays, tMax, nodes[near].bmin, nodes[near].bmax, active);
+            int farMask = IntersectAabbPacket(rays, tMax, nodes[far].bmin, nodes[far].bmax, active);
+
+            // Near child first, judged by the packet direction along the axis
+            // the two children are furthest apart on
+            Float3 offset = (nodes[far].bmin + nodes[far].bmax) - (nodes[near].bmin + nodes[near].bmax);
+            int axis = fabsf(offset.x) > fabsf(offset.y) ? (fabsf(offset.x) > fabsf(offset.z) ? 0 : 2) : (fabsf(offset.y) > fabsf(offset.z) ? 1 : 2);
+            if (offset[axis] * rays.direction[axis] < 0.0f)
+            {
+                std::swap(near, far);
+                std::swap(nearMask, farMask);
+            }
+
+            if (nearMask && farMask) stack[top++] = Entry { far, farMask };
+            index = nearMask ? near : far;
+            active = nearMask ? nearMask : farMask;
+        }
+
+        // Lanes may have found closer hits since a node was pushed, so it is
+        // tested again on the way out
+        while (active == 0 && top > 0)
+        {
+            const Entry entry = stack[--top];
+            active = IntersectAabbPacket(rays, laneTMax(), nodes[entry.index].bmin, nodes[entry.index].bmax, entry.mask);
+            index = entry.index;
+        }
+        if (active == 0) break;
+    }
+    return found;
+}
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "CompactVertex.h"
+#include "RayPacket.h"
+#include "TileScheduler.h"
+#include "TopLevelAS.h"
+
+// CPU reference for the DXR pipeline of the sample: RayGen.hlsl, Miss.hlsl
+// and Hit.hlsl ported line by line, and a DispatchRays replacement that
+// traces the TopLevelAS tile by tile on all cores.
+
+// RGBA float image, rows top to bottom like the UAV
+struct Image
+{
+    int width = 0;
+    int height = 0;
+    std::vector<Float4> pixels;
+
+    Image() {}
+    Image(int w, int h) : width(w), height(h), pixels(size_t(w) * h) {}
+
+    Float4& At(int x, int y) { return pixels[size_t(y) * width + x]; }
+    const Float4& At(int x, int y) const { return pixels[size_t(y) * width + x]; }
+
+    // 8-bit binary PPM, clamped, no gamma: the same values the UNORM output
+    // texture ends up with
+    bool WritePpm(const char* path) const
+    {
+        FILE* file = fopen(path, "wb");
+        if (!file) return false;
+
+        fprintf(file, "P6\n%d %d\n255\n", width, height);
+        std::vector<unsigned char> row(size_t(width) * 3);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                const Float4& p = At(x, y);
+                const float rgb[3] = { p.x, p.y, p.z };
+                for (int c = 0; c < 3; c++)
+                {
+                    row[x * 3 + c] = static_cast<unsigned char>(std::min(1.0f, std::max(0.0f, rgb[c])) * 255.0f + 0.5f);
+                }
+            }
+            fwrite(row.data(), 1, row.size(), file);
+        }
+        return fclose(file) == 0;
+    }
+
+    // Float RGB PFM, for exact comparisons between runs. PFM stores rows
+    // bottom to top; the negative scale marks little endian data.
+    bool WritePfm(const char* path) const
+    {
+        FILE* file = fopen(path, "wb");
+        if (!file) return false;
+
+        fprintf(file, "PF\n%d %d\n-1.0\n", width, height);
+        std::vector<float> row(size_t(width) * 3);
+        for (int y = height - 1; y >= 0; y--)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                const Float4& p = At(x, y);
+                row[x * 3 + 0] = p.x;
+                row[x * 3 + 1] = p.y;
+                row[x * 3 + 2] = p.z;
+            }
+            fwrite(row.data(), sizeof(float), row.size(), file);
+        }
+        return fclose(file) == 0;
+    }
+};
+
+// What the shader binding table gives the hit group of each instance: the
+// vertex buffer its ClosestHit reads colors from (BTriVertex), and the index
+// buffer for indexed geometry like the Menger sponge
+struct HitGroupRecord
+{
+    const Vertex* vertices;
+    const uint32_t* indices = nullptr;
+    const CompactVertexBuffer* compact = nullptr; // read instead of vertices when set
+
+    uint32_t VertexIndex(uint32_t primitive, int corner) const { return indices ? indices[3 * primitive + corner] : 3 * primitive + corner; }
+    Float4 Color(uint32_t primitive, int corner) const
+    {
+        uint32_t index = VertexIndex(primitive, corner);
+        return compact ? compact->Color(index) : vertices[index].color;
+    }
+};
+
+// Secondary rays the sample does not have: when shadows is set, every hit
+// sends a ray towards a directional light and is darkened if it is blocked.
+// They give the tracers a second wave to schedule.
+static const float kShadowFactor = 0.35f;
+static const float kShadowBias = 1e-3f;
+
+struct Scene
+{
+    const TopLevelAS* tlas;
+    std::vector<HitGroupRecord> hitGroups; // one per TLAS instance
+    bool shadows = false;
+    Float3 toLight = Normalize(Float3(-0.4f, 0.6f, 1.0f));
+};
+
+// Ray payload, as in Common.hlsl
+struct HitInfo
+{
+    Float4 colorAndDistance;
+};
+
+// RayGen.hlsl: one orthographic ray per pixel center, looking down -z from
+// z = 1 over the [-1, 1] square
+inline Ray RayGen(int x, int y, int width, int height)
+{
+    float dx = ((x + 0.5f) / width) * 2.0f - 1.0f;
+    float dy = ((y + 0.5f) / height) * 2.0f - 1.0f;
+
+    Ray ray;
+    ray.origin = Float3(dx, -dy, 1.0f);
+    ray.direction = Float3(0.0f, 0.0f, -1.0f);
+    ray.tMin = 0.0f;
+    ray.tMax = 100000.0f;
+    return ray;
+}
+
+// Miss.hlsl: vertical blue gradient, distance -1
+inline HitInfo Miss(int y, int height)
+{
+    float ramp = static_cast<float>(y) / height;
+    return HitInfo { Float4(0.0f, 0.2f, 0.7f - 0.3f * ramp, -1.0f) };
+}
+
+// The three blends of Hit.hlsl, numbered by the case that selects them
+// (0 is the default case)
+static const int kHitKernelCount = 3;
+
+inline int HitKernel(uint32_t instanceId) { return instanceId == 1 || instanceId == 2 ? static_cast<int>(instanceId) : 0; }
+
+template <int Kernel>
+inline Float4 BlendHitColor(const Float4& A, const Float4& B, const Float4& C, const Float3& barycentrics)
+{
+    if (Kernel == 1) return B * barycentrics.x + B * barycentrics.y + C * barycentrics.z;
+    if (Kernel == 2) return C * barycentrics.x + B * barycentrics.y + C * barycentrics.z;
+    return A * barycentrics.x + B * barycentrics.y + C * barycentrics.z;
+}
+
+// One blend for a hit, with the vertex colors of its triangle
+template <int Kernel>
+inline HitInfo ShadeHit(const Scene& scene, const Hit& hit)
+{
+    const HitGroupRecord& record = scene.hitGroups[hit.instance];
+    Float4 A = record.Color(hit.primitive, 0);
+    Float4 B = record.Color(hit.primitive, 1);
+    Float4 C = record.Color(hit.primitive, 2);
+
+    Float3 barycentrics(1.0f - hit.u - hit.v, hit.u, hit.v);
+    Float4 hitColor = BlendHitColor<Kernel>(A, B, C, barycentrics);
+    return HitInfo { Float4(hitColor.x, hitColor.y, hitColor.z, hit.t) };
+}
+
+// Hit.hlsl: blends the vertex colors of the hit triangle with the
+// barycentrics, choosing which vertex colors by InstanceID(). The shader
+// has no default case; other instances (the plane) use the case 0 blend.
+inline HitInfo ClosestHit(const Scene& scene, const Hit& hit)
+{
+    const Instance& instance = scene.tlas->GetInstance(hit.instance);
+    switch (instance.instanceId)
+    {
+        case 1:
+            return ShadeHit<1>(scene, hit);
+
+        case 2:
+            return ShadeHit<2>(scene, hit);
+
+        default:
+            return ShadeHit<0>(scene, hit);
+    }
+}
+
+// From the hit point towards the light, starting a little off the surface
+inline Ray ShadowRay(const Scene& scene, const Ray& ray, const Hit& hit)
+{
+    Ray shadow;
+    shadow.origin = ray.origin + ray.direction * hit.t;
+    shadow.direction = scene.toLight;
+    shadow.tMin = kShadowBias;
+    shadow.tMax = 100000.0f;
+    return shadow;
+}
+
+inline Float4 Darken(const Float4& c) { return Float4(c.x * kShadowFactor, c.y * kShadowFactor, c.z * kShadowFactor, c.w); }
+
+// How RenderTile traces its rays. Wide and Packet need AVX2; the renderer
+// falls back to Single on machines without it.
+enum class TraceMode
+{
+    Single, // one ray at a time through the binary BLAS
+    Wide,   // one ray at a time through the 8-wide BLAS
+    Packet, // 4x2 pixel blocks as 8-ray packets, Wide for incoherent blocks
+};
+
+inline const char* TraceModeName(TraceMode mode)
+{
+    switch (mode)
+    {
+        case TraceMode::Wide: return "wide";
+        case TraceMode::Packet: return "packet";
+        default: return "single";
+    }
+}
+
+// Pixel block traced as one packet in TraceMode::Packet
+static const int kPacketBlockWidth = 4;
+static const int kPacketBlockHeight = 2;
+
+struct RenderStats
+{
+    double seconds = 0.0;
+    uint64_t rays = 0;
+
+    double MraysPerSecond() const { return rays / seconds / 1e6; }
+};
+
+class Renderer
+{
+    public:
+        explicit Renderer(int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency())), int tileSize = 16,
+                          TraceMode mode = TraceMode::Single)
+            : _threads(std::max(1, threads)), _tileSize(tileSize), _mode(HasAvx2() ? mode : TraceMode::Single)
+        {
+        }
+
+        // DispatchRays over the whole image
+        RenderStats Render(const Scene& scene, Image& image) const
+        {
+            const int tilesX = (image.width + _tileSize - 1) / _tileSize;
+            const int tilesY = (image.height + _tileSize - 1) / _tileSize;
+            auto start = std::chrono::steady_clock::now();
+
+            TileScheduler scheduler(tilesX * tilesY, _threads);
+            scheduler.Run([&](int tile, int) {
+                int x0 = (tile % tilesX) * _tileSize, y0 = (tile / tilesX) * _tileSize;
+                RenderTile(scene, image, x0, y0, std::min(image.width, x0 + _tileSize), std::min(image.height, y0 + _tileSize), _mode);
+            });
+
+            RenderStats stats;
+            stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            stats.rays = uint64_t(image.width) * image.height;
+            return stats;
+        }
+
+        // The body of RayGen for the pixels in [x0, x1) x [y0, y1)
+        static void RenderTile(const Scene& scene, Image& image, int x0, int y0, int x1, int y1, TraceMode mode = TraceMode::Single)
+        {
+            if (mode == TraceMode::Packet)
+            {
+                for (int by = y0; by < y1; by += kPacketBlockHeight)
+                {
+                    for (int bx = x0; bx < x1; bx += kPacketBlockWidth) RenderBlock(scene, image, bx, by, x1, y1);
+                }
+                return;
+            }
+
+            for (int y = y0; y < y1; y++)
+            {
+                for (int x = x0; x < x1; x++)
+                {
+                    Ray ray = RayGen(x, y, image.width, image.height);
+                    Hit hit;
+                    bool found = mode == TraceMode::Wide ? scene.tlas->IntersectWide(ray, hit) : scene.tlas->Intersect(ray, hit);
+                    Shade(scene, image, x, y, ray, found, hit, mode);
+                }
+            }
+        }
+
+        int Threads() const { return _threads; }
+        int TileSize() const { return _tileSize; }
+        TraceMode Mode() const { return _mode; }
+
+    private:
+        static void Shade(const Scene& scene, Image& image, int x, int y, const Ray& ray, bool found, const Hit& hit, TraceMode mode)
+        {
+            HitInfo payload = found ? ClosestHit(scene, hit) : Miss(y, image.height);
+            Float4 c = payload.colorAndDistance;
+            if (found && scene.shadows)
+            {
+                Ray shadow = ShadowRay(scene, ray, hit);
+                Hit blocker;
+                if (mode == TraceMode::Single ? scene.tlas->Intersect(shadow, blocker) : scene.tlas->IntersectWide(shadow, blocker)) c = Darken(c);
+            }
+            image.At(x, y) = Float4(c.x, c.y, c.z, 1.0f);
+        }
+
+        // One kPacketBlockWidth x kPacketBlockHeight block clipped to
+        // [.., x1) x [.., y1); lanes outside stay inactive
+        static void RenderBlock(const Scene& scene, Image& image, int bx, int by, int x1, int y1)
+        {
+            RayPacket8 packet;
+            int mask = 0;
+            for (int lane = 0; lane < kPacketWidth; lane++)
+            {
+                int x = bx + lane % kPacketBlockWidth, y = by + lane / kPacketBlockWidth;
+                if (x >= x1 || y >= y1) x = bx, y = by;
+                else mask |= 1 << lane;
+                packet.Set(lane, RayGen(x, y, image.width, image.height));
+            }
+
+            // Rays that go different ways share few nodes; trace them alone
+            if (!IsCoherent(packet, mask))
+            {
+                for (int bits = mask; bits; bits &= bits - 1)
+                {
+                    int lane = __builtin_ctz(bits);
+                    Ray ray = packet.Get(lane);
+                    Hit hit;
+                    bool found = scene.tlas->IntersectWide(ray, hit);
+                    Shade(scene, image, bx + lane % kPacketBlockWidth, by + lane / kPacketBlockWidth, ray, found, hit, TraceMode::Packet);
+                }
+                return;
+            }
+
+            HitPacket8 hits;
+            scene.tlas->IntersectPacket(packet, hits, mask);
+            for (int bits = mask; bits; bits &= bits - 1)
+            {
+                int lane = __builtin_ctz(bits);
+                Hit hit = hits.Get(lane);
+                Shade(scene, image, bx + lane % kPacketBlockWidth, by + lane / kPacketBlockWidth, packet.Get(lane), hit.Valid(), hit, TraceMode::Packet);
+            }
+        }
+
+        int _threads;
+        int _tileSize;
+        TraceMode _mode;
+};
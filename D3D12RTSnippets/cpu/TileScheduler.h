@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Hands out the tiles of a frame to a fixed set of workers. Every worker
+// starts with a contiguous band of tiles (neighbouring tiles touch the same
+// BVH nodes) and takes them from the front. A worker that runs out steals
+// the back half of the fullest band, so a slow band (say, the one covering
+// the dense part of the scene) is shared out instead of finishing last.
+//
+// Tiles cost hundreds of rays each, so a mutex per band is cheap enough and
+// keeps the stealing simple.
+class TileScheduler
+{
+    public:
+        TileScheduler(int tiles, int workers) : _bands(std::max(1, workers))
+        {
+            const int count = static_cast<int>(_bands.size());
+            for (int w = 0; w < count; w++)
+            {
+                _bands[w].begin = static_cast<int>(int64_t(tiles) * w / count);
+                _bands[w].end = static_cast<int>(int64_t(tiles) * (w + 1) / count);
+            }
+        }
+
+        int Workers() const { return static_cast<int>(_bands.size()); }
+
+        // Next tile for worker, or -1 when the frame is done
+        int Next(int worker)
+        {
+            {
+                Band& own = _bands[worker];
+                std::lock_guard<std::mutex> lock(own.mutex);
+                if (own.begin < own.end) return own.begin++;
+            }
+            return Steal(worker);
+        }
+
+        // Runs body(tile, worker) over all tiles on workers - 1 extra threads
+        // plus the calling one
+        template <typename Body>
+        void Run(Body body)
+        {
+            auto work = [&](int worker) {
+                for (int tile = Next(worker); tile >= 0; tile = Next(worker)) body(tile, worker);
+            };
+
+            std::vector<std::thread> threads;
+            for (int w = 1; w < Workers(); w++) threads.emplace_back(work, w);
+            work(0);
+            for (std::thread& thread : threads) thread.join();
+        }
+
+    private:
+        struct Band
+        {
+            std::mutex mutex;
+            int begin = 0;
+            int end = 0;
+        };
+
+        int Steal(int thief)
+        {
+            while (true)
+            {
+                // Pick the victim with the most tiles left; the sizes can change
+                // under us, which only makes the choice a little worse
+                int victim = -1, most = 0;
+                for (int w = 0; w < Workers(); w++)
+                {
+                    if (w == thief) continue;
+                    std::lock_guard<std::mutex> lock(_bands[w].mutex);
+                    int left = _bands[w].end - _bands[w].begin;
+                    if (left > most)
+                    {
+                        most = left;
+                        victim = w;
+                    }
+                }
+                if (victim < 0) return -1;
+
+                int first, last;
+                {
+                    Band& band = _bands[victim];
+                    std::lock_guard<std::mutex> lock(band.mutex);
+                    int left = band.end - band.begin;
+                    if (left <= 0) continue;
+
+                    last = band.end;
+                    first = band.end - (left + 1) / 2;
+                    band.end = first;
+                }
+
+                // Keep the first stolen tile, the rest becomes our band
+                Band& own = _bands[thief];
+                std::lock_guard<std::mutex> lock(own.mutex);
+                own.begin = first + 1;
+                own.end = last;
+                return first;
+            }
+        }
+
+        std::vector<Band> _bands;
+};
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "BottomLevelAS.h"
+#include "Bvh.h"
+
+// CPU counterpart of CreateTopLevelAS: a BVH over instances of bottom level
+// structures, each with its own transform.
+//
+// When only transforms change (the usual animation case), Update refits the
+// existing tree bottom up in O(n) instead of rebuilding it, which is what
+// passing the previous AS to the DXR builder does. Refitting keeps the old
+// topology, so as instances move apart the boxes grow and overlap; once the
+// SAH cost of the refitted tree exceeds rebuildThreshold times the cost it
+// had right after the last full build, Update rebuilds instead. Build,
+// Update and Rebuild take a BvhScratch so per-frame rebuilds can reuse their
+// temporaries.
+
+// Default ratio of refitted to freshly built SAH cost that triggers a rebuild
+static const float kTlasRebuildThreshold = 1.3f;
+
+// One entry of m_instances / AddInstance: which BLAS, where, and the value
+// InstanceID() returns in the hit shader
+struct Instance
+{
+    const BottomLevelAS* blas;
+    Matrix34 transform;
+    uint32_t instanceId;
+};
+
+enum class TlasUpdate
+{
+    Refit,
+    Rebuild,
+};
+
+class TopLevelAS
+{
+    public:
+        explicit TopLevelAS(float rebuildThreshold = kTlasRebuildThreshold) : _rebuildThreshold(rebuildThreshold), _builtCost(0.0f) {}
+
+        void Build(const std::vector<Instance>& instances, const BvhBuildOptions& options = BvhBuildOptions(), const BvhScratch& scratch = BvhScratch())
+        {
+            _instances = instances;
+            _options = options;
+            _worldToObject.resize(instances.size());
+            _worldBoxes.resize(instances.size());
+            for (uint32_t i = 0; i < instances.size(); i++) UpdateInstance(i);
+            Rebuild(scratch);
+        }
+
+        // Moves one instance. Takes effect on the next Update.
+        void SetTransform(uint32_t index, const Matrix34& transform)
+        {
+            _instances[index].transform = transform;
+            UpdateInstance(index);
+        }
+
+        // Brings the tree up to date with the transforms set since the last
+        // update: refits, or rebuilds when the refitted tree got too slow
+        TlasUpdate Update(const BvhScratch& scratch = BvhScratch())
+        {
+            Refit();
+            if (BvhSahCost(_nodes) <= _rebuildThreshold * _builtCost) return TlasUpdate::Refit;
+
+            Rebuild(scratch);
+            return TlasUpdate::Rebuild;
+        }
+
+        // Recomputes every node box from the instance boxes. Children always
+        // come after their parent in the node array, so one backwards pass
+        // sees every child before its parent.
+        void Refit()
+        {
+            for (size_t i = _nodes.size(); i-- > 0;)
+            {
+                if (i == 1) continue;
+
+                BvhNode& node = _nodes[i];
+                Aabb box;
+                if (node.IsLeaf())
+                {
+                    for (uint32_t k = node.leftFirst; k < node.leftFirst + node.count; k++) box.Grow(_worldBoxes[_order[k]]);
+                }
+                else
+                {
+                    box.Grow(Aabb(_nodes[node.leftFirst].bmin, _nodes[node.leftFirst].bmax));
+                    box.Grow(Aabb(_nodes[node.leftFirst + 1].bmin, _nodes[node.leftFirst + 1].bmax));
+                }
+                node.bmin = box.bmin;
+                node.bmax = box.bmax;
+            }
+        }
+
+        void Rebuild(const BvhScratch& scratch = BvhScratch())
+        {
+            BvhBuilder().Build(_worldBoxes, _options, _nodes, _order, scratch);
+            _builtCost = BvhSahCost(_nodes);
+        }
+
+        // Closest hit over all instances. The ray is moved into object space
+        // without renormalizing the direction, so t means the same distance in
+        // both spaces and hit.t can bound every BLAS traversal.
+        bool Intersect(const Ray& ray, Hit& hit) const
+        {
+            return IntersectInstances(ray, hit, [](const BottomLevelAS& blas, const Ray& local, Hit& h) { return blas.Intersect(local, h); });
+        }
+
+        // Intersect with the 8-wide BLAS traversal; needs AVX2
+        bool IntersectWide(const Ray& ray, Hit& hit) const
+        {
+            return IntersectInstances(ray, hit, [](const BottomLevelAS& blas, const Ray& local, Hit& h) { return blas.IntersectWide(local, h); });
+        }
+
+        // Intersect for the lanes of mask, as one packet through this tree and
+        // every BLAS it reaches. Returns the lanes that hit something. Needs
+        // AVX2.
+        __attribute__((target("avx2")))
+        int IntersectPacket(const RayPacket8& packet, HitPacket8& hits, int mask) const
+        {
+            PacketRays rays;
+            LoadPacketRays(packet, mask, rays);
+            return TraversePacket(_nodes, rays, hits, mask, [&](uint32_t first, uint32_t count, int active) {
+                int found = 0;
+                for (uint32_t k = first; k < first + count; k++)
+                {
+                    uint32_t index = _order[k];
+                    const Matrix34& toObject = _worldToObject[index];
+
+                    RayPacket8 local = packet;
+                    for (int lane = 0; lane < kPacketWidth; lane++)
+                    {
+                        if (!(active & (1 << lane))) continue;
+                        Float3 origin = toObject.TransformPoint(Float3(packet.ox[lane], packet.oy[lane], packet.oz[lane]));
+                        Float3 direction = toObject.TransformVector(Float3(packet.dx[lane], packet.dy[lane], packet.dz[lane]));
+                        local.Set(lane, Ray { origin, packet.tMin[lane], direction, packet.tMax[lane] });
+                    }
+
+                    // As in IntersectInstances: the BLAS fills its own hits,
+                    // and ties with the current hits go to the lower instance
+                    HitPacket8 candidate;
+                    for (int lane = 0; lane < kPacketWidth; lane++) candidate.t[lane] = hits.t[lane];
+                    int closer = _instances[index].blas->IntersectPacket(local, candidate, active);
+                    for (int bits = closer; bits; bits &= bits - 1)
+                    {
+                        int lane = __builtin_ctz(bits);
+                        if (candidate.t[lane] == hits.t[lane] && index > hits.instance[lane]) continue;
+                        hits.t[lane] = candidate.t[lane];
+                        hits.u[lane] = candidate.u[lane];
+                        hits.v[lane] = candidate.v[lane];
+                        hits.primitive[lane] = candidate.primitive[lane];
+                        hits.instance[lane] = index;
+                        found |= 1 << lane;
+                    }
+                }
+                return found;
+            });
+        }
+
+        float SahCost() const { return BvhSahCost(_nodes); }
+        float BuiltSahCost() const { return _builtCost; }
+        int Depth() const { return BvhDepth(_nodes); }
+
+        Aabb Bounds() const { return _nodes.empty() ? Aabb() : Aabb(_nodes[0].bmin, _nodes[0].bmax); }
+        size_t NodeCount() const { return _nodes.empty() ? 0 : _nodes.size() - 1; }
+        size_t InstanceCount() const { return _instances.size(); }
+        const Instance& GetInstance(uint32_t index) const { return _instances[index]; }
+        const Aabb& WorldBounds(uint32_t index) const { return _worldBoxes[index]; }
+
+    private:
+        // Each BLAS traces into a hit of its own, bounded by the closest t so
+        // far. Hits at equal t go to the lower instance, and within one
+        // instance to the lower primitive, so the result does not depend on
+        // the order a trace mode visits instances in.
+        template <typename TraceFn>
+        bool IntersectInstances(const Ray& ray, Hit& hit, TraceFn trace) const
+        {
+            return TraverseBvh(_nodes, ray, hit, [&](uint32_t first, uint32_t count) {
+                bool found = false;
+                for (uint32_t k = first; k < first + count; k++)
+                {
+                    uint32_t index = _order[k];
+                    const Matrix34& toObject = _worldToObject[index];
+
+                    Ray local = ray;
+                    local.origin = toObject.TransformPoint(ray.origin);
+                    local.direction = toObject.TransformVector(ray.direction);
+                    Hit candidate;
+                    candidate.t = hit.t;
+                    if (trace(*_instances[index].blas, local, candidate) && (candidate.t < hit.t || index < hit.instance))
+                    {
+                        hit = candidate;
+                        hit.instance = index;
+                        found = true;
+                    }
+                }
+                return found;
+            });
+        }
+
+        void UpdateInstance(uint32_t index)
+        {
+            const Instance& instance = _instances[index];
+            _worldToObject[index] = instance.transform.Inverse();
+            _worldBoxes[index] = instance.transform.TransformBox(instance.blas->Bounds());
+        }
+
+        float _rebuildThreshold;
+        float _builtCost;
+        BvhBuildOptions _options;
+
+        std::vector<Instance> _instances;
+        std::vector<Matrix34> _worldToObject;
+        std::vector<Aabb> _worldBoxes;
+
+        BvhNodeArray _nodes;
+        std::vector<uint32_t> _order;
+};
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "Arena.h"
+#include "Renderer.h"
+#include "TileScheduler.h"
+
+// Wavefront (stream) counterpart of Renderer. Renderer runs the whole
+// pipeline per ray, megakernel style: trace, then ClosestHit's switch on
+// InstanceID(), then the shadow ray. Here every stage runs over a whole wave
+// of rays before the next one starts:
+//
+//   1. generate the primary rays of a band of kWaveRows rows
+//   2. trace all of them
+//   3. bin the hit records by hit kernel (the Hit.hlsl case), misses last
+//   4. run each kernel's blend over its contiguous batch, with no switch
+//      per ray, queueing a shadow ray for every hit
+//   5. trace the shadow wave, darken what is blocked, write the band
+//
+// Bins keep screen order, so records of one instance stay together inside
+// their kernel's batch. Bands are handed out by TileScheduler; each worker
+// keeps its queues in its part of a FrameArena, sized by the first band it
+// gets and reset after the frame. The image matches Renderer's exactly.
+
+static const int kWaveRows = 8;
+
+// Seconds spent in each stage, summed over the workers
+struct WavefrontTimings
+{
+    double generate = 0.0;
+    double trace = 0.0;
+    double bin = 0.0;
+    double shade = 0.0;
+    double shadows = 0.0;
+
+    double Total() const { return generate + trace + bin + shade + shadows; }
+};
+
+class WavefrontRenderer
+{
+    public:
+        explicit WavefrontRenderer(int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency())), TraceMode mode = TraceMode::Single)
+            : _threads(std::max(1, threads)), _mode(HasAvx2() ? mode : TraceMode::Single), _arena(_threads), _workers(_threads)
+        {
+        }
+
+        RenderStats Render(const Scene& scene, Image& image)
+        {
+            const int bands = (image.height + kWaveRows - 1) / kWaveRows;
+            auto start = std::chrono::steady_clock::now();
+
+            for (Worker& worker : _workers) worker = Worker();
+            TileScheduler scheduler(bands, _threads);
+            scheduler.Run([&](int band, int worker) {
+                RenderBand(scene, image, band * kWaveRows, std::min(image.height, (band + 1) * kWaveRows), worker);
+            });
+
+            _timings = WavefrontTimings();
+            for (const Worker& worker : _workers)
+            {
+                _timings.generate += worker.timings.generate;
+                _timings.trace += worker.timings.trace;
+                _timings.bin += worker.timings.bin;
+                _timings.shade += worker.timings.shade;
+                _timings.shadows += worker.timings.shadows;
+            }
+            _arena.Reset();
+
+            RenderStats stats;
+            stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            stats.rays = uint64_t(image.width) * image.height;
+            return stats;
+        }
+
+        int Threads() const { return _threads; }
+        TraceMode Mode() const { return _mode; }
+        const WavefrontTimings& Timings() const { return _timings; }
+
+    private:
+        // Queues of one wave, all indexed by ray within the band
+        struct Worker
+        {
+            uint32_t capacity = 0;
+            Ray* rays = nullptr;
+            Hit* hits = nullptr;
+            uint32_t* order = nullptr;   // ray indices grouped by kernel
+            Float4* colors = nullptr;
+            Ray* shadowRays = nullptr;
+            uint32_t* shadowOwner = nullptr; // ray each shadow ray darkens
+            Hit* shadowHits = nullptr;
+            WavefrontTimings timings;
+        };
+
+        static double Seconds(std::chrono::steady_clock::time_point& since)
+        {
+            auto now = std::chrono::steady_clock::now();
+            double seconds = std::chrono::duration<double>(now - since).count();
+            since = now;
+            return seconds;
+        }
+
+        void Reserve(Worker& worker, LinearArena& arena, uint32_t count)
+        {
+            if (worker.capacity >= count) return;
+            worker.capacity = count;
+            worker.rays = arena.Allocate<Ray>(count);
+            worker.hits = arena.Allocate<Hit>(count);
+            worker.order = arena.Allocate<uint32_t>(count);
+            worker.colors = arena.Allocate<Float4>(count);
+            worker.shadowRays = arena.Allocate<Ray>(count);
+            worker.shadowOwner = arena.Allocate<uint32_t>(count);
+            worker.shadowHits = arena.Allocate<Hit>(count);
+        }
+
+        // Closest hits of count rays in hits. Packet mode takes the rays
+        // eight at a time, as they come; incoherent groups go one by one.
+        void TraceWave(const Scene& scene, const Ray* rays, Hit* hits, uint32_t count) const
+        {
+            for (uint32_t i = 0; i < count; i++) hits[i] = Hit();
+
+            uint32_t i = 0;
+            if (_mode == TraceMode::Packet)
+            {
+                for (; i + kPacketWidth <= count; i += kPacketWidth) TracePacket(scene, rays + i, hits + i);
+            }
+            for (; i < count; i++)
+            {
+                if (_mode == TraceMode::Single) scene.tlas->Intersect(rays[i], hits[i]);
+                else scene.tlas->IntersectWide(rays[i], hits[i]);
+            }
+        }
+
+        static void TracePacket(const Scene& scene, const Ray* rays, Hit* hits)
+        {
+            RayPacket8 packet;
+            for (int lane = 0; lane < kPacketWidth; lane++) packet.Set(lane, rays[lane]);
+            if (!IsCoherent(packet, kFullPacket))
+            {
+                for (int lane = 0; lane < kPacketWidth; lane++) scene.tlas->IntersectWide(rays[lane], hits[lane]);
+                return;
+            }
+
+            HitPacket8 packetHits;
+            scene.tlas->IntersectPacket(packet, packetHits, kFullPacket);
+            for (int lane = 0; lane < kPacketWidth; lane++) hits[lane] = packetHits.Get(lane);
+        }
+
+        // Blend of one kernel over its batch, queueing shadow rays
+        template <int Kernel>
+        static void ShadeBatch(const Scene& scene, Worker& w, const uint32_t* batch, uint32_t count, uint32_t& shadowCount)
+        {
+            for (uint32_t k = 0; k < count; k++)
+            {
+                const uint32_t i = batch[k];
+                w.colors[i] = ShadeHit<Kernel>(scene, w.hits[i]).colorAndDistance;
+                if (scene.shadows)
+                {
+                    w.shadowRays[shadowCount] = ShadowRay(scene, w.rays[i], w.hits[i]);
+                    w.shadowOwner[shadowCount++] = i;
+                }
+            }
+        }
+
+        void RenderBand(const Scene& scene, Image& image, int y0, int y1, int workerIndex)
+        {
+            Worker& w = _workers[workerIndex];
+            const uint32_t count = uint32_t(image.width) * (y1 - y0);
+            Reserve(w, _arena.Thread(workerIndex), uint32_t(image.width) * kWaveRows);
+            auto clock = std::chrono::steady_clock::now();
+
+            for (int y = y0; y < y1; y++)
+            {
+                for (int x = 0; x < image.width; x++) w.rays[uint32_t(y - y0) * image.width + x] = RayGen(x, y, image.width, image.height);
+            }
+            w.timings.generate += Seconds(clock);
+
+            TraceWave(scene, w.rays, w.hits, count);
+            w.timings.trace += Seconds(clock);
+
+            // Counting sort on the kernel, misses in the last bin
+            uint32_t bins[kHitKernelCount + 2] = {};
+            auto binOf = [&](uint32_t i) {
+                return w.hits[i].Valid() ? HitKernel(scene.tlas->GetInstance(w.hits[i].instance).instanceId) : kHitKernelCount;
+            };
+            for (uint32_t i = 0; i < count; i++) bins[binOf(i) + 1]++;
+            for (int b = 0; b <= kHitKernelCount; b++) bins[b + 1] += bins[b];
+            uint32_t cursor[kHitKernelCount + 1];
+            std::copy(bins, bins + kHitKernelCount + 1, cursor);
+            for (uint32_t i = 0; i < count; i++) w.order[cursor[binOf(i)]++] = i;
+            w.timings.bin += Seconds(clock);
+
+            uint32_t shadowCount = 0;
+            ShadeBatch<0>(scene, w, w.order + bins[0], bins[1] - bins[0], shadowCount);
+            ShadeBatch<1>(scene, w, w.order + bins[1], bins[2] - bins[1], shadowCount);
+            ShadeBatch<2>(scene, w, w.order + bins[2], bins[3] - bins[2], shadowCount);
+            for (uint32_t k = bins[kHitKernelCount]; k < count; k++)
+            {
+                const uint32_t i = w.order[k];
+                w.colors[i] = Miss(y0 + static_cast<int>(i / image.width), image.height).colorAndDistance;
+            }
+            w.timings.shade += Seconds(clock);
+
+            // Shadow rays never take the packet path: they start all over
+            // the band and rarely share nodes
+            if (shadowCount > 0)
+            {
+                for (uint32_t s = 0; s < shadowCount; s++) w.shadowHits[s] = Hit();
+                for (uint32_t s = 0; s < shadowCount; s++)
+                {
+                    bool blocked = _mode == TraceMode::Single ? scene.tlas->Intersect(w.shadowRays[s], w.shadowHits[s])
+                                                              : scene.tlas->IntersectWide(w.shadowRays[s], w.shadowHits[s]);
+                    if (blocked) w.colors[w.shadowOwner[s]] = Darken(w.colors[w.shadowOwner[s]]);
+                }
+            }
+            for (uint32_t i = 0; i < count; i++)
+            {
+                const Float4& c = w.colors[i];
+                image.pixels[size_t(y0) * image.width + i] = Float4(c.x, c.y, c.z, 1.0f);
+            }
+            w.timings.shadows += Seconds(clock);
+        }
+
+        int _threads;
+        TraceMode _mode;
+        FrameArena _arena;
+        std::vector<Worker> _workers;
+        WavefrontTimings _timings;
+};
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <stdint.h>
+#include <immintrin.h>
+#include <algorithm>
+#include <vector>
+
+#include "Bvh.h"
+
+// 8-wide BVH collapsed from the binary one. Each node stores the boxes of
+// up to eight children as separate x / y / z arrays, so a single AVX2 slab
+// test checks a ray against all of them at once, and the tree is about a
+// third as deep.
+//
+// The leaves are the binary leaves, referring to the same triangle runs.
+// Used slots come first. Each node's valid slots are kept as a bit mask
+// next to the nodes (so a node still fills four cache lines), and it is
+// ANDed into the slab test result. Unused slots also hold a far away box at
+// 1e30, but nothing relies on it: a long enough ray, e.g. tMax = FLT_MAX as
+// DXR allows, does reach that box.
+
+static const int kWideBranch = 8;
+static const float kEmptySlotCoordinate = 1e30f;
+
+inline bool HasAvx2() { return __builtin_cpu_supports("avx2"); }
+
+struct WideBvhNode
+{
+    float bminX[kWideBranch], bminY[kWideBranch], bminZ[kWideBranch];
+    float bmaxX[kWideBranch], bmaxY[kWideBranch], bmaxZ[kWideBranch];
+    uint32_t child[kWideBranch]; // leaf: first triangle, interior: wide node index
+    uint32_t count[kWideBranch]; // triangles in a leaf, 0 for interior or unused slots
+};
+static_assert(sizeof(WideBvhNode) == 256, "WideBvhNode should fill four cache lines exactly");
+
+class WideBvh
+{
+    public:
+        void Build(const BvhNodeArray& binary)
+        {
+            _nodes.clear();
+            _slotMasks.clear();
+            if (!binary.empty()) Collapse(binary, 0);
+        }
+
+        // Closest hit traversal like TraverseBvh, for the same leaves.
+        // Children are pushed farthest first, and popped entries that start
+        // beyond the current hit are dropped without being visited.
+        template <typename LeafFn>
+        __attribute__((target("avx2")))
+        bool Traverse(const Ray& ray, Hit& hit, LeafFn intersectLeaf) const
+        {
+            if (_nodes.empty()) return false;
+
+            const Float3 invDir = SafeInverse(ray.direction);
+            const __m256 ox = _mm256_set1_ps(ray.origin.x), oy = _mm256_set1_ps(ray.origin.y), oz = _mm256_set1_ps(ray.origin.z);
+            const __m256 ix = _mm256_set1_ps(invDir.x), iy = _mm256_set1_ps(invDir.y), iz = _mm256_set1_ps(invDir.z);
+            const __m256 tMin = _mm256_set1_ps(ray.tMin);
+
+            struct Entry
+            {
+                float dist;
+                uint32_t child;
+                uint32_t count;
+            };
+            Entry stack[kMaxBvhDepth * kWideBranch];
+            int top = 0;
+
+            bool found = false;
+            uint32_t index = 0;
+            while (true)
+            {
+                const WideBvhNode& node = _nodes[index];
+                const __m256 tMax = _mm256_set1_ps(std::min(ray.tMax, hit.t));
+
+                __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bminX), ox), ix);
+                __m256 t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bmaxX), ox), ix);
+                __m256 tNear = _mm256_min_ps(t1, t2), tFar = _mm256_max_ps(t1, t2);
+                t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bminY), oy), iy);
+                t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bmaxY), oy), iy);
+                tNear = _mm256_max_ps(tNear, _mm256_min_ps(t1, t2));
+                tFar = _mm256_min_ps(tFar, _mm256_max_ps(t1, t2));
+                t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bminZ), oz), iz);
+                t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bmaxZ), oz), iz);
+                tNear = _mm256_max_ps(_mm256_max_ps(tNear, _mm256_min_ps(t1, t2)), tMin);
+                tFar = _mm256_min_ps(_mm256_min_ps(tFar, _mm256_max_ps(t1, t2)), tMax);
+                int mask = _mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ)) & _slotMasks[index];
+
+                alignas(32) float dist[kWideBranch];
+                _mm256_store_ps(dist, tNear);
+
+                // Sort the hit children by entry distance (at most eight, an
+                // insertion sort is plenty) and push the farthest first
+                Entry hits[kWideBranch];
+                int hitCount = 0;
+                while (mask)
+                {
+                    int slot = __builtin_ctz(mask);
+                    mask &= mask - 1;
+
+                    Entry entry = { dist[slot], node.child[slot], node.count[slot] };
+                    int k = hitCount++;
+                    while (k > 0 && hits[k - 1].dist > entry.dist)
+                    {
+                        hits[k] = hits[k - 1];
+                        k--;
+                    }
+                    hits[k] = entry;
+                }
+                while (hitCount > 0) stack[top++] = hits[--hitCount];
+
+                // Leaves are handled as they come off the stack; stop at the
+                // next interior node
+                bool descend = false;
+                while (top > 0 && !descend)
+                {
+                    const Entry entry = stack[--top];
+                    if (entry.dist > hit.t) continue;
+
+                    if (entry.count > 0)
+                    {
+                        found |= intersectLeaf(entry.child, entry.count);
+                    }
+                    else
+                    {
+                        index = entry.child;
+                        descend = true;
+                    }
+                }
+                if (!descend) break;
+            }
+            return found;
+        }
+
+        size_t NodeCount() const { return _nodes.size(); }
+        size_t Bytes() const { return _nodes.size() * (sizeof(WideBvhNode) + 1); }
+        int Depth() const { return _nodes.empty() ? 0 : Depth(0); }
+
+    private:
+        int Depth(uint32_t index) const
+        {
+            int deepest = 0;
+            for (int slot = 0; slot < kWideBranch; slot++)
+            {
+                const WideBvhNode& node = _nodes[index];
+                if (node.count[slot] == 0 && (_slotMasks[index] >> slot & 1)) deepest = std::max(deepest, Depth(node.child[slot]));
+            }
+            return 1 + deepest;
+        }
+
+        // Pulls up to eight binary nodes under one wide node, always opening
+        // the interior node with the largest surface first
+        uint32_t Collapse(const BvhNodeArray& binary, uint32_t binaryIndex)
+        {
+            uint32_t slots[kWideBranch];
+            int used = 0;
+            if (binary[binaryIndex].IsLeaf())
+            {
+                slots[used++] = binaryIndex;
+            }
+            else
+            {
+                slots[used++] = binary[binaryIndex].leftFirst;
+                slots[used++] = binary[binaryIndex].leftFirst + 1;
+            }
+
+            while (used < kWideBranch)
+            {
+                int open = -1;
+                float largest = -1.0f;
+                for (int i = 0; i < used; i++)
+                {
+                    const BvhNode& node = binary[slots[i]];
+                    if (!node.IsLeaf() && BvhNodeArea(node) > largest)
+                    {
+                        largest = BvhNodeArea(node);
+                        open = i;
+                    }
+                }
+                if (open < 0) break;
+
+                uint32_t left = binary[slots[open]].leftFirst;
+                slots[open] = left;
+                slots[used++] = left + 1;
+            }
+
+            const uint32_t index = static_cast<uint32_t>(_nodes.size());
+            _nodes.emplace_back();
+            _slotMasks.push_back(static_cast<uint8_t>((1u << used) - 1));
+            for (int slot = 0; slot < kWideBranch; slot++)
+            {
+                WideBvhNode& node = _nodes[index];
+                if (slot >= used)
+                {
+                    node.bminX[slot] = node.bminY[slot] = node.bminZ[slot] = kEmptySlotCoordinate;
+                    node.bmaxX[slot] = node.bmaxY[slot] = node.bmaxZ[slot] = kEmptySlotCoordinate;
+                    node.child[slot] = 0;
+                    node.count[slot] = 0;
+                    continue;
+                }
+
+                const BvhNode& src = binary[slots[slot]];
+                node.bminX[slot] = src.bmin.x;
+                node.bminY[slot] = src.bmin.y;
+                node.bminZ[slot] = src.bmin.z;
+                node.bmaxX[slot] = src.bmax.x;
+                node.bmaxY[slot] = src.bmax.y;
+                node.bmaxZ[slot] = src.bmax.z;
+                node.count[slot] = src.count;
+                node.child[slot] = src.IsLeaf() ? src.leftFirst : 0;
+            }
+
+            // Children are collapsed after the parent is filled in; they grow
+            // _nodes, so the parent is looked up again by index
+            for (int slot = 0; slot < used; slot++)
+            {
+                if (binary[slots[slot]].IsLeaf()) continue;
+                uint32_t child = Collapse(binary, slots[slot]);
+                _nodes[index].child[slot] = child;
+            }
+            return index;
+        }
+
+        std::vector<WideBvhNode, CacheAlignedAllocator<WideBvhNode>> _nodes;
+        std::vector<uint8_t> _slotMasks; // bit s set when slot s of the node is used
+};
@@ -0,0 +1 @@
+g++ -std=c++14 -O2 -g -pthread -o cputracer main.cpp
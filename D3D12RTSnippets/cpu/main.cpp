@@ -0,0 +1,1173 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../bench/Bench.h"
+#include "Arena.h"
+#include "BottomLevelAS.h"
+#include "CompactVertex.h"
+#include "IncrementalRenderer.h"
+#include "MengerSponge.h"
+#include "Renderer.h"
+#include "TileScheduler.h"
+#include "TopLevelAS.h"
+#include "Wavefront.h"
+
+// CPU side checks and benchmarks for the DXR sample: the same geometry the
+// sample feeds to CreateBottomLevelAS, plus larger generated meshes.
+
+// Every operator new of the process, for the allocation counts of
+// BenchmarkFrameAllocations
+static std::atomic<uint64_t> g_heapAllocations(0);
+
+// noinline keeps GCC from pairing the inlined malloc / free with new / delete
+__attribute__((noinline)) void* operator new(size_t bytes)
+{
+    g_heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(bytes ? bytes : 1)) return p;
+    throw std::bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { free(p); }
+
+// Vertices of the sample's triangle (LoadAssets, aspect ratio 16:9) and of
+// CreatePlaneVB
+std::vector<Vertex> SampleTriangle()
+{
+    const float aspectRatio = 16.0f / 9.0f;
+    return {
+        { Float3(0.0f, 0.25f * aspectRatio, 0.0f), Float4(1.0f, 1.0f, 0.0f, 1.0f) },
+        { Float3(0.25f, -0.25f * aspectRatio, 0.0f), Float4(0.0f, 1.0f, 1.0f, 1.0f) },
+        { Float3(-0.25f, -0.25f * aspectRatio, 0.0f), Float4(1.0f, 0.0f, 1.0f, 1.0f) },
+    };
+}
+
+std::vector<Vertex> SamplePlane()
+{
+    const Float4 white(1.0f, 1.0f, 1.0f, 1.0f);
+    return {
+        { Float3(-1.5f, -.8f, 01.5f), white }, // 0
+        { Float3(-1.5f, -.8f, -1.5f), white }, // 1
+        { Float3(01.5f, -.8f, 01.5f), white }, // 2
+        { Float3(01.5f, -.8f, 01.5f), white }, // 2
+        { Float3(-1.5f, -.8f, -1.5f), white }, // 1
+        { Float3(01.5f, -.8f, -1.5f), white }, // 4
+    };
+}
+
+// A sphere with a bumpy surface, tessellated into about 2 * rings * segments
+// triangles. Triangle density and size vary, which is where SAH pays off.
+std::vector<Vertex> BumpySphere(int rings, int segments)
+{
+    const float kPi = 3.14159265f;
+    auto Point = [&](int ring, int segment) {
+        float theta = kPi * ring / rings;
+        float phi = 2.0f * kPi * segment / segments;
+        float r = 1.0f + 0.15f * sinf(7.0f * theta) * cosf(5.0f * phi);
+        return Float3(r * sinf(theta) * cosf(phi), r * cosf(theta), r * sinf(theta) * sinf(phi));
+    };
+
+    std::vector<Vertex> vertices;
+    const Float4 color(0.8f, 0.8f, 0.8f, 1.0f);
+    for (int ring = 0; ring < rings; ring++)
+    {
+        for (int segment = 0; segment < segments; segment++)
+        {
+            Float3 a = Point(ring, segment), b = Point(ring + 1, segment);
+            Float3 c = Point(ring + 1, segment + 1), d = Point(ring, segment + 1);
+            vertices.push_back({ a, color });
+            vertices.push_back({ b, color });
+            vertices.push_back({ c, color });
+            vertices.push_back({ a, color });
+            vertices.push_back({ c, color });
+            vertices.push_back({ d, color });
+        }
+    }
+    return vertices;
+}
+
+// Small randomly oriented triangles spread through a unit cube, with a few
+// clusters so the distribution is uneven
+std::vector<Vertex> TriangleSoup(size_t count, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::normal_distribution<float> cluster(0.0f, 0.05f);
+
+    std::vector<Vertex> vertices;
+    const Float4 color(0.5f, 0.7f, 0.3f, 1.0f);
+    Float3 centers[8];
+    for (Float3& c : centers) c = Float3(unit(rng), unit(rng), unit(rng));
+
+    for (size_t i = 0; i < count; i++)
+    {
+        Float3 center = (i % 2) ? Float3(unit(rng), unit(rng), unit(rng))
+                                : centers[i % 8] + Float3(cluster(rng), cluster(rng), cluster(rng));
+        for (int v = 0; v < 3; v++)
+        {
+            vertices.push_back({ center + Float3(unit(rng), unit(rng), unit(rng)) * 0.02f, color });
+        }
+    }
+    return vertices;
+}
+
+Ray RandomRay(std::mt19937& rng, const Aabb& bounds)
+{
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    Float3 e = bounds.Extent();
+    Float3 target = bounds.bmin + Float3(unit(rng) * e.x, unit(rng) * e.y, unit(rng) * e.z);
+    Float3 origin = bounds.Center() + Normalize(Float3(unit(rng) - 0.5f, unit(rng) - 0.5f, unit(rng) - 0.5f)) * (2.0f * Length(e));
+
+    Ray ray;
+    ray.origin = origin;
+    ray.direction = Normalize(target - origin);
+    ray.tMin = 0.0f;
+    ray.tMax = 100000.0f;
+    return ray;
+}
+
+// Traces random rays through the BVH and against every triangle and checks
+// both agree on the closest hit
+bool CheckAgainstBruteForce(const BottomLevelAS& blas, const std::vector<Triangle>& triangles, int rays)
+{
+    std::mt19937 rng(5);
+    bool ok = true;
+    for (int r = 0; r < rays; r++)
+    {
+        Ray ray = RandomRay(rng, blas.Bounds());
+
+        Hit expected;
+        for (uint32_t i = 0; i < triangles.size(); i++) IntersectTriangle(ray, triangles[i], i, expected);
+
+        Hit hit;
+        blas.Intersect(ray, hit);
+        if (hit.primitive != expected.primitive && fabsf(hit.t - expected.t) > 1e-5f) ok = false;
+    }
+    return ok;
+}
+
+// Traces random rays one at a time, through the 8-wide tree and as packets
+// of eight, and checks all three find the same hits. The random packets are
+// incoherent; the parallel ones below them take the interval culling path.
+bool CheckTraceModes(const BottomLevelAS& blas, int packets)
+{
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    const Aabb bounds = blas.Bounds();
+    auto same = [](const Hit& a, const Hit& b) { return a.primitive == b.primitive && a.t == b.t && a.u == b.u && a.v == b.v; };
+
+    bool ok = true;
+    for (int p = 0; p < 2 * packets; p++)
+    {
+        RayPacket8 packet;
+        Ray base = RandomRay(rng, bounds);
+        for (int lane = 0; lane < kPacketWidth; lane++)
+        {
+            Ray ray = RandomRay(rng, bounds);
+            if (p >= packets)
+            {
+                // Parallel rays through a small square around a random one
+                ray = base;
+                ray.origin = base.origin + Float3(unit(rng), unit(rng), unit(rng)) * (0.05f * Length(bounds.Extent()));
+            }
+            packet.Set(lane, ray);
+        }
+
+        HitPacket8 hits;
+        blas.IntersectPacket(packet, hits, kFullPacket);
+        for (int lane = 0; lane < kPacketWidth; lane++)
+        {
+            Hit single, wide;
+            blas.Intersect(packet.Get(lane), single);
+            blas.IntersectWide(packet.Get(lane), wide);
+            if (!same(single, wide) || !same(single, hits.Get(lane))) ok = false;
+        }
+    }
+    return ok;
+}
+
+// Rays along the eight (+-1, +-1, +-1) diagonals with tMax = FLT_MAX, as a
+// DXR RayDesc may have, from around the mesh and from its center. Such rays
+// also reach the far boxes parked in unused wide node slots, which must not
+// be visited. All three trace modes have to agree and come back.
+bool CheckUnboundedRays(const BottomLevelAS& blas)
+{
+    auto same = [](const Hit& a, const Hit& b) { return a.primitive == b.primitive && a.t == b.t && a.u == b.u && a.v == b.v; };
+    const Aabb bounds = blas.Bounds();
+    const Float3 center = bounds.Center();
+    const float reach = 2.0f * Length(bounds.Extent()) + 1.0f;
+
+    bool ok = true;
+    RayPacket8 packet;
+    for (int lane = 0; lane < kPacketWidth; lane++)
+    {
+        Float3 direction = Normalize(Float3(lane & 1 ? 1.0f : -1.0f, lane & 2 ? 1.0f : -1.0f, lane & 4 ? 1.0f : -1.0f));
+        for (float offset : { -reach, 0.0f, reach })
+        {
+            Ray ray;
+            ray.origin = center + direction * offset;
+            ray.direction = direction;
+            ray.tMin = 0.0f;
+            ray.tMax = std::numeric_limits<float>::max();
+            Hit single, wide;
+            blas.Intersect(ray, single);
+            blas.IntersectWide(ray, wide);
+            ok &= same(single, wide);
+            if (offset == reach) packet.Set(lane, ray);
+        }
+    }
+
+    HitPacket8 hits;
+    blas.IntersectPacket(packet, hits, kFullPacket);
+    for (int lane = 0; lane < kPacketWidth; lane++)
+    {
+        Hit single;
+        blas.Intersect(packet.Get(lane), single);
+        ok &= same(single, hits.Get(lane));
+    }
+    return ok;
+}
+
+// Every other instance of one BLAS has the same transform, so they hit at
+// exactly the same t; the rest are moved aside so the build reorders them
+// all. Every trace mode has to pick the lowest instance, whatever order it
+// visits them in.
+bool CheckCoincidentInstances(const BottomLevelAS& blas, int packets)
+{
+    const float step = 3.0f * Length(blas.Bounds().Extent());
+    std::vector<Instance> instances;
+    for (uint32_t i = 0; i < 64; i++)
+    {
+        Matrix34 transform = i % 2 ? Matrix34::Translation(step * (i % 7 + 1), step * (i % 5), 0.0f) : Matrix34::Identity();
+        instances.push_back(Instance { &blas, transform, i });
+    }
+    TopLevelAS tlas;
+    tlas.Build(instances);
+
+    std::mt19937 rng(29);
+    auto same = [](const Hit& a, const Hit& b) { return a.instance == b.instance && a.primitive == b.primitive && a.t == b.t; };
+    bool ok = true;
+    for (int p = 0; p < packets; p++)
+    {
+        RayPacket8 packet;
+        for (int lane = 0; lane < kPacketWidth; lane++) packet.Set(lane, RandomRay(rng, blas.Bounds()));
+        HitPacket8 hits;
+        tlas.IntersectPacket(packet, hits, kFullPacket);
+        for (int lane = 0; lane < kPacketWidth; lane++)
+        {
+            Hit single, wide;
+            bool found = tlas.Intersect(packet.Get(lane), single);
+            tlas.IntersectWide(packet.Get(lane), wide);
+            if (!same(single, wide) || !same(single, hits.Get(lane)) || (found && single.instance % 2 == 0 && single.instance != 0)) ok = false;
+        }
+    }
+    return ok;
+}
+
+void BenchmarkBlasBuild(const char* name, const std::vector<Vertex>& vertices)
+{
+    std::vector<VertexBufferDesc> buffers = { { vertices.data(), static_cast<uint32_t>(vertices.size()) } };
+
+    struct Config
+    {
+        const char* label;
+        BvhSplit split;
+        int threads;
+    };
+    const int allThreads = BvhBuildOptions().threads;
+    const Config configs[] = {
+        { "median", BvhSplit::Median, 1 },
+        { "SAH", BvhSplit::Sah, 1 },
+        { "SAH", BvhSplit::Sah, allThreads },
+    };
+
+    for (const Config& config : configs)
+    {
+        if (&config == &configs[2] && allThreads == 1) break;
+
+        BvhBuildOptions options;
+        options.split = config.split;
+        options.threads = config.threads;
+
+        BottomLevelAS blas;
+        auto start = std::chrono::steady_clock::now();
+        blas.Build(buffers, options);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        printf("[BENCH] BLAS %-12s %8zu tris, %-6s %2d threads : %8.2f ms, %8zu nodes, depth %2d, SAH cost %7.2f, %6.1f MB\n",
+            name, blas.TriangleCount(), config.label, config.threads, ms, blas.NodeCount(), blas.Depth(), blas.SahCost(),
+            blas.Bytes() / (1024.0 * 1024.0));
+    }
+}
+
+// Brute force reference for the TLAS: every instance's BLAS, in order
+Hit IntersectAllInstances(const TopLevelAS& tlas, const Ray& ray)
+{
+    Hit hit;
+    for (uint32_t i = 0; i < tlas.InstanceCount(); i++)
+    {
+        const Instance& instance = tlas.GetInstance(i);
+        Matrix34 toObject = instance.transform.Inverse();
+        Ray local = ray;
+        local.origin = toObject.TransformPoint(ray.origin);
+        local.direction = toObject.TransformVector(ray.direction);
+        if (instance.blas->Intersect(local, hit)) hit.instance = i;
+    }
+    return hit;
+}
+
+// side * side instances of a small mesh on a grid, animated for a number of
+// frames. In the "orbit" motion every instance circles its grid cell, so
+// refits keep the tree tight; in "drift" they fly off in random directions
+// and the refitted tree degrades until Update rebuilds it.
+void BenchmarkTlasUpdates(int side, int frames, bool drift)
+{
+    std::vector<Vertex> mesh = BumpySphere(8, 16);
+    BottomLevelAS blas;
+    blas.Build({ { mesh.data(), static_cast<uint32_t>(mesh.size()) } });
+
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    const int count = side * side;
+    std::vector<Instance> instances(count);
+    std::vector<Float3> home(count), velocity(count);
+    std::vector<float> phase(count);
+    for (int i = 0; i < count; i++)
+    {
+        home[i] = Float3(3.0f * (i % side), 3.0f * unit(rng), 3.0f * (i / side));
+        velocity[i] = Float3(unit(rng), unit(rng), unit(rng)) * 0.3f;
+        phase[i] = 3.14159265f * unit(rng);
+        instances[i] = Instance { &blas, Matrix34::Translation(home[i].x, home[i].y, home[i].z), static_cast<uint32_t>(i) };
+    }
+
+    TopLevelAS tlas;
+    auto start = std::chrono::steady_clock::now();
+    tlas.Build(instances);
+    double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    double transformMs = 0.0, updateMs = 0.0, worstMs = 0.0;
+    int rebuilds = 0;
+    for (int frame = 1; frame <= frames; frame++)
+    {
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; i++)
+        {
+            float angle = phase[i] + 0.1f * frame;
+            Float3 p = drift ? home[i] + velocity[i] * (float)frame : home[i] + Float3(cosf(angle), 0.0f, sinf(angle));
+            tlas.SetTransform(i, Matrix34::Translation(p.x, p.y, p.z) * Matrix34::RotationY(angle));
+        }
+        auto moved = std::chrono::steady_clock::now();
+        rebuilds += tlas.Update() == TlasUpdate::Rebuild;
+        auto done = std::chrono::steady_clock::now();
+
+        double ms = std::chrono::duration<double, std::milli>(done - moved).count();
+        transformMs += std::chrono::duration<double, std::milli>(moved - start).count();
+        updateMs += ms;
+        worstMs = std::max(worstMs, ms);
+    }
+
+    // The tree has to agree with a loop over all instances after animating
+    bool ok = true;
+    for (int r = 0; r < 200; r++)
+    {
+        Ray ray = RandomRay(rng, tlas.Bounds());
+        Hit hit, expected = IntersectAllInstances(tlas, ray);
+        tlas.Intersect(ray, hit);
+        if (hit.instance != expected.instance && fabsf(hit.t - expected.t) > 1e-4f) ok = false;
+    }
+
+    printf("[BENCH] TLAS %6d instances, %-5s : build %7.2f ms, per frame: transforms %6.2f ms, update %6.2f ms (worst %6.2f), "
+        "%d rebuilds in %d frames, SAH %.1f vs %.1f built %s\n",
+        count, drift ? "drift" : "orbit", buildMs, transformMs / frames, updateMs / frames, worstMs, rebuilds, frames,
+        tlas.SahCost(), tlas.BuiltSahCost(), ok ? "" : "MISMATCH");
+}
+
+// Renders the scene at every thread count up to the core count, checking
+// each image matches the single threaded one
+void BenchmarkRender(const char* name, const Scene& scene, int width, int height)
+{
+    Image reference;
+    int maxThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    for (int threads = 1; ; threads = std::min(threads * 2, maxThreads))
+    {
+        Renderer renderer(threads);
+        Image image(width, height);
+        renderer.Render(scene, image);
+        RenderStats stats = renderer.Render(scene, image);
+
+        if (reference.pixels.empty()) reference = image;
+        bool same = memcmp(reference.pixels.data(), image.pixels.data(), image.pixels.size() * sizeof(Float4)) == 0;
+        printf("[BENCH] render %-12s %dx%d, %2d threads : %8.2f ms, %7.2f Mrays/s %s\n",
+            name, width, height, threads, stats.seconds * 1e3, stats.MraysPerSecond(), same ? "" : "IMAGE DIFFERS");
+
+        if (threads == maxThreads) break;
+    }
+}
+
+// Renders the scene once per TraceMode on all threads and compares every
+// image with the single ray one
+void BenchmarkTraceModes(const char* name, const Scene& scene, int width, int height)
+{
+    Image reference;
+    double baseline = 0.0;
+    for (TraceMode mode : { TraceMode::Single, TraceMode::Wide, TraceMode::Packet })
+    {
+        Renderer renderer(static_cast<int>(std::max(1u, std::thread::hardware_concurrency())), 16, mode);
+        Image image(width, height);
+        renderer.Render(scene, image);
+        RenderStats stats = renderer.Render(scene, image);
+
+        if (reference.pixels.empty())
+        {
+            reference = image;
+            baseline = stats.MraysPerSecond();
+        }
+        bool same = memcmp(reference.pixels.data(), image.pixels.data(), image.pixels.size() * sizeof(Float4)) == 0;
+        printf("[BENCH] trace %-12s %dx%d, %-6s : %8.2f ms, %7.2f Mrays/s, x%.2f %s\n", name, width, height,
+            TraceModeName(renderer.Mode()), stats.seconds * 1e3, stats.MraysPerSecond(), stats.MraysPerSecond() / baseline, same ? "" : "IMAGE DIFFERS");
+    }
+}
+
+// The megakernel Renderer against WavefrontRenderer in every trace mode,
+// without and with the shadow wave. Both have to draw the same image.
+void BenchmarkWavefront(const char* name, Scene scene, int width, int height)
+{
+    const int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    for (bool shadows : { false, true })
+    {
+        scene.shadows = shadows;
+        for (TraceMode mode : { TraceMode::Single, TraceMode::Wide, TraceMode::Packet })
+        {
+            Renderer megakernel(threads, 16, mode);
+            WavefrontRenderer wavefront(threads, mode);
+            if (megakernel.Mode() != mode) continue;
+
+            Image reference(width, height), image(width, height);
+            megakernel.Render(scene, reference);
+            RenderStats mega = megakernel.Render(scene, reference);
+            wavefront.Render(scene, image);
+            RenderStats wave = wavefront.Render(scene, image);
+
+            const WavefrontTimings& t = wavefront.Timings();
+            bool same = memcmp(reference.pixels.data(), image.pixels.data(), image.pixels.size() * sizeof(Float4)) == 0;
+            printf("[BENCH] wavefront %-12s %dx%d, %-6s %-10s : megakernel %8.2f ms, wavefront %8.2f ms, x%.2f "
+                "(trace %.0f%%, bin %.0f%%, shade %.0f%%, shadows %.0f%%) %s\n", name, width, height, TraceModeName(mode),
+                shadows ? "shadows" : "no shadows", mega.seconds * 1e3, wave.seconds * 1e3, mega.seconds / wave.seconds,
+                100.0 * t.trace / t.Total(), 100.0 * t.bin / t.Total(), 100.0 * t.shade / t.Total(), 100.0 * t.shadows / t.Total(),
+                same ? "" : "IMAGE DIFFERS");
+        }
+    }
+}
+
+// Random rays from all around the mesh, the case packets do not suit: one
+// ray at a time through both trees, and the same rays as packets of eight
+void BenchmarkIncoherentRays(const char* name, const std::vector<Vertex>& vertices, int rays)
+{
+    BottomLevelAS blas;
+    blas.Build({ { vertices.data(), static_cast<uint32_t>(vertices.size()) } });
+
+    std::mt19937 rng(17);
+    std::vector<RayPacket8, CacheAlignedAllocator<RayPacket8>> packets(rays / kPacketWidth);
+    for (RayPacket8& packet : packets)
+    {
+        for (int lane = 0; lane < kPacketWidth; lane++) packet.Set(lane, RandomRay(rng, blas.Bounds()));
+    }
+
+    for (TraceMode mode : { TraceMode::Single, TraceMode::Wide, TraceMode::Packet })
+    {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t found = 0;
+        for (const RayPacket8& packet : packets)
+        {
+            if (mode == TraceMode::Packet)
+            {
+                HitPacket8 hits;
+                found += __builtin_popcount(blas.IntersectPacket(packet, hits, kFullPacket));
+                continue;
+            }
+            for (int lane = 0; lane < kPacketWidth; lane++)
+            {
+                Hit hit;
+                found += mode == TraceMode::Wide ? blas.IntersectWide(packet.Get(lane), hit) : blas.Intersect(packet.Get(lane), hit);
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("[BENCH] incoherent %-12s %zu tris, %-6s : %7.2f Mrays/s, %llu hits\n", name, blas.TriangleCount(),
+            TraceModeName(mode), packets.size() * kPacketWidth / seconds / 1e6, static_cast<unsigned long long>(found));
+    }
+    printf("[BENCH] incoherent %-12s nodes %zu binary / %zu wide, depth %d / %d\n", name, blas.NodeCount(), blas.WideNodeCount(), blas.Depth(), blas.WideDepth());
+}
+
+// Closest hits of the welded sponge, the one with every cube kept, and the
+// instanced one agree: culled faces are never the closest hit, and neither
+// are the faces between instances
+bool CheckMengerSponge(int level, int baseLevel, int rays)
+{
+    const float size = 1.5f;
+    IndexedMesh welded = GenerateMengerSponge(level, size);
+    IndexedMesh naive = GenerateMengerSpongeNaive(level, size);
+    BottomLevelAS weldedBlas, naiveBlas;
+    weldedBlas.Build(GatherTriangles(welded.vertices.data(), welded.indices.data(), welded.indices.size()));
+    naiveBlas.Build(GatherTriangles(naive.vertices.data(), naive.indices.data(), naive.indices.size()));
+
+    MengerInstancing instancing(level, size, baseLevel);
+    BottomLevelAS baseBlas;
+    baseBlas.Build(GatherTriangles(instancing.Base().vertices.data(), instancing.Base().indices.data(), instancing.Base().indices.size()));
+    std::vector<Instance> instances;
+    for (const Matrix34& transform : instancing.Transforms()) instances.push_back(Instance { &baseBlas, transform, 0 });
+    TopLevelAS tlas;
+    tlas.Build(instances);
+
+    std::mt19937 rng(23);
+    bool ok = welded.TriangleCount() == 2 * MengerFaceCount(level);
+    for (int r = 0; r < rays; r++)
+    {
+        Ray ray = RandomRay(rng, weldedBlas.Bounds());
+        Hit a, b, c;
+        bool hitA = weldedBlas.Intersect(ray, a), hitB = naiveBlas.Intersect(ray, b), hitC = tlas.Intersect(ray, c);
+        if (hitA != hitB || hitA != hitC) ok = false;
+        else if (hitA && (fabsf(a.t - b.t) > 1e-5f || fabsf(a.t - c.t) > 1e-5f)) ok = false;
+    }
+    return ok;
+}
+
+// Generation time and memory per level: every cube on its own, welded on
+// one thread and on all of them, and as instances of a level 2 sponge
+void BenchmarkMengerSponge(int maxLevel)
+{
+    const float size = 1.5f;
+    const int maxThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    auto timed = [](auto body) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e3;
+    };
+
+    for (int level = 1; level <= maxLevel; level++)
+    {
+        // Past level 4 the cube per cube layout needs gigabytes; its size is
+        // known without building it
+        const uint64_t cubes = MengerCubeCount(level);
+        const double naiveMB = cubes * (24 * sizeof(Vertex) + 36 * sizeof(uint32_t)) / 1048576.0;
+        if (level <= 4)
+        {
+            double ms = timed([&]() { GenerateMengerSpongeNaive(level, size); });
+            printf("[BENCH] menger L%d naive            : %9.2f ms, %9llu triangles, %9.2f MB\n", level, ms,
+                static_cast<unsigned long long>(cubes * 12), naiveMB);
+        }
+        else
+        {
+            printf("[BENCH] menger L%d naive            :  (skipped), %9llu triangles, %9.2f MB\n", level,
+                static_cast<unsigned long long>(cubes * 12), naiveMB);
+        }
+
+        IndexedMesh reference;
+        for (int threads : { 1, maxThreads })
+        {
+            IndexedMesh mesh;
+            double ms = timed([&]() { mesh = GenerateMengerSponge(level, size, threads); });
+            if (reference.indices.empty()) reference = mesh;
+            bool same = mesh.indices == reference.indices && memcmp(mesh.vertices.data(), reference.vertices.data(), mesh.vertices.size() * sizeof(Vertex)) == 0;
+
+            const uint64_t lattice = uint64_t(MengerGridSize(level) + 1) * (MengerGridSize(level) + 1) * (MengerGridSize(level) + 1);
+            printf("[BENCH] menger L%d welded %2d threads : %9.2f ms, %9zu triangles, %9.2f MB, %8zu vertices, scratch %.2f MB %s\n",
+                level, threads, ms, mesh.TriangleCount(), mesh.Bytes() / 1048576.0, mesh.vertices.size(), lattice / 64 * 12 / 1048576.0,
+                same ? "" : "OUTPUT DIFFERS");
+            if (threads == maxThreads) break;
+        }
+
+        const int baseLevel = std::min(level, 2);
+        MengerInstancing instancing(level, size, baseLevel);
+        std::vector<Matrix34> transforms;
+        double ms = timed([&]() { transforms = instancing.Transforms(); });
+        printf("[BENCH] menger L%d as %6llu x L%d    : %9.2f ms, %9llu triangles, %9.2f MB described, %.2f MB as TLAS instances\n",
+            level, static_cast<unsigned long long>(instancing.InstanceCount()), baseLevel, ms,
+            static_cast<unsigned long long>(instancing.InstanceCount() * instancing.Base().TriangleCount()),
+            instancing.Bytes() / 1048576.0, (instancing.Base().Bytes() + transforms.size() * sizeof(Instance)) / 1048576.0);
+    }
+}
+
+// Encodes a vertex buffer in the compact format and checks every decoded
+// attribute against the error bounds of CompactVertex.h
+bool CheckCompactVertices(const char* name, const std::vector<Vertex>& vertices)
+{
+    CompactVertexBuffer compact(vertices.data(), vertices.size());
+    std::vector<Float3> normals = ComputeVertexNormals(vertices.data(), vertices.size(), nullptr, 0);
+
+    // Half a step, plus float rounding in encode and decode
+    const Float3 bound = compact.quantization.step * 0.5f + compact.quantization.step * 1e-3f + Float3(1e-6f);
+    float position = 0.0f, color = 0.0f, normal = 0.0f;
+    bool ok = true;
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        Float3 dp = compact.Position(i) - vertices[i].position;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            ok &= fabsf(dp[axis]) <= bound[axis];
+            position = std::max(position, fabsf(dp[axis]));
+        }
+
+        Float4 c = compact.Color(i);
+        const Float4& expected = vertices[i].color;
+        float dc = std::max(std::max(fabsf(c.x - expected.x), fabsf(c.y - expected.y)), std::max(fabsf(c.z - expected.z), fabsf(c.w - expected.w)));
+        color = std::max(color, dc);
+
+        float cosine = std::min(1.0f, std::max(-1.0f, Dot(compact.Normal(i), normals[i])));
+        normal = std::max(normal, acosf(cosine) * 57.2957795f);
+    }
+    ok &= color <= 0.5f / 255.0f + 1e-6f && normal <= kOctahedralMaxErrorDegrees;
+    printf("[MAIN] Compact vertices %-12s : max error position %.2e (bound %.2e), color %.2e, normal %.2f deg : %s\n", name,
+        position, std::max(bound.x, std::max(bound.y, bound.z)), color, normal, ok ? "within bounds" : "OUT OF BOUNDS");
+    return ok;
+}
+
+// Renders scene as given and again with every hit group reading its colors
+// from a CompactVertexBuffer. Blends are convex, so no pixel may move by more
+// than the half step of the 8-bit colors. vertexCounts holds the size of each
+// hit group's vertex buffer.
+bool CheckCompactRender(const char* name, const Scene& scene, const std::vector<size_t>& vertexCounts, int width, int height)
+{
+    std::vector<CompactVertexBuffer> compact;
+    compact.reserve(scene.hitGroups.size());
+    Scene compactScene = scene;
+    for (size_t g = 0; g < scene.hitGroups.size(); g++)
+    {
+        compact.emplace_back(scene.hitGroups[g].vertices, vertexCounts[g]);
+        compactScene.hitGroups[g].compact = &compact.back();
+    }
+
+    Image reference(width, height), image(width, height);
+    Renderer().Render(scene, reference);
+    Renderer().Render(compactScene, image);
+
+    float error = 0.0f;
+    for (size_t i = 0; i < image.pixels.size(); i++)
+    {
+        const Float4& a = image.pixels[i];
+        const Float4& b = reference.pixels[i];
+        error = std::max(error, std::max(fabsf(a.x - b.x), std::max(fabsf(a.y - b.y), fabsf(a.z - b.z))));
+    }
+    bool ok = error <= 0.5f / 255.0f + 1e-6f;
+    printf("[MAIN] Compact hit groups %-18s : max pixel error %.2e (bound %.2e) : %s\n", name, error, 0.5f / 255.0f,
+        ok ? "within bounds" : "OUT OF BOUNDS");
+    return ok;
+}
+
+// Memory traffic of the two vertex layouts: a pass over every vertex in
+// order (what a skinning or upload pass pays), and ClosestHit style fetches
+// of the three vertices of random triangles. Best of three runs each.
+void BenchmarkVertexFetch(const char* name, const std::vector<Vertex>& vertices)
+{
+    CompactVertexBuffer compact(vertices.data(), vertices.size());
+    std::mt19937 rng(31);
+    std::vector<uint32_t> fetches(1 << 20);
+    for (uint32_t& primitive : fetches) primitive = rng() % static_cast<uint32_t>(vertices.size() / 3);
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        const bool packed = pass == 1;
+        auto fetch = [&](size_t i) {
+            return packed ? compact.Position(i) + Float3(compact.Color(i).x) : vertices[i].position + Float3(vertices[i].color.x);
+        };
+
+        // Four sums, so the adds do not serialize the loop
+        Float3 sum[4];
+        double scan = 1e30, gather = 1e30;
+        for (int run = 0; run < 3; run++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i + 3 < vertices.size(); i += 4)
+            {
+                for (int k = 0; k < 4; k++) sum[k] = sum[k] + fetch(i + k);
+            }
+            scan = std::min(scan, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+            start = std::chrono::steady_clock::now();
+            for (size_t f = 0; f < fetches.size(); f++)
+            {
+                for (int k = 0; k < 3; k++) sum[k] = sum[k] + fetch(3 * size_t(fetches[f]) + k);
+            }
+            gather = std::min(gather, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        Float3 total = sum[0] + sum[1] + sum[2] + sum[3];
+        size_t bytes = packed ? compact.Bytes() : vertices.size() * sizeof(Vertex);
+        printf("[BENCH] vertices %-12s %8zu %-7s : %7.2f MB, scan %7.3f ms (%5.2f GB/s), random triangle fetch %5.1f ns (%g)\n", name,
+            vertices.size(), packed ? "compact" : "float", bytes / 1048576.0, scan * 1e3, bytes / scan / 1e9,
+            gather / fetches.size() * 1e9, total.x + total.y + total.z);
+    }
+}
+
+// Size and speed of the two BLAS triangle formats, for incoherent rays and
+// for a grid of parallel rays like RayGen's
+void BenchmarkCompactFormat(const char* name, const std::vector<Vertex>& vertices)
+{
+    auto seconds = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    BottomLevelAS blas[2];
+    const TriangleFormat formats[2] = { TriangleFormat::Float, TriangleFormat::Quantized16 };
+    std::vector<Triangle> triangles = GatherTriangles({ { vertices.data(), static_cast<uint32_t>(vertices.size()) } });
+    for (int f = 0; f < 2; f++) blas[f].Build(triangles, BvhBuildOptions(), formats[f]);
+
+    std::mt19937 rng(29);
+    std::vector<Ray> incoherent(1 << 19), coherent;
+    for (Ray& ray : incoherent) ray = RandomRay(rng, blas[0].Bounds());
+    const Aabb bounds = blas[0].Bounds();
+    for (int y = 0; y < 1024; y++)
+    {
+        for (int x = 0; x < 1024; x++)
+        {
+            Ray ray;
+            ray.origin = Float3(bounds.bmin.x + bounds.Extent().x * (x + 0.5f) / 1024, bounds.bmin.y + bounds.Extent().y * (y + 0.5f) / 1024, bounds.bmax.z + 1.0f);
+            ray.direction = Float3(0.0f, 0.0f, -1.0f);
+            ray.tMin = 0.0f;
+            ray.tMax = 100000.0f;
+            coherent.push_back(ray);
+        }
+    }
+
+    std::vector<Hit> reference;
+    for (int f = 0; f < 2; f++)
+    {
+        for (const std::vector<Ray>* rays : { &incoherent, &coherent })
+        {
+            std::vector<Hit> hits(rays->size());
+            auto start = std::chrono::steady_clock::now();
+            for (size_t r = 0; r < rays->size(); r++) blas[f].Intersect((*rays)[r], hits[r]);
+            double s = seconds(start);
+
+            // Quantization moves the surface by up to half a step, so compare
+            // the distances rather than the triangles
+            size_t agree = 0;
+            if (f == 0) reference.insert(reference.end(), hits.begin(), hits.end());
+            const Hit* expected = reference.data() + (rays == &coherent ? incoherent.size() : 0);
+            for (size_t r = 0; r < hits.size(); r++)
+            {
+                agree += hits[r].Valid() == expected[r].Valid() && (!hits[r].Valid() || fabsf(hits[r].t - expected[r].t) < 1e-3f);
+            }
+            printf("[BENCH] BLAS %-12s %-11s %-10s : triangles %7.2f MB, total %7.2f MB, %6.2f Mrays/s, %6.2f%% same hit\n", name,
+                f == 0 ? "float" : "quantized16", rays == &coherent ? "coherent" : "incoherent",
+                blas[f].TriangleBytes() / 1048576.0, blas[f].Bytes() / 1048576.0, rays->size() / s / 1e6, 100.0 * agree / hits.size());
+        }
+    }
+}
+
+// A few instances of scene nudged every frame, redrawn by IncrementalRenderer
+// and in full. Ends with a full render of the last frame, which the kept
+// image has to match exactly.
+void BenchmarkIncrementalRender(const char* name, Scene scene, TopLevelAS& tlas, int width, int height, int frames)
+{
+    const int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    std::mt19937 rng(23);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    for (bool shadows : { false, true })
+    {
+        scene.shadows = shadows;
+        Image full(width, height);
+        RenderStats fullStats = Renderer(threads).Render(scene, full);
+
+        for (int movers : { 1, 8, 64 })
+        {
+            IncrementalRenderer incremental(threads);
+            Image image(width, height);
+            incremental.Render(scene, image);
+
+            double seconds = 0.0, tiles = 0.0;
+            for (int frame = 0; frame < frames; frame++)
+            {
+                for (int m = 0; m < movers; m++)
+                {
+                    uint32_t i = rng() % tlas.InstanceCount();
+                    tlas.SetTransform(i, Matrix34::Translation(0.01f * unit(rng), 0.01f * unit(rng), 0.0f) * tlas.GetInstance(i).transform);
+                }
+                tlas.Update();
+                seconds += incremental.Render(scene, image).seconds;
+                tiles += incremental.DirtyTiles();
+            }
+
+            Renderer(threads).Render(scene, full);
+            bool same = memcmp(full.pixels.data(), image.pixels.data(), image.pixels.size() * sizeof(Float4)) == 0;
+            printf("[BENCH] incremental %-12s %dx%d, %-10s %2i moved per frame : %8.2f ms per frame vs full %8.2f ms, %5.1f%% of tiles %s\n",
+                name, width, height, shadows ? "shadows" : "no shadows", movers, seconds * 1e3 / frames, fullStats.seconds * 1e3,
+                100.0 * tiles / frames / incremental.TileCount(), same ? "" : "IMAGE DIFFERS");
+        }
+    }
+}
+
+// Bumpy sphere colored by height, so the blend in ClosestHit has something
+// to show. The bumps reach past y = +-1; colors are clamped to what a UNORM
+// vertex color can hold.
+std::vector<Vertex> HeightColoredSphere(int rings, int segments)
+{
+    std::vector<Vertex> mesh = BumpySphere(rings, segments);
+    for (size_t i = 0; i < mesh.size(); i++)
+    {
+        float h = std::min(1.0f, std::max(0.0f, 0.5f + 0.5f * mesh[i].position.y));
+        mesh[i].color = Float4(h, 0.3f, 1.0f - h, 1.0f);
+    }
+    return mesh;
+}
+
+// side * side small spheres spread over the view, at various depths
+void BenchmarkSphereField(int side, int width, int height)
+{
+    std::vector<Vertex> mesh = HeightColoredSphere(32, 64);
+    BottomLevelAS blas;
+    blas.Build({ { mesh.data(), static_cast<uint32_t>(mesh.size()) } });
+
+    std::mt19937 rng(13);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<Instance> instances;
+    const float spacing = 2.0f / side;
+    for (int i = 0; i < side * side; i++)
+    {
+        float x = -1.0f + spacing * (i % side + 0.5f), y = -1.0f + spacing * (i / side + 0.5f);
+        Matrix34 transform = Matrix34::Translation(x, y, 0.5f * unit(rng)) * Matrix34::RotationY(3.0f * unit(rng)) * Matrix34::Scaling(0.6f * spacing);
+        instances.push_back(Instance { &blas, transform, static_cast<uint32_t>(i % 3) });
+    }
+    TopLevelAS tlas;
+    tlas.Build(instances);
+
+    Scene scene { &tlas, std::vector<HitGroupRecord>(instances.size(), HitGroupRecord { mesh.data() }) };
+    char name[32];
+    snprintf(name, sizeof(name), "%d spheres", side * side);
+    BenchmarkRender(name, scene, width, height);
+    BenchmarkTraceModes(name, scene, width, height);
+    BenchmarkWavefront(name, scene, width, height);
+
+    Image image(width, height);
+    Renderer().Render(scene, image);
+    image.WritePpm("spheres.ppm");
+
+    // Last, it moves the spheres
+    BenchmarkIncrementalRender(name, scene, tlas, 1280, 720, 5);
+}
+
+// A frame of a dynamic scene: meshes deformed and their BLAS rebuilt, one
+// per worker, then the TLAS over all their instances rebuilt. With useArena
+// every build takes its temporaries from the worker's part of a FrameArena
+// and its build nodes from the worker's NodePool; the arena is reset once
+// per frame.
+struct DynamicScene
+{
+    std::vector<std::vector<Vertex>> rest, deformed;
+    std::vector<std::vector<VertexBufferDesc>> buffers;
+    std::vector<BottomLevelAS> blas;
+    std::vector<Instance> instances;
+    TopLevelAS tlas;
+
+    DynamicScene(int meshes, int instancesPerMesh) : rest(meshes, BumpySphere(24, 48)), deformed(rest), blas(meshes)
+    {
+        for (std::vector<Vertex>& mesh : deformed) buffers.push_back({ { mesh.data(), static_cast<uint32_t>(mesh.size()) } });
+        for (int i = 0; i < meshes * instancesPerMesh; i++)
+        {
+            Matrix34 transform = Matrix34::Translation(3.0f * (i % 32), 0.0f, 3.0f * (i / 32));
+            instances.push_back(Instance { &blas[i % meshes], transform, static_cast<uint32_t>(i) });
+        }
+    }
+
+    void Frame(int frame, int threads, FrameArena* arena, std::vector<std::unique_ptr<NodePool<BvhBuildNode>>>* pools)
+    {
+        BvhBuildOptions options;
+        options.threads = 1;
+
+        TileScheduler scheduler(static_cast<int>(blas.size()), threads);
+        scheduler.Run([&](int mesh, int worker) {
+            const float wave = 0.05f * sinf(0.2f * frame + mesh);
+            for (size_t v = 0; v < rest[mesh].size(); v++)
+            {
+                deformed[mesh][v].position = rest[mesh][v].position * (1.0f + wave * rest[mesh][v].position.y);
+            }
+            BvhScratch scratch;
+            if (arena) scratch = BvhScratch(&arena->Thread(worker), (*pools)[worker].get());
+            blas[mesh].Build(buffers[mesh], options, TriangleFormat::Float, scratch);
+        });
+
+        BvhScratch scratch;
+        if (arena) scratch = BvhScratch(&arena->Thread(0), (*pools)[0].get());
+        tlas.Build(instances, BvhBuildOptions(), scratch);
+        if (arena) arena->Reset();
+    }
+};
+
+// Heap allocations and time per frame of DynamicScene, building through the
+// heap and through the arena and pools
+void BenchmarkFrameAllocations(int meshes, int instancesPerMesh, int frames)
+{
+    const int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    Image reference;
+    for (bool useArena : { false, true })
+    {
+        DynamicScene scene(meshes, instancesPerMesh);
+        FrameArena arena(threads);
+        std::vector<std::unique_ptr<NodePool<BvhBuildNode>>> pools;
+        for (int t = 0; t < threads; t++) pools.emplace_back(new NodePool<BvhBuildNode>());
+
+        // The first frame sizes the arena and pools; count the steady state
+        scene.Frame(0, threads, useArena ? &arena : nullptr, &pools);
+        uint64_t allocations = g_heapAllocations.load();
+        auto start = std::chrono::steady_clock::now();
+        for (int frame = 1; frame <= frames; frame++) scene.Frame(frame, threads, useArena ? &arena : nullptr, &pools);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+        double perFrame = double(g_heapAllocations.load() - allocations) / frames;
+
+        // Both ways have to build the same trees
+        Scene view { &scene.tlas, std::vector<HitGroupRecord>(scene.instances.size(), HitGroupRecord { scene.rest[0].data() }) };
+        Image image(256, 256);
+        Renderer(1).Render(view, image);
+        if (reference.pixels.empty()) reference = image;
+        bool same = memcmp(reference.pixels.data(), image.pixels.data(), image.pixels.size() * sizeof(Float4)) == 0;
+
+        uint64_t poolBlocks = 0;
+        for (const auto& pool : pools) poolBlocks += pool->Allocations();
+        printf("[BENCH] frame %d BLAS + TLAS of %zu instances, %-5s : %7.2f ms, %8.1f heap allocations per frame "
+            "(arena chunks %llu, pool blocks %llu, arena peak %.1f MB) %s\n", meshes, scene.instances.size(), useArena ? "arena" : "heap",
+            ms, perFrame, static_cast<unsigned long long>(arena.Allocations()), static_cast<unsigned long long>(poolBlocks),
+            arena.HighWater() / 1048576.0, same ? "" : "IMAGE DIFFERS");
+    }
+}
+
+// Regression suite for bench/run.sh: BLAS build, incoherent single rays and
+// a small render in every trace mode, megakernel and wavefront with shadows,
+// and an incremental frame
+int RunBenchSuite()
+{
+    BenchSuite suite("cputracer");
+
+    std::vector<Vertex> sphere = BumpySphere(128, 256);
+    std::vector<Triangle> triangles = GatherTriangles({ { sphere.data(), static_cast<uint32_t>(sphere.size()) } });
+    BottomLevelAS blas;
+    suite.Run("BLAS build SAH bumpy sphere", triangles.size(), [&] { blas.Build(triangles); });
+
+    const int rays = 1 << 16;
+    std::mt19937 rng(17);
+    std::vector<Ray> incoherent(rays);
+    for (Ray& ray : incoherent) ray = RandomRay(rng, blas.Bounds());
+    suite.Run("incoherent rays single", rays, [&] {
+        uint64_t found = 0;
+        for (const Ray& ray : incoherent)
+        {
+            Hit hit;
+            found += blas.Intersect(ray, hit);
+        }
+        BenchKeep(found);
+    });
+    if (HasAvx2())
+    {
+        suite.Run("incoherent rays wide", rays, [&] {
+            uint64_t found = 0;
+            for (const Ray& ray : incoherent)
+            {
+                Hit hit;
+                found += blas.IntersectWide(ray, hit);
+            }
+            BenchKeep(found);
+        });
+    }
+
+    const int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    DynamicScene dynamic(16, 64);
+    FrameArena arena(threads);
+    std::vector<std::unique_ptr<NodePool<BvhBuildNode>>> pools;
+    for (int t = 0; t < threads; t++) pools.emplace_back(new NodePool<BvhBuildNode>());
+    int frame = 0;
+    suite.Run("dynamic frame heap", 1, [&] { dynamic.Frame(frame++, threads, nullptr, &pools); });
+    suite.Run("dynamic frame arena", 1, [&] { dynamic.Frame(frame++, threads, &arena, &pools); });
+
+    TopLevelAS tlas;
+    tlas.Build({
+        { &blas, Matrix34::Translation(-0.5f, 0, 0) * Matrix34::Scaling(0.4f), 0 },
+        { &blas, Matrix34::Translation(0.5f, 0, 0) * Matrix34::Scaling(0.4f), 1 },
+    });
+    Scene scene { &tlas, { { sphere.data() }, { sphere.data() } } };
+    Image image(640, 360);
+    for (TraceMode mode : { TraceMode::Single, TraceMode::Wide, TraceMode::Packet })
+    {
+        Renderer renderer(static_cast<int>(std::max(1u, std::thread::hardware_concurrency())), 16, mode);
+        if (renderer.Mode() != mode) continue;
+        std::string name = std::string("render 640x360 ") + TraceModeName(mode);
+        suite.Run(name.c_str(), image.width * image.height, [&] { renderer.Render(scene, image); });
+    }
+    IncrementalRenderer incremental(threads);
+    incremental.Render(scene, image);
+    int step = 0;
+    suite.Run("incremental render 640x360 one moved", 1, [&] {
+        float dx = (step++ & 1) ? -0.01f : 0.01f;
+        tlas.SetTransform(0, Matrix34::Translation(dx, 0, 0) * tlas.GetInstance(0).transform);
+        tlas.Update();
+        incremental.Render(scene, image);
+    });
+
+    scene.shadows = true;
+    for (TraceMode mode : { TraceMode::Single, TraceMode::Packet })
+    {
+        Renderer renderer(threads, 16, mode);
+        WavefrontRenderer wavefront(threads, mode);
+        if (renderer.Mode() != mode) continue;
+        std::string name = std::string("render shadows 640x360 ") + TraceModeName(mode);
+        suite.Run((name + " megakernel").c_str(), image.width * image.height, [&] { renderer.Render(scene, image); });
+        suite.Run((name + " wavefront").c_str(), image.width * image.height, [&] { wavefront.Render(scene, image); });
+    }
+
+    return suite.Finish();
+}
+
+int main(int argc, char** argv)
+{
+    if (BenchSuite::Requested(argc, argv)) return RunBenchSuite();
+
+    // Same inputs as CreateAccelerationStructures: one BLAS for the triangle,
+    // one for the plane
+    std::vector<Vertex> triangle = SampleTriangle();
+    std::vector<Vertex> plane = SamplePlane();
+    BottomLevelAS triangleBlas, planeBlas;
+    triangleBlas.Build({ { triangle.data(), 3 } });
+    planeBlas.Build({ { plane.data(), 6 } });
+
+    // The RayGen ray through the middle of the screen hits the triangle at z = 0
+    Ray ray;
+    ray.origin = Float3(0.0f, 0.0f, 1.0f);
+    ray.direction = Float3(0.0f, 0.0f, -1.0f);
+    ray.tMin = 0.0f;
+    ray.tMax = 100000.0f;
+    Hit hit;
+    bool hitTriangle = triangleBlas.Intersect(ray, hit);
+    printf("[MAIN] Center ray : %s at t = %.2f, barycentrics (%.2f, %.2f, %.2f)\n",
+        hitTriangle ? "hit" : "MISSED", hit.t, 1.0f - hit.u - hit.v, hit.u, hit.v);
+    printf("[MAIN] Plane BLAS : %zu triangles, %zu nodes\n", planeBlas.TriangleCount(), planeBlas.NodeCount());
+    if (HasAvx2())
+    {
+        printf("[MAIN] Rays with tMax = FLT_MAX, all trace modes agree : %s\n",
+            CheckUnboundedRays(triangleBlas) && CheckUnboundedRays(planeBlas) ? "yes" : "NO");
+    }
+
+    // The instances of CreateAccelerationStructures
+    TopLevelAS sampleTlas;
+    sampleTlas.Build({
+        { &triangleBlas, Matrix34::Identity(), 0 },
+        { &triangleBlas, Matrix34::Translation(-.6f, 0, 0), 1 },
+        { &triangleBlas, Matrix34::Translation(.6f, 0, 0), 2 },
+        { &planeBlas, Matrix34::Translation(0, 0, 0), 3 },
+    });
+    // RayGen style rays: straight down -z, one per triangle and one that
+    // passes them and falls onto the plane
+    const Float3 directions[] = { Float3(0, 0, -1), Float3(0, 0, -1), Float3(0, 0, -1), Normalize(Float3(0, -1, -1)) };
+    const float xs[] = { -0.6f, 0.0f, 0.6f, 1.2f };
+    for (int i = 0; i < 4; i++)
+    {
+        Ray sampleRay = ray;
+        sampleRay.origin = Float3(xs[i], 0.0f, 1.0f);
+        sampleRay.direction = directions[i];
+        Hit sampleHit;
+        sampleTlas.Intersect(sampleRay, sampleHit);
+        printf("[MAIN] Ray from x = %5.2f : instance %u at t = %.2f\n", xs[i], sampleHit.instance, sampleHit.t);
+    }
+
+    // The sample frame, as DispatchRays would draw it at 1280x720
+    Scene sampleScene { &sampleTlas, { { triangle.data() }, { triangle.data() }, { triangle.data() }, { plane.data() } } };
+    Image frame(1280, 720);
+    RenderStats frameStats = Renderer().Render(sampleScene, frame);
+    bool written = frame.WritePpm("sample.ppm") && frame.WritePfm("sample.pfm");
+    printf("[MAIN] Sample frame : %.2f ms, %.2f Mrays/s, %s sample.ppm / sample.pfm\n",
+        frameStats.seconds * 1e3, frameStats.MraysPerSecond(), written ? "wrote" : "FAILED to write");
+
+    std::vector<Vertex> sphere = BumpySphere(64, 128);
+    std::vector<Vertex> soup = TriangleSoup(20000, 3);
+    for (const std::vector<Vertex>* mesh : { &sphere, &soup })
+    {
+        std::vector<VertexBufferDesc> buffers = { { mesh->data(), static_cast<uint32_t>(mesh->size()) } };
+        std::vector<Triangle> triangles = GatherTriangles(buffers);
+        for (BvhSplit split : { BvhSplit::Sah, BvhSplit::Median })
+        {
+            BvhBuildOptions options;
+            options.split = split;
+            BottomLevelAS blas;
+            blas.Build(triangles, options);
+            printf("[MAIN] %zu triangles, %s BVH agrees with brute force : %s\n", triangles.size(),
+                split == BvhSplit::Sah ? "SAH" : "median", CheckAgainstBruteForce(blas, triangles, 2000) ? "yes" : "NO");
+            if (HasAvx2())
+            {
+                printf("[MAIN] %zu triangles, %s BVH wide and packet traversal agree : %s\n", triangles.size(),
+                    split == BvhSplit::Sah ? "SAH" : "median", CheckTraceModes(blas, 500) ? "yes" : "NO");
+            }
+        }
+
+        // The packet and wide paths decode quantized triangles on their own
+        if (HasAvx2())
+        {
+            BottomLevelAS quantized;
+            quantized.Build(triangles, BvhBuildOptions(), TriangleFormat::Quantized16);
+            printf("[MAIN] %zu triangles, quantized16 BVH wide and packet traversal agree : %s\n", triangles.size(),
+                CheckTraceModes(quantized, 500) ? "yes" : "NO");
+            printf("[MAIN] %zu triangles, coincident instances resolve to the first in every trace mode : %s\n", triangles.size(),
+                CheckCoincidentInstances(quantized, 200) ? "yes" : "NO");
+        }
+    }
+
+    BenchmarkBlasBuild("bumpy sphere", BumpySphere(512, 1024));
+    BenchmarkBlasBuild("soup", TriangleSoup(1 << 20, 7));
+
+    BenchmarkTlasUpdates(128, 100, false);
+    BenchmarkTlasUpdates(128, 100, true);
+    BenchmarkFrameAllocations(16, 64, 50);
+
+    BenchmarkRender("sample", sampleScene, 1920, 1080);
+    BenchmarkTraceModes("sample", sampleScene, 1920, 1080);
+    BenchmarkWavefront("sample", sampleScene, 1920, 1080);
+    BenchmarkSphereField(32, 1920, 1080);
+    if (HasAvx2())
+    {
+        BenchmarkIncoherentRays("bumpy sphere", BumpySphere(512, 1024), 1 << 20);
+        BenchmarkIncoherentRays("soup", TriangleSoup(1 << 20, 7), 1 << 20);
+    }
+
+    for (int level = 1; level <= 3; level++)
+    {
+        printf("[MAIN] Menger sponge L%d : welded, per cube and instanced agree : %s\n", level, CheckMengerSponge(level, level - 1, 2000) ? "yes" : "NO");
+    }
+    BenchmarkMengerSponge(5);
+
+    CheckCompactVertices("bumpy sphere", BumpySphere(64, 128));
+    CheckCompactVertices("soup", TriangleSoup(20000, 3));
+    const std::vector<size_t> sampleCounts = { triangle.size(), triangle.size(), triangle.size(), plane.size() };
+    CheckCompactRender("sample", sampleScene, sampleCounts, 1280, 720);
+    Scene shadowedScene = sampleScene;
+    shadowedScene.shadows = true;
+    CheckCompactRender("sample, shadows", shadowedScene, sampleCounts, 1280, 720);
+
+    // The sample's vertex colors are exact in 8 bits; these are not
+    std::vector<Vertex> coloredSphere = HeightColoredSphere(32, 64);
+    BottomLevelAS sphereBlas;
+    sphereBlas.Build({ { coloredSphere.data(), static_cast<uint32_t>(coloredSphere.size()) } });
+    TopLevelAS sphereTlas;
+    sphereTlas.Build({
+        { &sphereBlas, Matrix34::Translation(-.6f, 0, 0) * Matrix34::Scaling(0.3f), 0 },
+        { &sphereBlas, Matrix34::Translation(0, 0, 0) * Matrix34::Scaling(0.3f), 1 },
+        { &sphereBlas, Matrix34::Translation(.6f, 0, 0) * Matrix34::Scaling(0.3f), 2 },
+    });
+    Scene sphereScene { &sphereTlas, std::vector<HitGroupRecord>(3, HitGroupRecord { coloredSphere.data() }), true };
+    CheckCompactRender("spheres, shadows", sphereScene, std::vector<size_t>(3, coloredSphere.size()), 1280, 720);
+    IndexedMesh sponge = GenerateMengerSponge(3, 1.5f);
+    CompactVertexBuffer compactSponge(sponge.vertices.data(), sponge.vertices.size(), sponge.indices.data(), sponge.indices.size());
+    printf("[MAIN] Compact Menger L3 : %zu vertices, %.2f MB -> %.2f MB\n", sponge.vertices.size(),
+        sponge.vertices.size() * sizeof(Vertex) / 1048576.0, compactSponge.Bytes() / 1048576.0);
+    for (int segments : { 128, 256, 1024 })
+    {
+        BenchmarkVertexFetch("bumpy sphere", BumpySphere(segments / 2, segments));
+    }
+    BenchmarkCompactFormat("bumpy sphere", BumpySphere(512, 1024));
+    BenchmarkCompactFormat("soup", TriangleSoup(1 << 20, 7));
+
+    return 0;
+}
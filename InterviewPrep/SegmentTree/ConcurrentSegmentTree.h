@@ -0,0 +1,201 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "SegmentTree.h"
+#include "TreeStorage.h"
+
+// SegmentTree for many reader threads and an ingest thread, after the
+// left-right scheme: two copies of the flat tree, one published to readers
+// while the writer works on the other.
+//
+// A writer applies a batch of point updates to the back copy and publishes
+// it with one atomic store. The copy it leaves behind is one batch late; the
+// next batch first waits until no reader is left in it and replays the
+// previous batch there, so readers get the whole gap between batches to
+// drain. Readers never take a lock and never wait for the writer: they mark
+// which copy they are in, in a slot of their own, check it is still the
+// published one and read it. They only retry when a publish lands between
+// those two steps.
+//
+// A batch is sorted by leaf, and ancestors shared by several of its updates
+// are recomputed once, level by level, instead of once per update. The
+// published word packs the batch count with the copy, so every query can
+// report the exact version it answered from.
+
+// Most reader ids a tree hands out slots for
+static const int kMaxTreeReaders = 256;
+
+template <typename T, typename Op = SumOp<T>>
+class ConcurrentSegmentTree
+{
+    static_assert(std::is_trivially_copyable<T>::value, "ConcurrentSegmentTree nodes are stored in raw mapped memory");
+
+    public:
+        struct PointUpdate
+        {
+            int64_t index;
+            T value;
+        };
+
+        // Readers are numbered 0 .. readers - 1; each id is used by one thread
+        // at a time. Throws std::invalid_argument unless 1 <= readers <=
+        // kMaxTreeReaders.
+        ConcurrentSegmentTree(const T* values, int64_t n, int readers, Op op = Op(), HugePages pages = HugePages::Transparent)
+            : _op(op), _n(n), _readers(CheckedReaders(readers)), _slots(new Slot[_readers]), _state(0), _nodesWritten(0)
+        {
+            for (TreeStorage<T>& tree : _copies)
+            {
+                tree = TreeStorage<T>(2 * n, pages);
+                tree[0] = _op.Identity();
+                for (int64_t i = 0; i < n; i++) tree[n + i] = values[i];
+                for (int64_t i = n - 1; i > 0; i--) tree[i] = _op(tree[2*i], tree[2*i+1]);
+            }
+            for (int r = 0; r < _readers; r++) _slots[r].copy.store(0, std::memory_order_relaxed);
+        }
+
+        // Reader side. version, when given, receives the number of batches
+        // the answer includes.
+        T Query(int reader, int64_t l, int64_t r, uint64_t* version = nullptr) const
+        {
+            const TreeStorage<T>& tree = Enter(reader, version);
+            T resl = _op.Identity();
+            T resr = _op.Identity();
+            for (l += _n, r += _n; l < r; l >>= 1, r >>= 1)
+            {
+                if (l&1) resl = _op(resl, tree[l++]);
+                if (r&1) resr = _op(tree[--r], resr);
+            }
+            Leave(reader);
+            return _op(resl, resr);
+        }
+
+        T Get(int reader, int64_t i, uint64_t* version = nullptr) const
+        {
+            T value = Enter(reader, version)[_n + i];
+            Leave(reader);
+            return value;
+        }
+
+        // Writer side: applies batch as one new version and returns its
+        // number. Sorts batch in place; for repeated leaves the last update
+        // wins. Writers are serialized, readers are never held up.
+        uint64_t Apply(std::vector<PointUpdate>& batch)
+        {
+            std::lock_guard<std::mutex> lock(_writer);
+            std::stable_sort(batch.begin(), batch.end(), [](const PointUpdate& a, const PointUpdate& b) { return a.index < b.index; });
+
+            // The back copy was published before the last batch: wait out the
+            // readers still in it, then catch it up
+            const uint64_t state = _state.load(std::memory_order_relaxed);
+            const uint32_t back = static_cast<uint32_t>(state & 1) ^ 1;
+            for (int r = 0; r < _readers; r++)
+            {
+                while (_slots[r].copy.load(std::memory_order_seq_cst) == back + 1) std::this_thread::yield();
+            }
+            Write(_copies[back], _pending);
+
+            const uint64_t version = (state >> 1) + 1;
+            Write(_copies[back], batch);
+            _state.store(version << 1 | back, std::memory_order_seq_cst);
+            _pending = batch;
+            return version;
+        }
+
+        uint64_t Update(int64_t i, const T& value)
+        {
+            std::vector<PointUpdate> batch(1, PointUpdate { i, value });
+            return Apply(batch);
+        }
+
+        uint64_t Version() const { return _state.load(std::memory_order_acquire) >> 1; }
+        int64_t Size() const { return _n; }
+        int Readers() const { return _readers; }
+        // Inner nodes recomputed by writers, both copies counted (the back
+        // copy one batch late)
+        uint64_t NodesWritten() const { return _nodesWritten; }
+
+    private:
+        // One reader's copy + 1, 0 when outside. 128 bytes apart so no two
+        // slots share a line however new aligns the array.
+        struct Slot
+        {
+            std::atomic<uint32_t> copy;
+            char padding[124];
+        };
+
+        static int CheckedReaders(int readers)
+        {
+            if (readers < 1 || readers > kMaxTreeReaders) throw std::invalid_argument("ConcurrentSegmentTree: readers out of range");
+            return readers;
+        }
+
+        const TreeStorage<T>& Enter(int reader, uint64_t* version) const
+        {
+            assert(reader >= 0 && reader < _readers);
+            std::atomic<uint32_t>& slot = _slots[reader].copy;
+            uint64_t state = _state.load(std::memory_order_seq_cst);
+            for (;;)
+            {
+                slot.store(static_cast<uint32_t>(state & 1) + 1, std::memory_order_seq_cst);
+                // Once the slot is visible a writer has to wait for it before
+                // touching this copy, so only a publish in between matters
+                uint64_t now = _state.load(std::memory_order_seq_cst);
+                bool same = (now & 1) == (state & 1);
+                state = now;
+                if (same) break;
+            }
+            if (version) *version = state >> 1;
+            return _copies[state & 1];
+        }
+
+        void Leave(int reader) const { _slots[reader].copy.store(0, std::memory_order_release); }
+
+        // Leaves of a sorted batch, then their ancestors one round at a time.
+        // Each round maps the sorted dirty nodes to their parents, which
+        // keeps them sorted, so shared parents are next to each other.
+        void Write(TreeStorage<T>& tree, const std::vector<PointUpdate>& batch)
+        {
+            std::vector<int64_t>& dirty = _dirty;
+            dirty.clear();
+            for (const PointUpdate& u : batch)
+            {
+                tree[_n + u.index] = u.value;
+                int64_t parent = (_n + u.index) >> 1;
+                if (dirty.empty() || dirty.back() != parent) dirty.push_back(parent);
+            }
+            while (!dirty.empty() && dirty[0] > 0)
+            {
+                size_t next = 0;
+                for (size_t k = 0; k < dirty.size(); k++)
+                {
+                    int64_t i = dirty[k];
+                    tree[i] = _op(tree[2*i], tree[2*i+1]);
+                    if (next == 0 || dirty[next - 1] != (i >> 1)) dirty[next++] = i >> 1;
+                }
+                _nodesWritten += dirty.size();
+                dirty.resize(next);
+            }
+        }
+
+        Op _op;
+        int64_t _n;
+        int _readers;
+        std::unique_ptr<Slot[]> _slots;
+        TreeStorage<T> _copies[2];
+        std::atomic<uint64_t> _state; // version << 1 | published copy
+
+        std::mutex _writer;
+        std::vector<PointUpdate> _pending; // last batch, not yet in the back copy
+        std::vector<int64_t> _dirty;
+        uint64_t _nodesWritten;
+};
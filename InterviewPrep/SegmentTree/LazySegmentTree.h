@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+
+#include "SegmentTree.h"
+#include "TreeStorage.h"
+
+// Aggregate kept by every node of the lazy tree, so one tree answers sum,
+// min and max queries. len is needed to scale range add / assign on sums.
+template <typename T>
+struct RangeStats
+{
+    T sum;
+    T min;
+    T max;
+    int len;
+};
+
+// Pending update on a node: an optional assign followed by an add.
+// Composing two tags stays in that form, which is what keeps range assign
+// and range add O(log n) when mixed.
+template <typename T>
+struct RangeTag
+{
+    bool assign;
+    T set;
+    T add;
+};
+
+// Same bottom-up layout as SegmentTree, with the leaf count rounded up to a
+// power of two so every node covers a contiguous aligned block. Updates push
+// pending tags down along the two boundary paths only, then rebuild those
+// same paths, so both updates and queries touch O(log n) nodes.
+// Ranges are half open, [l, r).
+template <typename T>
+class LazySegmentTree
+{
+    public:
+        LazySegmentTree(const T* values, int n, HugePages pages = HugePages::Transparent) : _n(n), _log(0)
+        {
+            while ((1 << _log) < n) _log++;
+            _size = 1 << _log;
+
+            _node = TreeStorage<RangeStats<T>>(2 * _size, pages);
+            _tag = TreeStorage<RangeTag<T>>(_size, pages);
+            for (int i = 0; i < _size; i++)
+            {
+                _node[_size + i] = i < n ? RangeStats<T>{ values[i], values[i], values[i], 1 } : Empty();
+                _tag[i] = NoTag();
+            }
+            for (int i = _size - 1; i > 0; i--)
+            {
+                Pull(i);
+            }
+        }
+
+        void RangeAdd(int l, int r, const T& value)
+        {
+            RangeTag<T> tag = { false, T(0), value };
+            Apply(l, r, tag);
+        }
+
+        void RangeAssign(int l, int r, const T& value)
+        {
+            RangeTag<T> tag = { true, value, T(0) };
+            Apply(l, r, tag);
+        }
+
+        RangeStats<T> Query(int l, int r)
+        {
+            if (l >= r) return Empty();
+
+            l += _size;
+            r += _size;
+            PushBoundaries(l, r);
+
+            RangeStats<T> resl = Empty(), resr = Empty();
+            for (; l < r; l >>= 1, r >>= 1)
+            {
+                if (l&1) resl = Merge(resl, _node[l++]);
+                if (r&1) resr = Merge(_node[--r], resr);
+            }
+            return Merge(resl, resr);
+        }
+
+        T QuerySum(int l, int r) { return Query(l, r).sum; }
+        T QueryMin(int l, int r) { return Query(l, r).min; }
+        T QueryMax(int l, int r) { return Query(l, r).max; }
+
+        int Size() const { return _n; }
+
+    private:
+        static RangeStats<T> Empty()
+        {
+            return { T(0), MinOp<T>().Identity(), MaxOp<T>().Identity(), 0 };
+        }
+
+        static RangeTag<T> NoTag() { return { false, T(0), T(0) }; }
+
+        static RangeStats<T> Merge(const RangeStats<T>& a, const RangeStats<T>& b)
+        {
+            return { a.sum + b.sum, std::min(a.min, b.min), std::max(a.max, b.max), a.len + b.len };
+        }
+
+        void Pull(int i) { _node[i] = Merge(_node[2*i], _node[2*i+1]); }
+
+        void ApplyNode(int i, const RangeTag<T>& tag)
+        {
+            RangeStats<T>& node = _node[i];
+            if (node.len == 0) return;
+
+            if (tag.assign)
+            {
+                node.sum = tag.set * node.len;
+                node.min = tag.set;
+                node.max = tag.set;
+            }
+            node.sum += tag.add * node.len;
+            node.min += tag.add;
+            node.max += tag.add;
+
+            if (i < _size)
+            {
+                RangeTag<T>& pending = _tag[i];
+                if (tag.assign) pending = tag;
+                else pending.add += tag.add;
+            }
+        }
+
+        void Push(int i)
+        {
+            RangeTag<T>& pending = _tag[i];
+            if (!pending.assign && pending.add == T(0)) return;
+
+            ApplyNode(2*i, pending);
+            ApplyNode(2*i+1, pending);
+            pending = NoTag();
+        }
+
+        // Push every tag above the first and last leaf of [l, r) so the
+        // nodes visited by the bottom-up loop hold up to date values.
+        void PushBoundaries(int l, int r)
+        {
+            for (int h = _log; h > 0; h--)
+            {
+                if (((l >> h) << h) != l) Push(l >> h);
+                if (((r >> h) << h) != r) Push((r - 1) >> h);
+            }
+        }
+
+        void Apply(int l, int r, const RangeTag<T>& tag)
+        {
+            if (l >= r) return;
+
+            l += _size;
+            r += _size;
+            PushBoundaries(l, r);
+
+            for (int l2 = l, r2 = r; l2 < r2; l2 >>= 1, r2 >>= 1)
+            {
+                if (l2&1) ApplyNode(l2++, tag);
+                if (r2&1) ApplyNode(--r2, tag);
+            }
+
+            for (int h = 1; h <= _log; h++)
+            {
+                if (((l >> h) << h) != l) Pull(l >> h);
+                if (((r >> h) << h) != r) Pull((r - 1) >> h);
+            }
+        }
+
+        int _n;
+        int _log;
+        int _size;
+        TreeStorage<RangeStats<T>> _node;
+        TreeStorage<RangeTag<T>> _tag;
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "SegmentTree.h"
+#include "TreeStorage.h"
+
+// Segment tree that keeps every version. An update copies only the nodes on
+// the path from the root to the changed leaf, about log2(n) + 1 of them, and
+// shares the rest with the version it started from; any version stays
+// queryable in O(log n). Version 0 is the tree built from the initial values.
+//
+// Nodes are bump allocated from blocks of mapped TreeStorage and only freed
+// with the tree, so an update is a few stores and no malloc. Children are
+// 32-bit indices into those blocks, which keeps a node of int64 sums at 16
+// bytes; past 2^32 nodes the pool is full and Update throws
+// std::length_error, leaving every existing version intact. Ranges are half
+// open, [l, r), and left and right partial results are combined in order,
+// as in SegmentTree.
+
+// Nodes per pool block, as a power of two
+static const int kPersistentBlockShift = 16;
+// Nodes a pool can index with its 32-bit links
+static const int64_t kPersistentMaxNodes = int64_t(1) << 32;
+
+template <typename T, typename Op = SumOp<T>>
+class PersistentSegmentTree
+{
+    static_assert(std::is_trivially_copyable<T>::value, "PersistentSegmentTree nodes are stored in raw mapped memory");
+
+    public:
+        struct Node
+        {
+            T value;
+            uint32_t left;
+            uint32_t right;
+        };
+
+        PersistentSegmentTree(const T* values, int64_t n, Op op = Op()) : _op(op), _n(n), _count(0)
+        {
+            _roots.push_back(n > 0 ? Build(values, 0, n) : NewNode(Node { _op.Identity(), 0, 0 }));
+        }
+
+        // Sets leaf i of version to value as a new version and returns its
+        // number. Older versions, including the one it started from, are left
+        // as they were, so history can branch.
+        int Update(int version, int64_t i, const T& value)
+        {
+            uint32_t path[64];
+            int depth = 0;
+
+            uint32_t copy = NewNode(At(_roots[version]));
+            const uint32_t root = copy;
+            for (int64_t lo = 0, hi = _n; hi - lo > 1;)
+            {
+                path[depth++] = copy;
+                Node& node = At(copy);
+                int64_t mid = lo + (hi - lo) / 2;
+                if (i < mid)
+                {
+                    node.left = copy = NewNode(At(node.left));
+                    hi = mid;
+                }
+                else
+                {
+                    node.right = copy = NewNode(At(node.right));
+                    lo = mid;
+                }
+            }
+            At(copy).value = value;
+
+            while (depth-- > 0)
+            {
+                Node& node = At(path[depth]);
+                node.value = _op(At(node.left).value, At(node.right).value);
+            }
+            _roots.push_back(root);
+            return Versions() - 1;
+        }
+
+        // Update on top of the latest version
+        int Update(int64_t i, const T& value) { return Update(Versions() - 1, i, value); }
+
+        T Query(int version, int64_t l, int64_t r) const
+        {
+            if (l >= r) return _op.Identity();
+            return Query(_roots[version], 0, _n, l, r);
+        }
+
+        T Get(int version, int64_t i) const
+        {
+            uint32_t node = _roots[version];
+            for (int64_t lo = 0, hi = _n; hi - lo > 1;)
+            {
+                int64_t mid = lo + (hi - lo) / 2;
+                if (i < mid)
+                {
+                    node = At(node).left;
+                    hi = mid;
+                }
+                else
+                {
+                    node = At(node).right;
+                    lo = mid;
+                }
+            }
+            return At(node).value;
+        }
+
+        int Versions() const { return static_cast<int>(_roots.size()); }
+        int64_t Size() const { return _n; }
+        int64_t NodeCount() const { return _count; }
+        // Mapped bytes of the node pool, including the unused end of the last block
+        size_t Bytes() const { return _blocks.size() * (size_t(1) << kPersistentBlockShift) * sizeof(Node); }
+
+    private:
+        static const uint32_t kBlockMask = (1u << kPersistentBlockShift) - 1;
+
+        Node& At(uint32_t index) { return _blocks[index >> kPersistentBlockShift][index & kBlockMask]; }
+        const Node& At(uint32_t index) const { return _blocks[index >> kPersistentBlockShift][index & kBlockMask]; }
+
+        // Takes the node by value: copying from a node of this pool is fine,
+        // blocks never move once mapped
+        uint32_t NewNode(Node node)
+        {
+            if (_count == kPersistentMaxNodes) throw std::length_error("PersistentSegmentTree: node pool holds 2^32 nodes at most");
+            if ((_count >> kPersistentBlockShift) == static_cast<int64_t>(_blocks.size()))
+            {
+                _blocks.emplace_back(int64_t(1) << kPersistentBlockShift);
+            }
+            const uint32_t index = static_cast<uint32_t>(_count++);
+            At(index) = node;
+            return index;
+        }
+
+        uint32_t Build(const T* values, int64_t lo, int64_t hi)
+        {
+            if (hi - lo == 1) return NewNode(Node { values[lo], 0, 0 });
+
+            int64_t mid = lo + (hi - lo) / 2;
+            uint32_t left = Build(values, lo, mid);
+            uint32_t right = Build(values, mid, hi);
+            return NewNode(Node { _op(At(left).value, At(right).value), left, right });
+        }
+
+        T Query(uint32_t node, int64_t lo, int64_t hi, int64_t l, int64_t r) const
+        {
+            if (l <= lo && hi <= r) return At(node).value;
+
+            int64_t mid = lo + (hi - lo) / 2;
+            if (r <= mid) return Query(At(node).left, lo, mid, l, r);
+            if (l >= mid) return Query(At(node).right, mid, hi, l, r);
+            return _op(Query(At(node).left, lo, mid, l, r), Query(At(node).right, mid, hi, l, r));
+        }
+
+        Op _op;
+        int64_t _n;
+        int64_t _count;
+        std::vector<TreeStorage<Node>> _blocks;
+        std::vector<uint32_t> _roots;
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdint.h>
+#include <limits>
+#include <memory>
+#include <type_traits>
+
+#include "TreeStorage.h"
+
+// Aggregates usable with SegmentTree. Each one is an empty functor exposing
+// its identity element and the combine step; since the op is a template
+// parameter, the calls are resolved (and inlined) at compile time.
+template <typename T>
+struct SumOp
+{
+    T Identity() const { return T(0); }
+    T operator()(const T& a, const T& b) const { return a + b; }
+};
+
+template <typename T>
+struct MinOp
+{
+    T Identity() const
+    {
+        return std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity() : std::numeric_limits<T>::max();
+    }
+    T operator()(const T& a, const T& b) const { return b < a ? b : a; }
+};
+
+template <typename T>
+struct MaxOp
+{
+    T Identity() const
+    {
+        return std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::lowest();
+    }
+    T operator()(const T& a, const T& b) const { return a < b ? b : a; }
+};
+
+template <typename T>
+struct GcdOp
+{
+    T Identity() const { return T(0); }
+    T operator()(T a, T b) const
+    {
+        if (a < 0) a = -a;
+        if (b < 0) b = -b;
+        while (b != 0)
+        {
+            T t = a % b;
+            a = b;
+            b = t;
+        }
+        return a;
+    }
+};
+
+// Same layout as BuildSegmentTree / QuerySegmentTree: leaves live in
+// [n, 2n), node i combines children 2i and 2i+1, node 0 is unused.
+// Queries are on the half open range [l, r). Left and right partial results
+// are kept apart so non commutative ops also give the right answer.
+// Nodes live in a TreeStorage, so T has to be trivially copyable.
+template <typename T, typename Op = SumOp<T>>
+class SegmentTree
+{
+    static_assert(std::is_trivially_copyable<T>::value, "SegmentTree nodes are stored in raw mapped memory");
+
+    public:
+        SegmentTree(const T* values, int64_t n, Op op = Op(), HugePages pages = HugePages::Transparent)
+            : _op(op), _n(n), _tree(2 * n, pages)
+        {
+            _tree[0] = _op.Identity();
+            for (int64_t i = 0; i < n; i++)
+            {
+                _tree[n + i] = values[i];
+            }
+            for (int64_t i = n - 1; i > 0; i--)
+            {
+                _tree[i] = _op(_tree[2*i], _tree[2*i+1]);
+            }
+        }
+
+        // Maps a tree written by Save instead of building it. Returns null if
+        // the file is missing or was saved for another element type.
+        static std::unique_ptr<SegmentTree> Load(const char* path, Op op = Op())
+        {
+            int64_t n = 0;
+            TreeStorage<T> storage = TreeStorage<T>::MapFile(path, &n);
+            if (!storage.Data() || storage.Count() != 2 * n) return nullptr;
+
+            return std::unique_ptr<SegmentTree>(new SegmentTree(std::move(storage), n, op));
+        }
+
+        bool Save(const char* path) const
+        {
+            return SaveTreeFile(path, _tree.Data(), _tree.Count(), _n);
+        }
+
+        void Update(int64_t i, const T& value)
+        {
+            i += _n;
+            _tree[i] = value;
+            for (i >>= 1; i > 0; i >>= 1)
+            {
+                _tree[i] = _op(_tree[2*i], _tree[2*i+1]);
+            }
+        }
+
+        T Query(int64_t l, int64_t r) const
+        {
+            T resl = _op.Identity();
+            T resr = _op.Identity();
+
+            for (l += _n, r += _n; l < r; l >>= 1, r >>= 1)
+            {
+                if (l&1) resl = _op(resl, _tree[l++]);
+                if (r&1) resr = _op(_tree[--r], resr);
+            }
+            return _op(resl, resr);
+        }
+
+        T Get(int64_t i) const { return _tree[_n + i]; }
+        int64_t Size() const { return _n; }
+        HugePages Backing() const { return _tree.Backing(); }
+
+    private:
+        SegmentTree(TreeStorage<T>&& storage, int64_t n, Op op)
+            : _op(op), _n(n), _tree(std::move(storage))
+        {
+        }
+
+        Op _op;
+        int64_t _n;
+        TreeStorage<T> _tree;
+};
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <new>
+#include <utility>
+
+// Where the pages of a TreeStorage come from
+enum class HugePages
+{
+    None,           // Regular 4KB pages
+    Transparent,    // madvise(MADV_HUGEPAGE), the kernel promotes when it can
+    Explicit,       // MAP_HUGETLB from the reserved pool, falls back to Transparent
+    File            // Private mapping of a tree saved with SaveTreeFile
+};
+
+// Header written in front of a saved tree. 64 bytes so the data that follows
+// stays cache line aligned once the file is mapped.
+struct TreeFileHeader
+{
+    char magic[8];
+    int64_t n;
+    int64_t count;
+    int64_t elemSize;
+    char pad[32];
+};
+
+static const char kTreeFileMagic[8] = { 'S', 'E', 'G', 'T', 'R', 'E', 'E', '1' };
+static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+// Zero initialized, page aligned storage for segment tree nodes. Memory is
+// mapped directly so it never touches the stack or the malloc heap, which
+// lets trees grow to billions of leaves. Like new, it throws std::bad_alloc
+// when the memory cannot be mapped. Move only.
+template <typename T>
+class TreeStorage
+{
+    public:
+        TreeStorage() : _base(nullptr), _bytes(0), _data(nullptr), _count(0), _backing(HugePages::None) {}
+
+        explicit TreeStorage(int64_t count, HugePages mode = HugePages::Transparent) : TreeStorage()
+        {
+            size_t bytes = count * sizeof(T);
+            if (bytes == 0) return;
+
+            // Not worth a whole huge page (and its RSS) for small trees
+            if (bytes < kHugePageSize) mode = HugePages::None;
+
+            void* base = MAP_FAILED;
+            if (mode == HugePages::Explicit)
+            {
+#ifdef MAP_HUGETLB
+                _bytes = RoundUp(bytes, kHugePageSize);
+                base = mmap(nullptr, _bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+                // No pool reserved (vm.nr_hugepages), use THP instead
+                if (base == MAP_FAILED) mode = HugePages::Transparent;
+            }
+            if (base == MAP_FAILED)
+            {
+                _bytes = mode == HugePages::Transparent ? RoundUp(bytes, kHugePageSize) : RoundUp(bytes, 4096);
+                base = mmap(nullptr, _bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (base == MAP_FAILED) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+                if (mode == HugePages::Transparent && madvise(base, _bytes, MADV_HUGEPAGE) != 0)
+                {
+                    mode = HugePages::None;
+                }
+#else
+                mode = HugePages::None;
+#endif
+            }
+
+            _base = base;
+            _data = static_cast<T*>(base);
+            _count = count;
+            _backing = mode;
+        }
+
+        ~TreeStorage() { Release(); }
+
+        TreeStorage(TreeStorage&& other) : TreeStorage() { Swap(other); }
+        TreeStorage& operator=(TreeStorage&& other)
+        {
+            Swap(other);
+            return *this;
+        }
+
+        TreeStorage(const TreeStorage&) = delete;
+        TreeStorage& operator=(const TreeStorage&) = delete;
+
+        // Maps a file written by SaveTreeFile. Pages are loaded lazily and are
+        // copy on write, so the tree is usable (and updatable) right away
+        // without touching the file. Returns an empty storage on failure.
+        static TreeStorage MapFile(const char* path, int64_t* n)
+        {
+            TreeStorage storage;
+
+            int fd = open(path, O_RDONLY);
+            if (fd < 0) return storage;
+
+            struct stat st;
+            TreeFileHeader header;
+            bool valid = fstat(fd, &st) == 0
+                && pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header)
+                && memcmp(header.magic, kTreeFileMagic, sizeof(kTreeFileMagic)) == 0
+                && header.elemSize == (int64_t)sizeof(T)
+                && (int64_t)(sizeof(header) + header.count * sizeof(T)) <= (int64_t)st.st_size;
+
+            if (valid)
+            {
+                void* base = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+                if (base != MAP_FAILED)
+                {
+                    storage._base = base;
+                    storage._bytes = st.st_size;
+                    storage._data = reinterpret_cast<T*>(static_cast<char*>(base) + sizeof(header));
+                    storage._count = header.count;
+                    storage._backing = HugePages::File;
+                    *n = header.n;
+                }
+            }
+            close(fd);
+            return storage;
+        }
+
+        T* Data() { return _data; }
+        const T* Data() const { return _data; }
+        T& operator[](int64_t i) { return _data[i]; }
+        const T& operator[](int64_t i) const { return _data[i]; }
+
+        int64_t Count() const { return _count; }
+        HugePages Backing() const { return _backing; }
+
+    private:
+        static size_t RoundUp(size_t bytes, size_t align) { return (bytes + align - 1) / align * align; }
+
+        void Release()
+        {
+            if (_base) munmap(_base, _bytes);
+            _base = nullptr;
+            _data = nullptr;
+            _bytes = 0;
+            _count = 0;
+        }
+
+        void Swap(TreeStorage& other)
+        {
+            std::swap(_base, other._base);
+            std::swap(_bytes, other._bytes);
+            std::swap(_data, other._data);
+            std::swap(_count, other._count);
+            std::swap(_backing, other._backing);
+        }
+
+        void* _base;
+        size_t _bytes;
+        T* _data;
+        int64_t _count;
+        HugePages _backing;
+};
+
+// Writes count nodes of a tree over n leaves so TreeStorage::MapFile can
+// load it back without rebuilding
+template <typename T>
+bool SaveTreeFile(const char* path, const T* data, int64_t count, int64_t n)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+
+    TreeFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kTreeFileMagic, sizeof(kTreeFileMagic));
+    header.n = n;
+    header.count = count;
+    header.elemSize = sizeof(T);
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && (int64_t)fwrite(data, sizeof(T), count, file) == count;
+    return fclose(file) == 0 && ok;
+}
+
+inline const char* HugePagesName(HugePages mode)
+{
+    switch (mode)
+    {
+        case HugePages::None: return "4KB pages";
+        case HugePages::Transparent: return "transparent huge pages";
+        case HugePages::Explicit: return "explicit huge pages";
+        case HugePages::File: return "file mapping";
+    }
+    return "?";
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#include <vector>
+
+#include "TreeStorage.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WIDE_TREE_X86 1
+#endif
+
+// Static sum tree with 16 children per node instead of 2. Every node is one
+// 64 byte cache line of 32-bit keys, so the tree is log16(n) levels high,
+// a quarter of the binary layout in BuildSegmentTree.
+//
+// Level 0 holds the leaves, level h+1 holds the sum of each 16 wide block of
+// level h, and the last level is a single block. Query(l, r) is computed as
+// Prefix(r) - Prefix(l), where each level contributes the sum of the lanes
+// left of the current position inside one block. The block addresses only
+// depend on the index, so the per level loads are independent of each other
+// instead of a chain of dependent loads.
+//
+// Sums are computed on 32-bit keys and wrap like the keys themselves do.
+// Blocks stay 64 byte aligned since TreeStorage hands out whole pages.
+class WideSegmentTree
+{
+    public:
+        static const int kBranch = 16;
+        static const int kShift = 4;
+
+        WideSegmentTree(const int32_t* values, int64_t n, HugePages pages = HugePages::Transparent) : _n(n)
+        {
+            ComputeLevels();
+            _data = TreeStorage<uint32_t>(_total, pages);
+            memcpy(_data.Data(), values, n * sizeof(int32_t));
+
+            for (size_t h = 0; h + 1 < _offset.size(); h++)
+            {
+                const uint32_t* src = _data.Data() + _offset[h];
+                uint32_t* dst = _data.Data() + _offset[h + 1];
+                int64_t blocks = (_offset[h + 1] - _offset[h]) / kBranch;
+                for (int64_t b = 0; b < blocks; b++)
+                {
+                    uint32_t sum = 0;
+                    for (int c = 0; c < kBranch; c++) sum += src[b * kBranch + c];
+                    dst[b] = sum;
+                }
+            }
+        }
+
+        // Maps a tree written by Save instead of building it, null on failure
+        static std::unique_ptr<WideSegmentTree> Load(const char* path)
+        {
+            int64_t n = 0;
+            TreeStorage<uint32_t> storage = TreeStorage<uint32_t>::MapFile(path, &n);
+            if (!storage.Data()) return nullptr;
+
+            std::unique_ptr<WideSegmentTree> tree(new WideSegmentTree(n));
+            if (storage.Count() != tree->_total) return nullptr;
+
+            tree->_data = std::move(storage);
+            return tree;
+        }
+
+        bool Save(const char* path) const
+        {
+            return SaveTreeFile(path, _data.Data(), _data.Count(), _n);
+        }
+
+        // Sum over [l, r)
+        int32_t Query(int64_t l, int64_t r) const
+        {
+#ifdef WIDE_TREE_X86
+            if (_useAvx2) return static_cast<int32_t>(PrefixAvx2(r) - PrefixAvx2(l));
+#endif
+            return static_cast<int32_t>(PrefixScalar(r) - PrefixScalar(l));
+        }
+
+        int64_t Size() const { return _n; }
+        int Height() const { return static_cast<int>(_offset.size()); }
+        size_t Bytes() const { return _total * sizeof(uint32_t); }
+        HugePages Backing() const { return _data.Backing(); }
+
+    private:
+        explicit WideSegmentTree(int64_t n) : _n(n) { ComputeLevels(); }
+
+        void ComputeLevels()
+        {
+            // Level sizes, each rounded up to a whole number of blocks. Levels
+            // are added until Prefix(n) lands inside the single top block.
+            int64_t count = _n;
+            int64_t reach = _n;
+            int64_t total = 0;
+            while (true)
+            {
+                int64_t padded = (count + kBranch - 1) / kBranch * kBranch;
+                if (padded == 0) padded = kBranch;
+                _offset.push_back(total);
+                total += padded;
+                if (reach < kBranch) break;
+                reach >>= kShift;
+                count = padded / kBranch;
+            }
+
+            // One spare block so Prefix(n) can read a whole (fully masked)
+            // block past the end of the last level
+            _total = total + kBranch;
+
+#ifdef WIDE_TREE_X86
+            _useAvx2 = __builtin_cpu_supports("avx2");
+#else
+            _useAvx2 = false;
+#endif
+        }
+
+        // Sum of [0, k)
+        uint32_t PrefixScalar(int64_t k) const
+        {
+            uint32_t res = 0;
+            for (size_t h = 0; h < _offset.size(); h++)
+            {
+                const uint32_t* block = _data.Data() + _offset[h] + (k & ~int64_t(kBranch - 1));
+                for (int c = 0; c < (k & (kBranch - 1)); c++) res += block[c];
+                k >>= kShift;
+            }
+            return res;
+        }
+
+#ifdef WIDE_TREE_X86
+        __attribute__((target("avx2")))
+        uint32_t PrefixAvx2(int64_t k) const
+        {
+            const __m256i iotaLo = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+            const __m256i iotaHi = _mm256_setr_epi32(8, 9, 10, 11, 12, 13, 14, 15);
+
+            __m256i acc = _mm256_setzero_si256();
+            for (size_t h = 0; h < _offset.size(); h++)
+            {
+                const uint32_t* block = _data.Data() + _offset[h] + (k & ~int64_t(kBranch - 1));
+                __m256i lane = _mm256_set1_epi32(static_cast<int>(k & (kBranch - 1)));
+                __m256i lo = _mm256_load_si256(reinterpret_cast<const __m256i*>(block));
+                __m256i hi = _mm256_load_si256(reinterpret_cast<const __m256i*>(block + 8));
+                lo = _mm256_and_si256(lo, _mm256_cmpgt_epi32(lane, iotaLo));
+                hi = _mm256_and_si256(hi, _mm256_cmpgt_epi32(lane, iotaHi));
+                acc = _mm256_add_epi32(acc, _mm256_add_epi32(lo, hi));
+                k >>= kShift;
+            }
+
+            __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+            sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+            sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+            return static_cast<uint32_t>(_mm_cvtsi128_si32(sum));
+        }
+#endif
+
+        int64_t _n;
+        int64_t _total;
+        TreeStorage<uint32_t> _data;
+        std::vector<int64_t> _offset;
+        bool _useAvx2;
+};
@@ -1 +1 @@
-g++ -g -std=c++14 -o segment main.cpp
+g++ -O2 -g -std=c++14 -pthread -o segment main.cpp
@@ -1,6 +1,24 @@
 #include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <stdlib.h>
 #include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../bench/Bench.h"
+#include "ConcurrentSegmentTree.h"
+#include "LazySegmentTree.h"
+#include "PersistentSegmentTree.h"
+#include "SegmentTree.h"
+#include "TreeStorage.h"
+#include "WideSegmentTree.h"
 
 void Print(int *arr, int n)
 {
@@ -32,15 +50,716 @@ int QuerySegmentTree(int *arr, int n, int l, int r)
     return res;
 }
 
+// Fenwick (binary indexed) tree, used as the baseline for the mixed
+// update / query benchmark. Only supports invertible ops, so sums only.
+class FenwickTree
+{
+    public:
+        FenwickTree(const int64_t *values, int n) : _bit(n + 1, 0)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                Add(i, values[i]);
+            }
+        }
+
+        void Add(int i, int64_t delta)
+        {
+            for (i++; i < (int)_bit.size(); i += i & -i) _bit[i] += delta;
+        }
+
+        // Sum of [0, i)
+        int64_t Prefix(int i) const
+        {
+            int64_t res = 0;
+            for (; i > 0; i -= i & -i) res += _bit[i];
+            return res;
+        }
+
+        int64_t Query(int l, int r) const { return Prefix(r) - Prefix(l); }
+
+    private:
+        std::vector<int64_t> _bit;
+};
+
+void BenchmarkMixedStream(int n, int ops)
+{
+    std::mt19937 rng(1234);
+    std::vector<int64_t> values(n);
+    for (int64_t &v : values) v = rng() % 1000;
+
+    // Half updates, half queries, generated up front so both trees see the same stream
+    struct Op { bool update; int a; int b; };
+    std::vector<Op> stream(ops);
+    for (Op &op : stream)
+    {
+        op.update = rng() & 1;
+        op.a = rng() % n;
+        op.b = op.update ? (int)(rng() % 1000) : op.a + 1 + (int)(rng() % (n - op.a));
+    }
+
+    SegmentTree<int64_t> sTree(values.data(), n);
+    FenwickTree fTree(values.data(), n);
+    std::vector<int64_t> current(values);
+
+    int64_t sCheck = 0, fCheck = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (const Op &op : stream)
+    {
+        if (op.update) sTree.Update(op.a, op.b);
+        else sCheck += sTree.Query(op.a, op.b);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (const Op &op : stream)
+    {
+        if (op.update)
+        {
+            fTree.Add(op.a, op.b - current[op.a]);
+            current[op.a] = op.b;
+        }
+        else fCheck += fTree.Query(op.a, op.b);
+    }
+    auto t2 = std::chrono::steady_clock::now();
+
+    double sMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    double fMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    printf("[BENCH] n = %9i, %i ops : SegmentTree %8.2f ms (%6.1f ns/op), Fenwick %8.2f ms (%6.1f ns/op) %s\n",
+        n, ops, sMs, sMs * 1e6 / ops, fMs, fMs * 1e6 / ops, sCheck == fCheck ? "" : "MISMATCH");
+}
+
+// Random range add / assign / query stream checked against a plain array
+bool CheckLazyAgainstBruteForce(int n, int ops)
+{
+    std::mt19937 rng(42);
+    std::vector<int64_t> brute(n);
+    for (int64_t &v : brute) v = (int64_t)(rng() % 2001) - 1000;
+
+    LazySegmentTree<int64_t> lTree(brute.data(), n);
+    for (int op = 0; op < ops; op++)
+    {
+        int l = rng() % n;
+        int r = l + 1 + (int)(rng() % (n - l));
+        int64_t v = (int64_t)(rng() % 2001) - 1000;
+
+        switch (rng() % 3)
+        {
+            case 0:
+                lTree.RangeAdd(l, r, v);
+                for (int i = l; i < r; i++) brute[i] += v;
+                break;
+            case 1:
+                lTree.RangeAssign(l, r, v);
+                for (int i = l; i < r; i++) brute[i] = v;
+                break;
+            case 2:
+            {
+                RangeStats<int64_t> stats = lTree.Query(l, r);
+                int64_t sum = 0, mn = brute[l], mx = brute[l];
+                for (int i = l; i < r; i++)
+                {
+                    sum += brute[i];
+                    mn = std::min(mn, brute[i]);
+                    mx = std::max(mx, brute[i]);
+                }
+                if (stats.sum != sum || stats.min != mn || stats.max != mx)
+                {
+                    printf("[CHECK] Mismatch on [%i, %i) after %i ops\n", l, r, op);
+                    return false;
+                }
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+// Range adds through the lazy tree, versus the same adds done one point
+// update at a time on SegmentTree
+void BenchmarkRangeUpdates(int n, int ops)
+{
+    std::mt19937 rng(99);
+    std::vector<int64_t> values(n);
+    for (int64_t &v : values) v = rng() % 1000;
+
+    struct Op { int l; int r; int64_t v; };
+    std::vector<Op> stream(ops);
+    for (Op &op : stream)
+    {
+        op.l = rng() % n;
+        op.r = op.l + 1 + (int)(rng() % (n - op.l));
+        op.v = rng() % 100;
+    }
+
+    LazySegmentTree<int64_t> lTree(values.data(), n);
+    SegmentTree<int64_t> sTree(values.data(), n);
+
+    auto t0 = std::chrono::steady_clock::now();
+    int64_t lCheck = 0;
+    for (const Op &op : stream)
+    {
+        lTree.RangeAdd(op.l, op.r, op.v);
+        lCheck += lTree.QuerySum(op.l, op.r);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    int64_t sCheck = 0;
+    for (const Op &op : stream)
+    {
+        for (int i = op.l; i < op.r; i++) sTree.Update(i, sTree.Get(i) + op.v);
+        sCheck += sTree.Query(op.l, op.r);
+    }
+    auto t2 = std::chrono::steady_clock::now();
+
+    double lMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    double sMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    printf("[BENCH] n = %9i, %i range add + query : Lazy %8.2f ms (%8.1f ns/op), point updates %10.2f ms (%10.1f ns/op) %s\n",
+        n, ops, lMs, lMs * 1e6 / ops, sMs, sMs * 1e6 / ops, lCheck == sCheck ? "" : "MISMATCH");
+}
+
+// Static range sum queries on the 16-wide layout versus the binary layout.
+// Both trees are built from the same int32 data and sum with 32-bit wrap.
+void BenchmarkWideQueries(int64_t n, int queries)
+{
+    std::mt19937_64 rng(7);
+    std::vector<int32_t> values(n);
+    for (int32_t &v : values) v = (int32_t)(rng() % 1000);
+
+    std::vector<int64_t> ls(queries), rs(queries);
+    for (int q = 0; q < queries; q++)
+    {
+        ls[q] = rng() % n;
+        rs[q] = ls[q] + 1 + (int64_t)(rng() % (n - ls[q]));
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    WideSegmentTree wTree(values.data(), n);
+    auto t1 = std::chrono::steady_clock::now();
+    uint32_t wCheck = 0;
+    for (int q = 0; q < queries; q++) wCheck += (uint32_t)wTree.Query(ls[q], rs[q]);
+    auto t2 = std::chrono::steady_clock::now();
+
+    // The binary tree and its copy of the values take three times the wide
+    // tree's memory (12 bytes per leaf), so past 2^30 leaves only the wide
+    // tree is measured
+    double bMs = -1.0;
+    uint32_t bCheck = wCheck;
+    if (n < (1ll << 30))
+    {
+        std::vector<uint32_t> uvalues(values.begin(), values.end());
+        SegmentTree<uint32_t> bTree(uvalues.data(), n);
+        auto t3 = std::chrono::steady_clock::now();
+        bCheck = 0;
+        for (int q = 0; q < queries; q++) bCheck += bTree.Query(ls[q], rs[q]);
+        auto t4 = std::chrono::steady_clock::now();
+        bMs = std::chrono::duration<double, std::milli>(t4 - t3).count();
+    }
+
+    double buildMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    double wMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    printf("[BENCH] n = %11lli, height %i : wide build %8.2f ms, query %6.1f ns, binary query %6.1f ns %s\n",
+        (long long)n, wTree.Height(), buildMs, wMs * 1e6 / queries, bMs * 1e6 / queries,
+        wCheck == bCheck ? "" : "MISMATCH");
+}
+
+// The way to keep history without a persistent tree: a full copy of the
+// flat tree (SegmentTree's layout) for every version
+template <typename T>
+class SnapshotHistory
+{
+    public:
+        SnapshotHistory(const T *values, int64_t n) : _n(n)
+        {
+            std::vector<T> tree(2 * n, T(0));
+            std::copy(values, values + n, tree.begin() + n);
+            for (int64_t i = n - 1; i > 0; i--) tree[i] = tree[2*i] + tree[2*i+1];
+            _versions.push_back(std::move(tree));
+        }
+
+        int Update(int64_t i, const T &value)
+        {
+            _versions.push_back(_versions.back());
+            std::vector<T> &tree = _versions.back();
+            i += _n;
+            tree[i] = value;
+            for (i >>= 1; i > 0; i >>= 1) tree[i] = tree[2*i] + tree[2*i+1];
+            return (int)_versions.size() - 1;
+        }
+
+        T Query(int version, int64_t l, int64_t r) const
+        {
+            const std::vector<T> &tree = _versions[version];
+            T res = T(0);
+            for (l += _n, r += _n; l < r; l >>= 1, r >>= 1)
+            {
+                if (l&1) res += tree[l++];
+                if (r&1) res += tree[--r];
+            }
+            return res;
+        }
+
+        size_t Bytes() const { return _versions.size() * 2 * _n * sizeof(T); }
+
+    private:
+        int64_t _n;
+        std::vector<std::vector<T>> _versions;
+};
+
+// Random updates, each on top of a random earlier version, checked against a
+// plain array kept per version. Min is not invertible and max of a range is
+// order sensitive enough to catch a wrong child.
+bool CheckPersistentAgainstBruteForce(int n, int updates)
+{
+    std::mt19937 rng(5);
+    std::vector<std::vector<int64_t>> brute(1, std::vector<int64_t>(n));
+    for (int64_t &v : brute[0]) v = (int64_t)(rng() % 2001) - 1000;
+
+    PersistentSegmentTree<int64_t> sumTree(brute[0].data(), n);
+    PersistentSegmentTree<int64_t, MinOp<int64_t>> minTree(brute[0].data(), n);
+    for (int u = 0; u < updates; u++)
+    {
+        int from = rng() % brute.size();
+        int i = rng() % n;
+        int64_t v = (int64_t)(rng() % 2001) - 1000;
+        brute.push_back(brute[from]);
+        brute.back()[i] = v;
+        if (sumTree.Update(from, i, v) != (int)brute.size() - 1 || minTree.Update(from, i, v) != (int)brute.size() - 1) return false;
+
+        // Query some version, old or new
+        int version = rng() % brute.size();
+        int l = rng() % n;
+        int r = l + 1 + (int)(rng() % (n - l));
+        int64_t sum = 0, mn = brute[version][l];
+        for (int k = l; k < r; k++)
+        {
+            sum += brute[version][k];
+            mn = std::min(mn, brute[version][k]);
+        }
+        if (sumTree.Query(version, l, r) != sum || minTree.Query(version, l, r) != mn || sumTree.Get(version, l) != brute[version][l])
+        {
+            printf("[CHECK] Mismatch on [%i, %i) of version %i after %i updates\n", l, r, version, u);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Updates and queries at random past versions, persistent tree against a
+// full snapshot per version. Snapshots are capped at about 1 GB, so for
+// large n they only cover the first updates of the stream.
+void BenchmarkPersistentVersions(int n, int updates, int queries)
+{
+    std::mt19937 rng(21);
+    std::vector<int64_t> values(n);
+    for (int64_t &v : values) v = rng() % 1000;
+    std::vector<int> is(updates);
+    std::vector<int64_t> vs(updates);
+    for (int u = 0; u < updates; u++)
+    {
+        is[u] = rng() % n;
+        vs[u] = rng() % 1000;
+    }
+    const int snapshots = (int)std::min<int64_t>(updates, (1ll << 30) / (2ll * n * sizeof(int64_t)));
+
+    struct Query { int version; int l; int r; };
+    std::vector<Query> stream(queries);
+    for (Query &q : stream)
+    {
+        q.version = rng() % (snapshots + 1);
+        q.l = rng() % n;
+        q.r = q.l + 1 + (int)(rng() % (n - q.l));
+    }
+
+    PersistentSegmentTree<int64_t> pTree(values.data(), n);
+    int64_t builtNodes = pTree.NodeCount();
+    auto t0 = std::chrono::steady_clock::now();
+    for (int u = 0; u < updates; u++) pTree.Update(is[u], vs[u]);
+    auto t1 = std::chrono::steady_clock::now();
+    int64_t pCheck = 0;
+    for (const Query &q : stream) pCheck += pTree.Query(q.version, q.l, q.r);
+    auto t2 = std::chrono::steady_clock::now();
+
+    SnapshotHistory<int64_t> history(values.data(), n);
+    auto t3 = std::chrono::steady_clock::now();
+    for (int u = 0; u < snapshots; u++) history.Update(is[u], vs[u]);
+    auto t4 = std::chrono::steady_clock::now();
+    int64_t sCheck = 0;
+    for (const Query &q : stream) sCheck += history.Query(q.version, q.l, q.r);
+    auto t5 = std::chrono::steady_clock::now();
+
+    double pUpdate = std::chrono::duration<double, std::nano>(t1 - t0).count() / updates;
+    double pQuery = std::chrono::duration<double, std::nano>(t2 - t1).count() / queries;
+    double sUpdate = std::chrono::duration<double, std::nano>(t4 - t3).count() / snapshots;
+    double sQuery = std::chrono::duration<double, std::nano>(t5 - t4).count() / queries;
+    double pBytes = double(pTree.NodeCount() - builtNodes) * sizeof(PersistentSegmentTree<int64_t>::Node) / updates;
+    double sBytes = 2.0 * n * sizeof(int64_t);
+    printf("[BENCH] n = %8i, %i versions : persistent update %7.1f ns, %6.0f B/update, query %6.1f ns | "
+        "snapshot (%i versions) update %11.1f ns, %10.0f B/update, query %6.1f ns %s\n", n, updates, pUpdate, pBytes, pQuery,
+        snapshots, sUpdate, sBytes, sQuery, pCheck == sCheck ? "" : "MISMATCH");
+}
+
+// One writer applies random batches while readers query; every answer has to
+// equal the brute force answer of the version it reports, and that version
+// has to be one that was published at some point during the query. Once
+// the writer is done every range of the last version is checked too, so the
+// batch writes are covered however little the readers got to run. Returns
+// the number of distinct versions the readers saw, 0 on a violation.
+int CheckConcurrentLinearizable(int n, int readers, int batches)
+{
+    std::mt19937 rng(8);
+    std::vector<std::vector<int64_t>> history(1, std::vector<int64_t>(n));
+    for (int64_t &v : history[0]) v = rng() % 1000;
+    ConcurrentSegmentTree<int64_t> tree(history[0].data(), n, readers);
+
+    struct Observation { uint64_t before; uint64_t version; uint64_t after; int l; int r; int64_t sum; };
+    std::vector<std::vector<Observation>> logs(readers);
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < readers; t++)
+    {
+        threads.emplace_back([&, t] {
+            std::mt19937 local(100 + t);
+            while (!done.load(std::memory_order_relaxed) && logs[t].size() < 1000000)
+            {
+                Observation o;
+                o.l = local() % n;
+                o.r = o.l + 1 + (int)(local() % (n - o.l));
+                o.before = tree.Version();
+                o.sum = tree.Query(t, o.l, o.r, &o.version);
+                o.after = tree.Version();
+                logs[t].push_back(o);
+            }
+        });
+    }
+
+    std::vector<ConcurrentSegmentTree<int64_t>::PointUpdate> batch;
+    for (int b = 0; b < batches; b++)
+    {
+        batch.resize(1 + rng() % 16);
+        history.push_back(history.back());
+        for (auto &u : batch)
+        {
+            u.index = rng() % n;
+            u.value = rng() % 1000;
+            history.back()[u.index] = u.value; // last one wins, as in Apply
+        }
+        tree.Apply(batch);
+        // Hand the core to the readers now and then, so single core machines
+        // interleave too
+        if (b % 16 == 0) std::this_thread::yield();
+    }
+    done = true;
+    for (std::thread &thread : threads) thread.join();
+
+    std::vector<int64_t> prefix(n + 1, 0);
+    for (int k = 0; k < n; k++) prefix[k + 1] = prefix[k] + history.back()[k];
+    for (int l = 0; l < n; l++)
+    {
+        for (int r = l + 1; r <= n; r++)
+        {
+            if (tree.Query(0, l, r) != prefix[r] - prefix[l])
+            {
+                printf("[CHECK] Last version, n = %i, [%i, %i) : wrong sum\n", n, l, r);
+                return 0;
+            }
+        }
+    }
+
+    std::vector<bool> seen(history.size(), false);
+    for (int t = 0; t < readers; t++)
+    {
+        uint64_t last = 0;
+        for (const Observation &o : logs[t])
+        {
+            int64_t sum = 0;
+            for (int k = o.l; k < o.r; k++) sum += history[o.version][k];
+            if (o.version < o.before || o.version > o.after || o.version < last || sum != o.sum)
+            {
+                printf("[CHECK] Reader %i saw version %llu in [%llu, %llu] with sum %lli, expected %lli\n", t,
+                    (unsigned long long)o.version, (unsigned long long)o.before, (unsigned long long)o.after, (long long)o.sum, (long long)sum);
+                return 0;
+            }
+            last = o.version;
+            seen[o.version] = true;
+        }
+    }
+    return (int)std::count(seen.begin(), seen.end(), true);
+}
+
+// Read throughput while one writer ingests batches, as readers are added.
+// The baseline is SegmentTree behind a mutex, with the same updates applied
+// one by one under the lock.
+void BenchmarkConcurrentReaders(int n, int batchSize, int milliseconds)
+{
+    std::mt19937 rng(31);
+    std::vector<int64_t> values(n);
+    for (int64_t &v : values) v = rng() % 1000;
+
+    for (int readers = 1; readers <= 8; readers *= 2)
+    {
+        for (bool locked : { false, true })
+        {
+            ConcurrentSegmentTree<int64_t> cTree(values.data(), n, readers);
+            SegmentTree<int64_t> sTree(values.data(), n);
+            std::mutex mutex;
+
+            std::atomic<bool> done(false);
+            std::vector<uint64_t> reads(readers * 16, 0); // 16 apart, one line each
+            std::vector<std::thread> threads;
+            for (int t = 0; t < readers; t++)
+            {
+                threads.emplace_back([&, t] {
+                    std::mt19937 local(200 + t);
+                    uint64_t count = 0;
+                    int64_t check = 0;
+                    while (!done.load(std::memory_order_relaxed))
+                    {
+                        int l = local() % n;
+                        int r = l + 1 + (int)(local() % (n - l));
+                        if (locked)
+                        {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            check += sTree.Query(l, r);
+                        }
+                        else check += cTree.Query(t, l, r);
+                        count++;
+                    }
+                    reads[t * 16] = count;
+                    BenchKeep(check);
+                });
+            }
+
+            uint64_t updates = 0;
+            std::vector<ConcurrentSegmentTree<int64_t>::PointUpdate> batch(batchSize);
+            auto start = std::chrono::steady_clock::now();
+            auto end = start + std::chrono::milliseconds(milliseconds);
+            while (std::chrono::steady_clock::now() < end)
+            {
+                for (auto &u : batch)
+                {
+                    u.index = rng() % n;
+                    u.value = rng() % 1000;
+                }
+                if (locked)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    for (const auto &u : batch) sTree.Update(u.index, u.value);
+                }
+                else cTree.Apply(batch);
+                updates += batchSize;
+            }
+            done = true;
+            for (std::thread &thread : threads) thread.join();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            uint64_t total = 0;
+            for (int t = 0; t < readers; t++) total += reads[t * 16];
+            printf("[BENCH] n = %8i, %i readers + 1 writer (batches of %i), %-10s : %8.2f M reads/s, %8.2f M updates/s\n", n, readers,
+                batchSize, locked ? "mutex" : "left-right", total / seconds / 1e6, updates / seconds / 1e6);
+        }
+    }
+}
+
+// Writer cost per update as batches grow: shared ancestors are recomputed
+// once per batch. SegmentTree::Update recomputes the whole path each time.
+void BenchmarkConcurrentBatches(int n, int updates)
+{
+    std::mt19937 rng(41);
+    std::vector<int64_t> values(n);
+    for (int64_t &v : values) v = rng() % 1000;
+    std::vector<ConcurrentSegmentTree<int64_t>::PointUpdate> stream(updates);
+    for (auto &u : stream)
+    {
+        u.index = rng() % n;
+        u.value = rng() % 1000;
+    }
+
+    SegmentTree<int64_t> sTree(values.data(), n);
+    auto t0 = std::chrono::steady_clock::now();
+    for (const auto &u : stream) sTree.Update(u.index, u.value);
+    double pointNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / updates;
+
+    for (int batchSize = 1; batchSize <= 1 << 14; batchSize <<= 3)
+    {
+        ConcurrentSegmentTree<int64_t> cTree(values.data(), n, 1);
+        std::vector<ConcurrentSegmentTree<int64_t>::PointUpdate> batch;
+        auto t1 = std::chrono::steady_clock::now();
+        for (int u = 0; u < updates; u += batchSize)
+        {
+            batch.assign(stream.begin() + u, stream.begin() + std::min(updates, u + batchSize));
+            cTree.Apply(batch);
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t1).count() / updates;
+
+        bool same = cTree.Query(0, 0, n) == sTree.Query(0, n);
+        printf("[BENCH] n = %8i, batches of %5i : %7.1f ns/update, %5.2f nodes per update per copy (SegmentTree::Update %6.1f ns) %s\n", n, batchSize,
+            ns, cTree.NodesWritten() / 2.0 / updates, pointNs, same ? "" : "MISMATCH");
+    }
+}
+
+template <typename Tree>
+void TimeRandomQueries(const char *label, Tree &tree, int64_t n, int queries, double buildMs)
+{
+    std::mt19937_64 rng(3);
+    PerfCounters counters;
+
+    int64_t check = 0;
+    counters.Start();
+    auto t0 = std::chrono::steady_clock::now();
+    for (int q = 0; q < queries; q++)
+    {
+        int64_t l = rng() % n;
+        check += tree.Query(l, l + 1 + (int64_t)(rng() % (n - l)));
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    long long misses = counters.Stop().value[kBenchDtlbMisses];
+
+    char missText[32] = "n/a";
+    if (misses >= 0) snprintf(missText, sizeof(missText), "%.3f", (double)misses / queries);
+
+    double qMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    printf("[BENCH] %-24s (%-22s) : build/load %9.2f ms, query %6.1f ns, dTLB misses/query %s (check %lli)\n",
+        label, HugePagesName(tree.Backing()), buildMs, qMs * 1e6 / queries, missText, (long long)check);
+}
+
+// Builds the same large tree with each page backing, then saves it and maps
+// it back from the file to compare against a fresh build
+void BenchmarkTreeStorage(int64_t n, int queries)
+{
+    std::mt19937_64 rng(11);
+    std::vector<int64_t> values(n);
+    for (int64_t &v : values) v = rng() % 1000;
+
+    // The saved tree goes to a file of its own in TMPDIR, /tmp if unset
+    const char *tmp = getenv("TMPDIR");
+    std::string path = std::string(tmp && *tmp ? tmp : "/tmp") + "/segment.tree.XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd >= 0) close(fd);
+
+    bool saved = false;
+    const HugePages modes[] = { HugePages::None, HugePages::Transparent, HugePages::Explicit };
+    for (HugePages mode : modes)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        SegmentTree<int64_t> tree(values.data(), n, SumOp<int64_t>(), mode);
+        auto t1 = std::chrono::steady_clock::now();
+        TimeRandomQueries(HugePagesName(mode), tree, n, queries,
+            std::chrono::duration<double, std::milli>(t1 - t0).count());
+
+        if (mode == HugePages::None)
+        {
+            saved = fd >= 0 && tree.Save(path.c_str());
+            if (!saved) printf("[BENCH] Could not save %s\n", path.c_str());
+        }
+    }
+
+    if (saved)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        std::unique_ptr<SegmentTree<int64_t>> loaded = SegmentTree<int64_t>::Load(path.c_str());
+        auto t1 = std::chrono::steady_clock::now();
+        if (loaded)
+        {
+            TimeRandomQueries("mapped from a saved file", *loaded, n, queries,
+                std::chrono::duration<double, std::milli>(t1 - t0).count());
+        }
+    }
+    if (fd >= 0) unlink(path.c_str());
+}
+
+// Regression suite for bench/run.sh: the query and update paths of each
+// tree on one mid sized input
+int RunBenchSuite()
+{
+    BenchSuite suite("segment");
+    const int n = 1 << 20, ops = 1 << 18;
+
+    std::mt19937 rng(77);
+    std::vector<int64_t> values(n);
+    for (int64_t &v : values) v = rng() % 1000;
+    std::vector<int> ls(ops), rs(ops);
+    for (int q = 0; q < ops; q++)
+    {
+        ls[q] = rng() % n;
+        rs[q] = ls[q] + 1 + (int)(rng() % (n - ls[q]));
+    }
+
+    SegmentTree<int64_t> sTree(values.data(), n);
+    suite.Run("SegmentTree query", ops, [&] {
+        int64_t check = 0;
+        for (int q = 0; q < ops; q++) check += sTree.Query(ls[q], rs[q]);
+        BenchKeep(check);
+    });
+    suite.Run("SegmentTree update", ops, [&] {
+        for (int q = 0; q < ops; q++) sTree.Update(ls[q], rs[q] & 1023);
+    });
+
+    FenwickTree fTree(values.data(), n);
+    suite.Run("Fenwick query", ops, [&] {
+        int64_t check = 0;
+        for (int q = 0; q < ops; q++) check += fTree.Query(ls[q], rs[q]);
+        BenchKeep(check);
+    });
+
+    // Range operations touch far more nodes, a slice of the stream is enough
+    const int rangeOps = ops / 8;
+    LazySegmentTree<int64_t> lTree(values.data(), n);
+    suite.Run("LazySegmentTree range add + sum", rangeOps, [&] {
+        int64_t check = 0;
+        for (int q = 0; q < rangeOps; q++)
+        {
+            lTree.RangeAdd(ls[q], rs[q], 1);
+            check += lTree.QuerySum(ls[q], rs[q]);
+        }
+        BenchKeep(check);
+    });
+
+    // Each rep starts from a fresh tree so the pool does not keep growing
+    std::unique_ptr<PersistentSegmentTree<int64_t>> pTree;
+    suite.Run("PersistentSegmentTree update", rangeOps, [&] { pTree.reset(new PersistentSegmentTree<int64_t>(values.data(), n)); }, [&] {
+        for (int q = 0; q < rangeOps; q++) pTree->Update(ls[q], rs[q] & 1023);
+    });
+    suite.Run("PersistentSegmentTree past query", rangeOps, [&] {
+        int64_t check = 0;
+        for (int q = 0; q < rangeOps; q++) check += pTree->Query(q % pTree->Versions(), ls[q], rs[q]);
+        BenchKeep(check);
+    });
+
+    ConcurrentSegmentTree<int64_t> cTree(values.data(), n, 1);
+    std::vector<ConcurrentSegmentTree<int64_t>::PointUpdate> batch(256);
+    suite.Run("ConcurrentSegmentTree batched update", ops, [&] {
+        for (int q = 0; q < ops; q += (int)batch.size())
+        {
+            for (size_t k = 0; k < batch.size(); k++) batch[k] = { ls[q + k], rs[q + k] & 1023 };
+            cTree.Apply(batch);
+        }
+    });
+    suite.Run("ConcurrentSegmentTree query", ops, [&] {
+        int64_t check = 0;
+        for (int q = 0; q < ops; q++) check += cTree.Query(0, ls[q], rs[q]);
+        BenchKeep(check);
+    });
+
+    std::vector<int32_t> narrow(values.begin(), values.end());
+    WideSegmentTree wTree(narrow.data(), n);
+    suite.Run("WideSegmentTree query", ops, [&] {
+        int64_t check = 0;
+        for (int q = 0; q < ops; q++) check += wTree.Query(ls[q], rs[q]);
+        BenchKeep(check);
+    });
+
+    return suite.Finish();
+}
+
 int main(int argc, char **argv)
 {
+    if (BenchSuite::Requested(argc, argv)) return RunBenchSuite();
+
     int values[] = { 58, 62, 15, 92, 17, 80, 95, 0 };
     int n = sizeof(values) / sizeof(values[0]);
 
-    int sTree[2 * n];
-    int m = sizeof(sTree) / sizeof(sTree[0]);
-    memset(sTree, 0, m * sizeof(sTree[0]));
-    memcpy(sTree + n, values, n * sizeof(values[0]));
+    // Mapped storage comes back zeroed, and unlike a VLA it does not live on the stack
+    int m = 2 * n;
+    TreeStorage<int> sTree(m);
+    memcpy(sTree.Data() + n, values, n * sizeof(values[0]));
 
     printf("[MAIN] Segment tree tests ...\n");
 
@@ -48,15 +767,75 @@ int main(int argc, char **argv)
     Print(values, n);
 
     printf("[MAIN] Segment tree initial state (m = %i):\n", m);
-    Print(sTree, m);
+    Print(sTree.Data(), m);
 
-    BuildSegmentTree(sTree, n);
+    BuildSegmentTree(sTree.Data(), n);
 
     printf("[MAIN] Segment tree done building:\n");
-    Print(sTree, m);
+    Print(sTree.Data(), m);
 
     int l = 2, r = 6;
-    printf("[MAIN] Query from %i to %i : %i\n", l, r, QuerySegmentTree(sTree, n, l, r));
+    printf("[MAIN] Query from %i to %i : %i\n", l, r, QuerySegmentTree(sTree.Data(), n, l, r));
+
+    printf("[MAIN] Generic segment tree over the same values:\n");
+    std::vector<int64_t> wide(values, values + n);
+    SegmentTree<int64_t> sumTree(wide.data(), n);
+    SegmentTree<int64_t, MinOp<int64_t>> minTree(wide.data(), n);
+    SegmentTree<int64_t, MaxOp<int64_t>> maxTree(wide.data(), n);
+    SegmentTree<int64_t, GcdOp<int64_t>> gcdTree(wide.data(), n);
+    printf("[MAIN] [%i, %i) sum = %lli, min = %lli, max = %lli, gcd = %lli\n", l, r,
+        (long long)sumTree.Query(l, r), (long long)minTree.Query(l, r),
+        (long long)maxTree.Query(l, r), (long long)gcdTree.Query(l, r));
+
+    sumTree.Update(3, 8);
+    minTree.Update(3, 8);
+    printf("[MAIN] After setting index 3 to 8: sum = %lli, min = %lli\n",
+        (long long)sumTree.Query(l, r), (long long)minTree.Query(l, r));
+
+    std::vector<float> fvalues(values, values + n);
+    SegmentTree<float, MaxOp<float>> fTree(fvalues.data(), n);
+    printf("[MAIN] Float max over [0, %i) : %f\n", n, fTree.Query(0, n));
+
+    for (int size = 1 << 10; size <= 1 << 22; size <<= 4)
+    {
+        BenchmarkMixedStream(size, 1 << 20);
+    }
+
+    printf("[MAIN] Lazy propagation randomized check : %s\n",
+        CheckLazyAgainstBruteForce(1000, 20000) && CheckLazyAgainstBruteForce(37, 20000) ? "OK" : "FAILED");
+
+    for (int size = 1 << 10; size <= 1 << 18; size <<= 4)
+    {
+        BenchmarkRangeUpdates(size, 1 << 10);
+    }
+
+    printf("[MAIN] Persistent segment tree randomized check : %s\n",
+        CheckPersistentAgainstBruteForce(1000, 5000) && CheckPersistentAgainstBruteForce(37, 5000) ? "OK" : "FAILED");
+
+    for (int size = 1 << 10; size <= 1 << 22; size <<= 4)
+    {
+        BenchmarkPersistentVersions(size, 1 << 16, 1 << 18);
+    }
+
+    // Sizes off a power of two put the leaves on two levels of the tree
+    for (int size : { 128, 37, 1000 })
+    {
+        int versions = CheckConcurrentLinearizable(size, 3, 20000);
+        printf("[MAIN] Concurrent segment tree linearizability stress, n = %4i : %s (%i versions observed)\n", size,
+            versions ? "OK" : "FAILED", versions);
+    }
+
+    BenchmarkConcurrentBatches(1 << 20, 1 << 20);
+    BenchmarkConcurrentReaders(1 << 20, 256, 300);
+
+    // Pass the largest n as the first argument to go up to 10^9 leaves
+    int64_t maxN = argc > 1 ? atoll(argv[1]) : 10000000;
+    for (int64_t size = 1000; size <= maxN; size *= 10)
+    {
+        BenchmarkWideQueries(size, 1 << 20);
+    }
+
+    BenchmarkTreeStorage(1 << 25, 1 << 20);
 
     return 0;
 }
@@ -0,0 +1,575 @@
+#pragma once
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "Sort.h"
+
+// Sorts a file of fixed width records that does not fit in memory:
+// 1. run generation reads memoryBudget / 2 bytes at a time with large
+//    sequential reads, sorts them with Sort and writes each one out as a
+//    run, while the previous run is still being written in the background;
+// 2. runs are merged k at a time through a loser tree, with every run
+//    reader and the output writer double buffered so the next block is in
+//    flight while the current one is consumed. If the budget cannot give
+//    each run a decent block, the merge takes several passes.
+//
+// With directIO the files are opened with O_DIRECT so the page cache is
+// bypassed; buffers, offsets and block sizes are kept 4KB aligned for it.
+// The background I/O runs on one dedicated thread (IoQueue) rather than
+// io_uring, which would need liburing.
+
+struct ExternalSortConfig
+{
+    size_t memoryBudget = size_t(256) << 20;
+    std::string tempDir = ".";
+    bool directIO = false;
+};
+
+struct ExternalSortStats
+{
+    uint64_t bytes = 0;
+    int runs = 0;
+    int mergePasses = 0;
+    double runSeconds = 0.0;
+    double mergeSeconds = 0.0;
+
+    // Input size over wall time; every pass reads and writes all of it
+    double GBps() const { return bytes / (runSeconds + mergeSeconds) / 1e9; }
+};
+
+static const size_t kIoAlignment = 4096;
+
+// Smallest merge block worth issuing as one read; below this the merge
+// falls back to multiple passes with a smaller fan in
+static const size_t kMinMergeBlock = size_t(256) << 10;
+
+// Runs blocking I/O calls on a background thread, in submission order
+class IoQueue
+{
+    public:
+        IoQueue() : _stop(false), _thread([this]() { Loop(); }) {}
+
+        ~IoQueue()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _ready.notify_one();
+            _thread.join();
+        }
+
+        std::future<ssize_t> Submit(std::function<ssize_t()> job)
+        {
+            std::packaged_task<ssize_t()> task(std::move(job));
+            std::future<ssize_t> result = task.get_future();
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _jobs.push_back(std::move(task));
+            }
+            _ready.notify_one();
+            return result;
+        }
+
+    private:
+        void Loop()
+        {
+            while (true)
+            {
+                std::packaged_task<ssize_t()> task;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _ready.wait(lock, [this]() { return _stop || !_jobs.empty(); });
+                    if (_jobs.empty()) return;
+
+                    task = std::move(_jobs.front());
+                    _jobs.pop_front();
+                }
+                task();
+            }
+        }
+
+        std::mutex _mutex;
+        std::condition_variable _ready;
+        std::deque<std::packaged_task<ssize_t()>> _jobs;
+        bool _stop;
+        std::thread _thread;
+};
+
+struct AlignedDeleter
+{
+    void operator()(char* p) const { free(p); }
+};
+typedef std::unique_ptr<char, AlignedDeleter> AlignedBuffer;
+
+inline AlignedBuffer AllocateAligned(size_t bytes)
+{
+    void* p = nullptr;
+    if (posix_memalign(&p, kIoAlignment, bytes) != 0) return AlignedBuffer();
+    return AlignedBuffer(static_cast<char*>(p));
+}
+
+inline int OpenFile(const char* path, bool write, bool directIO)
+{
+    int flags = write ? (O_WRONLY | O_CREAT | O_TRUNC) : O_RDONLY;
+#ifdef O_DIRECT
+    if (directIO) flags |= O_DIRECT;
+#endif
+    int fd = open(path, flags, 0644);
+    if (fd < 0 && directIO)
+    {
+        // Some file systems (tmpfs ...) refuse O_DIRECT
+        return OpenFile(path, write, false);
+    }
+    return fd;
+}
+
+// Full pread / pwrite, retrying short transfers. Returns the byte count or -1.
+inline ssize_t ReadFully(int fd, char* buffer, size_t bytes, off_t offset)
+{
+    size_t done = 0;
+    while (done < bytes)
+    {
+        ssize_t n = pread(fd, buffer + done, bytes - done, offset + done);
+        if (n < 0) return -1;
+        done += n;
+
+        // End of file. O_DIRECT would reject the next, unaligned, offset.
+        if (n == 0 || done % kIoAlignment != 0) break;
+    }
+    return done;
+}
+
+inline ssize_t WriteFully(int fd, const char* buffer, size_t bytes, off_t offset)
+{
+    size_t done = 0;
+    while (done < bytes)
+    {
+        ssize_t n = pwrite(fd, buffer + done, bytes - done, offset + done);
+        if (n <= 0) return -1;
+        done += n;
+    }
+    return done;
+}
+
+inline size_t RoundUpTo(size_t bytes, size_t align) { return (bytes + align - 1) / align * align; }
+
+// Block size unit: a whole number of records that is also 4KB aligned
+template <typename Record>
+size_t RecordBlockUnit()
+{
+    size_t a = kIoAlignment, b = sizeof(Record);
+    while (b != 0)
+    {
+        size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return kIoAlignment / a * sizeof(Record);
+}
+
+// Streams the records of one run, keeping the next block in flight
+template <typename Record>
+class RunReader
+{
+    public:
+        RunReader(int fd, off_t begin, off_t end, size_t blockBytes, IoQueue& io)
+            : _fd(fd), _next(begin), _end(end), _blockBytes(blockBytes), _io(io), _pos(0), _count(0), _failed(false)
+        {
+            _buffers[0] = AllocateAligned(blockBytes);
+            _buffers[1] = AllocateAligned(blockBytes);
+            Prefetch(1);
+            Swap();
+        }
+
+        ~RunReader()
+        {
+            if (_pending.valid()) _pending.wait();
+        }
+
+        bool Valid() const { return _pos < _count; }
+        bool Failed() const { return _failed; }
+        const Record& Head() const { return _current[_pos]; }
+
+        void Advance()
+        {
+            if (++_pos == _count) Swap();
+        }
+
+    private:
+        void Prefetch(int buffer)
+        {
+            if (_next >= _end) return;
+
+            size_t bytes = std::min<size_t>(_blockBytes, _end - _next);
+            char* data = _buffers[buffer].get();
+            int fd = _fd;
+            off_t offset = _next;
+            _pending = _io.Submit([=]() {
+                // Whole pages for O_DIRECT, anything past the run is ignored
+                ssize_t n = ReadFully(fd, data, RoundUpTo(bytes, kIoAlignment), offset);
+                return n < 0 ? n : std::min<ssize_t>(n, bytes);
+            });
+            _next += bytes;
+            _pendingBuffer = buffer;
+            _pendingBytes = bytes;
+        }
+
+        void Swap()
+        {
+            _pos = 0;
+            _count = 0;
+            if (!_pending.valid()) return;
+
+            ssize_t bytes = _pending.get();
+            if (bytes != (ssize_t)_pendingBytes)
+            {
+                // A failed or short read ends the run early, the merge reports it
+                _failed = true;
+                return;
+            }
+
+            int ready = _pendingBuffer;
+            _current = reinterpret_cast<const Record*>(_buffers[ready].get());
+            _count = bytes / sizeof(Record);
+            Prefetch(1 - ready);
+        }
+
+        int _fd;
+        off_t _next;
+        off_t _end;
+        size_t _blockBytes;
+        IoQueue& _io;
+
+        AlignedBuffer _buffers[2];
+        std::future<ssize_t> _pending;
+        int _pendingBuffer;
+        size_t _pendingBytes;
+
+        const Record* _current;
+        size_t _pos;
+        size_t _count;
+        bool _failed;
+};
+
+// Writes records sequentially from offset on, writing one block in the
+// background while the other fills up
+template <typename Record>
+class RunWriter
+{
+    public:
+        RunWriter(int fd, off_t offset, size_t blockBytes, IoQueue& io)
+            : _fd(fd), _blockBytes(blockBytes), _io(io), _active(0), _fill(0), _offset(offset), _failed(false)
+        {
+            _buffers[0] = AllocateAligned(blockBytes);
+            _buffers[1] = AllocateAligned(blockBytes);
+        }
+
+        void Push(const Record& record)
+        {
+            memcpy(_buffers[_active].get() + _fill, &record, sizeof(Record));
+            _fill += sizeof(Record);
+            if (_fill == _blockBytes) Flush();
+        }
+
+        // Writes what is left, padded to a whole page for O_DIRECT (the caller
+        // truncates the file to its real size). Returns false if any write failed.
+        bool Close()
+        {
+            if (_fill > 0)
+            {
+                memset(_buffers[_active].get() + _fill, 0, RoundUpTo(_fill, kIoAlignment) - _fill);
+                _fill = RoundUpTo(_fill, kIoAlignment);
+                Flush();
+            }
+            for (int i = 0; i < 2; i++) Wait(i);
+            return !_failed;
+        }
+
+    private:
+        void Wait(int buffer)
+        {
+            if (_pending[buffer].valid() && _pending[buffer].get() < 0) _failed = true;
+        }
+
+        void Flush()
+        {
+            const char* data = _buffers[_active].get();
+            int fd = _fd;
+            size_t bytes = _fill;
+            off_t offset = _offset;
+            _pending[_active] = _io.Submit([=]() { return WriteFully(fd, data, bytes, offset); });
+
+            _offset += _fill;
+            _fill = 0;
+            _active = 1 - _active;
+            Wait(_active);
+        }
+
+        int _fd;
+        size_t _blockBytes;
+        IoQueue& _io;
+
+        AlignedBuffer _buffers[2];
+        std::future<ssize_t> _pending[2];
+        int _active;
+        size_t _fill;
+        off_t _offset;
+        bool _failed;
+};
+
+// Tournament tree over k sources where every internal node keeps the loser
+// of its match. Replacing the winner only replays the matches on its path to
+// the root: log2(k) comparisons, each against a single stored loser.
+// Exhausted sources lose every match.
+template <typename Record, typename Compare>
+class LoserTree
+{
+    public:
+        LoserTree(std::vector<std::unique_ptr<RunReader<Record>>>& sources, Compare comp)
+            : _sources(sources), _comp(comp), _k(static_cast<int>(sources.size())), _tree(std::max(1, _k))
+        {
+            _tree[0] = _k > 1 ? Build(1) : 0;
+        }
+
+        bool Empty() const { return !_sources[_tree[0]]->Valid(); }
+        const Record& Top() const { return _sources[_tree[0]]->Head(); }
+
+        void Pop()
+        {
+            int winner = _tree[0];
+            _sources[winner]->Advance();
+
+            for (int node = (winner + _k) / 2; node > 0; node /= 2)
+            {
+                if (Less(_tree[node], winner)) std::swap(_tree[node], winner);
+            }
+            _tree[0] = winner;
+        }
+
+    private:
+        bool Less(int a, int b) const
+        {
+            if (!_sources[a]->Valid()) return false;
+            if (!_sources[b]->Valid()) return true;
+            return _comp(_sources[a]->Head(), _sources[b]->Head());
+        }
+
+        // Leaves sit at [k, 2k) of the implicit heap, internal nodes at [1, k)
+        int Build(int node)
+        {
+            if (node >= _k) return node - _k;
+
+            int a = Build(2 * node);
+            int b = Build(2 * node + 1);
+            if (Less(b, a))
+            {
+                _tree[node] = a;
+                return b;
+            }
+            _tree[node] = b;
+            return a;
+        }
+
+        std::vector<std::unique_ptr<RunReader<Record>>>& _sources;
+        Compare _comp;
+        int _k;
+        std::vector<int> _tree;
+};
+
+// A run is a byte range of a file
+struct SortRun
+{
+    int fd;
+    off_t begin;
+    off_t end;
+};
+
+template <typename Record, typename Compare>
+bool MergeRuns(const std::vector<SortRun>& runs, int outFd, off_t outOffset, size_t blockBytes, Compare comp, IoQueue& io)
+{
+    std::vector<std::unique_ptr<RunReader<Record>>> readers;
+    for (const SortRun& run : runs)
+    {
+        readers.emplace_back(new RunReader<Record>(run.fd, run.begin, run.end, blockBytes, io));
+    }
+
+    RunWriter<Record> writer(outFd, outOffset, blockBytes, io);
+    LoserTree<Record, Compare> tree(readers, comp);
+    while (!tree.Empty())
+    {
+        writer.Push(tree.Top());
+        tree.Pop();
+    }
+
+    bool ok = writer.Close();
+    for (const auto& reader : readers) ok &= !reader->Failed();
+    return ok;
+}
+
+template <typename Record, typename Compare>
+bool ExternalSort(const char* inPath, const char* outPath, const ExternalSortConfig& config, Compare comp, ExternalSortStats* stats)
+{
+    static_assert(std::is_trivially_copyable<Record>::value, "Records are moved as raw bytes");
+
+    const size_t unit = RecordBlockUnit<Record>();
+    const size_t chunkBytes = std::max(unit, config.memoryBudget / 2 / unit * unit);
+    auto start = std::chrono::steady_clock::now();
+
+    int inFd = OpenFile(inPath, false, config.directIO);
+    if (inFd < 0) return false;
+
+    struct stat st;
+    if (fstat(inFd, &st) != 0)
+    {
+        close(inFd);
+        return false;
+    }
+    const off_t total = st.st_size / sizeof(Record) * sizeof(Record);
+
+    // The run file gets a name of its own from mkstemp, so concurrent sorts
+    // in one tempDir do not collide; the merge passes append to it. It is
+    // opened again for O_DIRECT.
+    std::string runPath = config.tempDir + "/extsort.runs.XXXXXX";
+    int created = mkstemp(&runPath[0]);
+    if (created < 0)
+    {
+        close(inFd);
+        return false;
+    }
+    close(created);
+
+    // Phase 1: sort budget / 2 sized chunks, writing the previous one while
+    // reading and sorting the next
+    int runFd = OpenFile(runPath.c_str(), true, config.directIO);
+    if (runFd < 0)
+    {
+        unlink(runPath.c_str());
+        close(inFd);
+        return false;
+    }
+
+    std::vector<SortRun> runs;
+    bool ok = true;
+    {
+        IoQueue io;
+        AlignedBuffer chunks[2] = { AllocateAligned(chunkBytes), AllocateAligned(chunkBytes) };
+        std::future<ssize_t> pending[2];
+        ok = chunks[0] && chunks[1];
+
+        int current = 0;
+        for (off_t offset = 0; ok && offset < total; offset += chunkBytes, current = 1 - current)
+        {
+            if (pending[current].valid()) ok &= pending[current].get() >= 0;
+
+            size_t bytes = std::min<size_t>(chunkBytes, total - offset);
+            char* data = chunks[current].get();
+            ok &= ReadFully(inFd, data, RoundUpTo(bytes, kIoAlignment), offset) >= (ssize_t)bytes;
+
+            Record* records = reinterpret_cast<Record*>(data);
+            Sort(records, records + bytes / sizeof(Record), comp);
+
+            pending[current] = io.Submit([=]() {
+                return WriteFully(runFd, data, RoundUpTo(bytes, kIoAlignment), offset);
+            });
+            runs.push_back(SortRun { runFd, offset, offset + (off_t)bytes });
+        }
+        for (std::future<ssize_t>& write : pending)
+        {
+            if (write.valid()) ok &= write.get() >= 0;
+        }
+        ok &= ftruncate(runFd, total) == 0;
+    }
+    close(inFd);
+    close(runFd);
+
+    auto runsDone = std::chrono::steady_clock::now();
+    if (stats)
+    {
+        stats->bytes = total;
+        stats->runs = static_cast<int>(runs.size());
+        stats->mergePasses = 0;
+        stats->runSeconds = std::chrono::duration<double>(runsDone - start).count();
+    }
+
+    // Phase 2: each reader and the writer get two blocks. Merge as many runs
+    // at once as the budget allows with blocks of at least kMinMergeBlock;
+    // runs and merged groups all start on chunk boundaries, so every offset
+    // stays page aligned.
+    const size_t fanIn = std::max<size_t>(2, config.memoryBudget / kMinMergeBlock / 2 - 1);
+    std::string inputPath = runPath;
+    int pass = 0;
+    while (ok)
+    {
+        const bool last = runs.size() <= fanIn;
+        const std::string outputPath = last ? std::string(outPath) : runPath + "." + std::to_string(pass);
+
+        size_t fan = std::min(fanIn, runs.size());
+        size_t blockBytes = std::max(unit, config.memoryBudget / (2 * (fan + 1)) / unit * unit);
+
+        int readFd = OpenFile(inputPath.c_str(), false, config.directIO);
+        int writeFd = OpenFile(outputPath.c_str(), true, config.directIO);
+        ok = readFd >= 0 && writeFd >= 0;
+
+        std::vector<SortRun> merged;
+        {
+            IoQueue io;
+            for (size_t first = 0; ok && first < runs.size(); first += fanIn)
+            {
+                std::vector<SortRun> group(runs.begin() + first, runs.begin() + std::min(runs.size(), first + fanIn));
+                for (SortRun& run : group) run.fd = readFd;
+
+                SortRun out = { writeFd, group.front().begin, group.back().end };
+                ok &= MergeRuns<Record>(group, writeFd, out.begin, blockBytes, comp, io);
+                merged.push_back(out);
+            }
+        }
+        ok &= writeFd >= 0 && ftruncate(writeFd, total) == 0;
+
+        if (readFd >= 0) close(readFd);
+        if (writeFd >= 0) close(writeFd);
+        unlink(inputPath.c_str());
+        inputPath.clear();
+
+        pass++;
+        if (last) break;
+
+        runs = merged;
+        inputPath = outputPath;
+    }
+
+    // On failure the run file of phase 1, or the output of the failed
+    // intermediate pass, is still there
+    if (!ok && !inputPath.empty()) unlink(inputPath.c_str());
+
+    if (stats)
+    {
+        stats->mergePasses = pass;
+        stats->mergeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - runsDone).count();
+    }
+    return ok;
+}
+
+template <typename Record>
+bool ExternalSort(const char* inPath, const char* outPath, const ExternalSortConfig& config, ExternalSortStats* stats = nullptr)
+{
+    return ExternalSort<Record>(inPath, outPath, config, std::less<Record>(), stats);
+}
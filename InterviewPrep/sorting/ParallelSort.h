@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "Sort.h"
+#include "WorkStealingPool.h"
+
+// Parallel quicksort on top of WorkStealingPool. Each partition step spawns
+// the smaller side as a task and keeps going on the larger one; ranges under
+// kParallelSortGrain are handed to the serial Sort. Big ranges are also
+// partitioned in parallel (see ParallelPartition) so the first levels, which
+// touch the whole array, are not stuck on one core.
+//
+// The work is split on fixed block boundaries, never on the thread count, and
+// every task runs the same deterministic code whichever worker picks it up,
+// so the output (including the order of equal keys) is the same for any
+// number of threads.
+
+// Below this size a range is sorted serially by one task
+static const std::ptrdiff_t kParallelSortGrain = 1 << 14;
+
+// Ranges at least this big get the block parallel partition
+static const std::ptrdiff_t kParallelPartitionThreshold = 1 << 20;
+
+// Elements per block in the parallel partition and per chunk in its fixup
+static const std::ptrdiff_t kPartitionBlock = 1 << 16;
+
+// Partitions [first, last) so that elements satisfying pred come first and
+// returns how many do. Blocks are partitioned independently in parallel,
+// then the elements that ended up on the wrong side of the global split are
+// swapped pairwise, also in parallel.
+template <typename RandomIt, typename Predicate>
+std::ptrdiff_t ParallelPartition(RandomIt first, RandomIt last, Predicate pred, WorkStealingPool& pool)
+{
+    const std::ptrdiff_t n = last - first;
+    const std::ptrdiff_t blocks = (n + kPartitionBlock - 1) / kPartitionBlock;
+    std::vector<std::ptrdiff_t> front(blocks);
+
+    TaskGroup group;
+    for (std::ptrdiff_t b = 0; b < blocks; b++)
+    {
+        pool.Spawn(group, [=, &front]() {
+            RandomIt begin = first + b * kPartitionBlock;
+            RandomIt end = first + std::min(n, (b + 1) * kPartitionBlock);
+            front[b] = std::partition(begin, end, pred) - begin;
+        });
+    }
+    pool.Wait(group);
+
+    std::ptrdiff_t split = 0;
+    for (std::ptrdiff_t count : front) split += count;
+
+    // Misplaced runs: the back part of blocks left of split, and the front
+    // part of blocks right of it. Both lists hold the same number of elements.
+    struct Run { std::ptrdiff_t begin, end; };
+    std::vector<Run> left, right;
+    for (std::ptrdiff_t b = 0; b < blocks; b++)
+    {
+        std::ptrdiff_t begin = b * kPartitionBlock;
+        std::ptrdiff_t end = std::min(n, begin + kPartitionBlock);
+        std::ptrdiff_t mid = begin + front[b];
+
+        Run wrongLeft = { mid, std::min(end, split) };
+        if (wrongLeft.begin < wrongLeft.end) left.push_back(wrongLeft);
+        Run wrongRight = { std::max(begin, split), mid };
+        if (wrongRight.begin < wrongRight.end) right.push_back(wrongRight);
+    }
+
+    std::vector<std::ptrdiff_t> leftStart(1, 0), rightStart(1, 0);
+    for (const Run& run : left) leftStart.push_back(leftStart.back() + run.end - run.begin);
+    for (const Run& run : right) rightStart.push_back(rightStart.back() + run.end - run.begin);
+    const std::ptrdiff_t misplaced = leftStart.back();
+
+    // Maps the k-th misplaced element of a run list to its array index
+    auto Locate = [](const std::vector<Run>& runs, const std::vector<std::ptrdiff_t>& starts, std::ptrdiff_t k, size_t& run) {
+        while (starts[run + 1] <= k) run++;
+        return runs[run].begin + (k - starts[run]);
+    };
+
+    for (std::ptrdiff_t chunk = 0; chunk < misplaced; chunk += kPartitionBlock)
+    {
+        pool.Spawn(group, [=, &left, &right, &leftStart, &rightStart]() {
+            std::ptrdiff_t end = std::min(misplaced, chunk + kPartitionBlock);
+            size_t l = std::upper_bound(leftStart.begin(), leftStart.end(), chunk) - leftStart.begin() - 1;
+            size_t r = std::upper_bound(rightStart.begin(), rightStart.end(), chunk) - rightStart.begin() - 1;
+            for (std::ptrdiff_t k = chunk; k < end; k++)
+            {
+                std::swap(first[Locate(left, leftStart, k, l)], first[Locate(right, rightStart, k, r)]);
+            }
+        });
+    }
+    pool.Wait(group);
+
+    return split;
+}
+
+template <typename RandomIt, typename Compare>
+void ParallelSortTask(RandomIt first, RandomIt last, int depthLimit, Compare comp, WorkStealingPool& pool, TaskGroup& group)
+{
+    while (last - first > kParallelSortGrain)
+    {
+        if (depthLimit == 0)
+        {
+            HeapSort(first, last, comp);
+            return;
+        }
+        depthLimit--;
+
+        MovePivotToFirst(first, last, comp);
+        RandomIt lo, hi;
+        if (last - first >= kParallelPartitionThreshold)
+        {
+            typedef typename std::iterator_traits<RandomIt>::value_type T;
+            const T pivot = *first;
+
+            // [first + 1, cut) < pivot <= [cut, last), then the pivot moves
+            // to the boundary so it is excluded from both sides
+            std::ptrdiff_t less = ParallelPartition(first + 1, last, [&](const T& x) { return comp(x, pivot); }, pool);
+            RandomIt cut = first + less;
+            std::swap(*first, *cut);
+            lo = cut;
+            hi = cut + 1;
+
+            // A lopsided split means many keys equal the pivot; pull them out
+            // as a block that is already in its final place
+            if ((last - hi) > 7 * ((last - first) / 8))
+            {
+                hi += ParallelPartition(hi, last, [&](const T& x) { return !comp(pivot, x); }, pool);
+            }
+        }
+        else
+        {
+            lo = hi = HoarePartition(first + 1, last, *first, comp);
+        }
+
+        // Spawn the smaller side, keep the larger one on this task
+        if (lo - first < last - hi)
+        {
+            pool.Spawn(group, [=, &pool, &group]() { ParallelSortTask(first, lo, depthLimit, comp, pool, group); });
+            first = hi;
+        }
+        else
+        {
+            pool.Spawn(group, [=, &pool, &group]() { ParallelSortTask(hi, last, depthLimit, comp, pool, group); });
+            last = lo;
+        }
+    }
+    Sort(first, last, comp);
+}
+
+template <typename RandomIt, typename Compare>
+void ParallelSort(RandomIt first, RandomIt last, Compare comp, WorkStealingPool& pool)
+{
+    std::ptrdiff_t n = last - first;
+    if (n < 2) return;
+
+    int log2n = 0;
+    while ((std::ptrdiff_t(1) << (log2n + 1)) <= n) log2n++;
+
+    TaskGroup group;
+    ParallelSortTask(first, last, 2 * log2n, comp, pool, group);
+    pool.Wait(group);
+}
+
+template <typename RandomIt>
+void ParallelSort(RandomIt first, RandomIt last, WorkStealingPool& pool)
+{
+    ParallelSort(first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>(), pool);
+}
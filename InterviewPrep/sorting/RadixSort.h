@@ -0,0 +1,215 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Maps a key to an unsigned integer with the same ordering, and back.
+// Signed integers get their sign bit flipped. IEEE floats flip every bit
+// when negative (larger magnitude means smaller) and only the sign bit
+// otherwise, so -0.0 sorts right before +0.0 and NaNs go to the ends.
+template <typename T, typename Enable = void>
+struct RadixKey;
+
+template <typename T>
+struct RadixKey<T, typename std::enable_if<std::is_integral<T>::value>::type>
+{
+    typedef typename std::make_unsigned<T>::type Bits;
+    static const Bits kFlip = std::is_signed<T>::value ? Bits(Bits(1) << (sizeof(T) * 8 - 1)) : Bits(0);
+
+    static Bits Encode(T key) { return Bits(Bits(key) ^ kFlip); }
+    static T Decode(Bits bits) { return T(Bits(bits ^ kFlip)); }
+};
+
+template <typename T>
+struct RadixKey<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static_assert(sizeof(T) == 4 || sizeof(T) == 8, "Only IEEE single and double precision keys are supported");
+
+    typedef typename std::conditional<sizeof(T) == 4, uint32_t, uint64_t>::type Bits;
+    static const Bits kSign = Bits(1) << (sizeof(T) * 8 - 1);
+
+    static Bits Encode(T key)
+    {
+        Bits bits;
+        memcpy(&bits, &key, sizeof(bits));
+        return (bits & kSign) ? Bits(~bits) : Bits(bits | kSign);
+    }
+
+    static T Decode(Bits bits)
+    {
+        bits = (bits & kSign) ? Bits(bits & ~kSign) : Bits(~bits);
+        T key;
+        memcpy(&key, &bits, sizeof(key));
+        return key;
+    }
+};
+
+// LSD radix sort with scratch buffers that are kept (and only ever grown)
+// across calls, so sorting many batches does not reallocate.
+//
+// 8-bit keys are a single 256 bucket counting sort. 16-bit keys use two 8-bit
+// digits; 32 and 64-bit keys use 11-bit digits (3 and 6 passes). A 2048 entry
+// histogram is 16 KB, so one pass's counts fit in L1, though all of them
+// (48 KB and 96 KB) spill to L2 while they are built. All histograms come out
+// of a single read of the input, and a pass is skipped when every key shares
+// its digit.
+class RadixSorter
+{
+    public:
+        // Sorts keys in place, ascending
+        template <typename T>
+        void Sort(T* keys, size_t n)
+        {
+            typedef RadixKey<T> Key;
+            typedef typename Key::Bits Bits;
+            if (n < 2) return;
+
+            if (sizeof(T) == 1)
+            {
+                // Counting sort, no scatter needed: the counts are the output
+                size_t count[256] = {};
+                for (size_t i = 0; i < n; i++) count[Key::Encode(keys[i])]++;
+
+                T* out = keys;
+                for (int b = 0; b < 256; b++)
+                {
+                    T value = Key::Decode(Bits(b));
+                    for (size_t c = 0; c < count[b]; c++) *out++ = value;
+                }
+                return;
+            }
+
+            Bits* src = Scratch<Bits>(_keyScratch[0], n);
+            Bits* dst = Scratch<Bits>(_keyScratch[1], n);
+            for (size_t i = 0; i < n; i++) src[i] = Key::Encode(keys[i]);
+
+            std::vector<size_t>& hist = Histograms(src, n);
+            for (int pass = 0; pass < Passes<Bits>(); pass++)
+            {
+                size_t* offsets = hist.data() + pass * Buckets<Bits>();
+                if (!PrefixSum(offsets, n, Buckets<Bits>())) continue;
+
+                const int shift = pass * DigitBits<Bits>();
+                for (size_t i = 0; i < n; i++)
+                {
+                    dst[offsets[Digit<Bits>(src[i], shift)]++] = src[i];
+                }
+                std::swap(src, dst);
+            }
+
+            for (size_t i = 0; i < n; i++) keys[i] = Key::Decode(src[i]);
+        }
+
+        // Sorts keys in place and applies the same permutation to values
+        // (typically the original indices). Stable, equal keys keep the
+        // order of their values.
+        template <typename K, typename V>
+        void SortPairs(K* keys, V* values, size_t n)
+        {
+            static_assert(std::is_trivially_copyable<V>::value, "Values are moved through raw scratch memory");
+
+            typedef RadixKey<K> Key;
+            typedef typename Key::Bits Bits;
+            if (n < 2) return;
+
+            Bits* src = Scratch<Bits>(_keyScratch[0], n);
+            Bits* dst = Scratch<Bits>(_keyScratch[1], n);
+            V* srcValues = values;
+            V* dstValues = Scratch<V>(_valueScratch[0], n);
+            V* spareValues = Scratch<V>(_valueScratch[1], n);
+            for (size_t i = 0; i < n; i++) src[i] = Key::Encode(keys[i]);
+
+            std::vector<size_t>& hist = Histograms(src, n);
+            for (int pass = 0; pass < Passes<Bits>(); pass++)
+            {
+                size_t* offsets = hist.data() + pass * Buckets<Bits>();
+                if (!PrefixSum(offsets, n, Buckets<Bits>())) continue;
+
+                const int shift = pass * DigitBits<Bits>();
+                for (size_t i = 0; i < n; i++)
+                {
+                    size_t to = offsets[Digit<Bits>(src[i], shift)]++;
+                    dst[to] = src[i];
+                    dstValues[to] = srcValues[i];
+                }
+                std::swap(src, dst);
+
+                // The caller's array is only read from, never written to, until the end
+                V* written = dstValues;
+                dstValues = srcValues == values ? spareValues : srcValues;
+                srcValues = written;
+            }
+
+            for (size_t i = 0; i < n; i++) keys[i] = Key::Decode(src[i]);
+            if (srcValues != values) memcpy(values, srcValues, n * sizeof(V));
+        }
+
+        size_t ScratchBytes() const
+        {
+            return _keyScratch[0].capacity() + _keyScratch[1].capacity()
+                + _valueScratch[0].capacity() + _valueScratch[1].capacity();
+        }
+
+    private:
+        template <typename Bits>
+        static constexpr int DigitBits() { return sizeof(Bits) <= 2 ? 8 : 11; }
+
+        template <typename Bits>
+        static constexpr int Buckets() { return 1 << DigitBits<Bits>(); }
+
+        template <typename Bits>
+        static constexpr int Passes() { return (sizeof(Bits) * 8 + DigitBits<Bits>() - 1) / DigitBits<Bits>(); }
+
+        template <typename Bits>
+        static size_t Digit(Bits bits, int shift) { return (bits >> shift) & (Buckets<Bits>() - 1); }
+
+        template <typename T>
+        static T* Scratch(std::vector<unsigned char>& buffer, size_t n)
+        {
+            if (buffer.size() < n * sizeof(T)) buffer.resize(n * sizeof(T));
+            return reinterpret_cast<T*>(buffer.data());
+        }
+
+        template <typename Bits>
+        std::vector<size_t>& Histograms(const Bits* keys, size_t n)
+        {
+            _hist.assign(Passes<Bits>() * Buckets<Bits>(), 0);
+            for (size_t i = 0; i < n; i++)
+            {
+                for (int pass = 0; pass < Passes<Bits>(); pass++)
+                {
+                    _hist[pass * Buckets<Bits>() + Digit<Bits>(keys[i], pass * DigitBits<Bits>())]++;
+                }
+            }
+            return _hist;
+        }
+
+        // Turns counts into starting offsets. Returns false when one bucket
+        // holds every key, in which case the pass would not move anything.
+        static bool PrefixSum(size_t* counts, size_t n, int buckets)
+        {
+            size_t sum = 0;
+            for (int b = 0; b < buckets; b++)
+            {
+                if (counts[b] == n) return false;
+                size_t c = counts[b];
+                counts[b] = sum;
+                sum += c;
+            }
+            return true;
+        }
+
+        std::vector<unsigned char> _keyScratch[2];
+        std::vector<unsigned char> _valueScratch[2];
+        std::vector<size_t> _hist;
+};
+
+template <typename T>
+void RadixSort(T* keys, size_t n)
+{
+    RadixSorter sorter;
+    sorter.Sort(keys, n);
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <stddef.h>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "Sort.h"
+
+// Selection on the introsort building blocks, for when only the k smallest
+// (or largest, with std::greater) or the median are needed.
+//
+// IntroSelect is quickselect with the pivot choice and HoarePartition of
+// IntroSortLoop, following only the side that holds nth: O(n) expected.
+// The range it follows has to halve every kSelectHalvingPartitions
+// partitions; the first time it does not, every later pivot is a median of
+// medians. Each quickselect stretch then costs O(size) on a range half the
+// size of the last one, and median of medians is linear too, so the worst
+// case stays O(n) where introsort falls back to heapsort.
+// PartialSort selects, then sorts only the first k. StreamingTopK keeps the
+// k smallest of an input of any length in a fixed size heap.
+
+// Elements per group when taking the median of medians
+static const int kMedianGroup = 5;
+
+// Partitions quickselect gets to halve the range before it gives up on its
+// pivots
+static const int kSelectHalvingPartitions = 4;
+
+template <typename RandomIt, typename Compare>
+void IntroSelectLoop(RandomIt first, RandomIt nth, RandomIt last, bool medianOfMedians, Compare comp);
+
+// Pivot for the fallback: the median of the medians of groups of five,
+// swapped into *first. Group medians are gathered at the front of the range
+// and selected there recursively.
+template <typename RandomIt, typename Compare>
+void MoveMedianOfMediansToFirst(RandomIt first, RandomIt last, Compare comp)
+{
+    std::ptrdiff_t groups = (last - first) / kMedianGroup;
+    for (std::ptrdiff_t g = 0; g < groups; g++)
+    {
+        RandomIt group = first + g * kMedianGroup;
+        InsertionSort(group, group + kMedianGroup, comp);
+        std::swap(first[g], group[kMedianGroup / 2]);
+    }
+
+    IntroSelectLoop(first, first + groups / 2, first + groups, false, comp);
+    std::swap(*first, first[groups / 2]);
+}
+
+// Same scheme as IntroSortLoop: the pivot stays right before the range it
+// partitions, which is what HoarePartition's unguarded scans need. With
+// medianOfMedians set, or once the range fails to halve in time, every
+// further pivot is a median of medians.
+template <typename RandomIt, typename Compare>
+void IntroSelectLoop(RandomIt first, RandomIt nth, RandomIt last, bool medianOfMedians, Compare comp)
+{
+    std::ptrdiff_t half = (last - first) / 2;
+    int partitionsLeft = kSelectHalvingPartitions;
+    while (last - first > kInsertionSortThreshold)
+    {
+        if (medianOfMedians) MoveMedianOfMediansToFirst(first, last, comp);
+        else MovePivotToFirst(first, last, comp);
+        RandomIt cut = HoarePartition(first + 1, last, *first, comp);
+
+        if (nth < cut) last = cut;
+        else first = cut;
+
+        if (last - first <= half)
+        {
+            half = (last - first) / 2;
+            partitionsLeft = kSelectHalvingPartitions;
+        }
+        else if (--partitionsLeft == 0)
+        {
+            medianOfMedians = true;
+        }
+    }
+    InsertionSort(first, last, comp);
+}
+
+// Rearranges [first, last) so *nth is the element a full sort would put
+// there, nothing before it is greater and nothing after it is less. Same
+// contract as std::nth_element.
+template <typename RandomIt, typename Compare>
+void IntroSelect(RandomIt first, RandomIt nth, RandomIt last, Compare comp)
+{
+    if (last - first < 2 || nth >= last) return;
+    IntroSelectLoop(first, nth, last, false, comp);
+}
+
+template <typename RandomIt>
+void IntroSelect(RandomIt first, RandomIt nth, RandomIt last)
+{
+    IntroSelect(first, nth, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+}
+
+// Sorts the smallest middle - first elements into [first, middle); the rest
+// end up in [middle, last) in no particular order. O(n + k log k).
+template <typename RandomIt, typename Compare>
+void PartialSort(RandomIt first, RandomIt middle, RandomIt last, Compare comp)
+{
+    IntroSelect(first, middle, last, comp);
+    Sort(first, middle, comp);
+}
+
+template <typename RandomIt>
+void PartialSort(RandomIt first, RandomIt middle, RandomIt last)
+{
+    PartialSort(first, middle, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+}
+
+// The k smallest values seen so far, over a stream of unknown length, in
+// O(k) memory. The heap root is the largest value kept, so most values of a
+// long stream are rejected with one comparison. With std::greater it keeps
+// the k largest instead.
+template <typename T, typename Compare = std::less<T>>
+class StreamingTopK
+{
+    public:
+        explicit StreamingTopK(size_t k, Compare comp = Compare()) : _k(k), _comp(comp)
+        {
+            _heap.reserve(k);
+        }
+
+        void Push(const T& value)
+        {
+            if (_heap.size() < _k)
+            {
+                _heap.push_back(value);
+                SiftUp(_heap.size() - 1);
+            }
+            else if (_k > 0 && _comp(value, _heap[0]))
+            {
+                _heap[0] = value;
+                SiftDown(_heap.begin(), 0, static_cast<std::ptrdiff_t>(_heap.size()), _comp);
+            }
+        }
+
+        template <typename InputIt>
+        void Push(InputIt first, InputIt last)
+        {
+            for (; first != last; ++first) Push(*first);
+        }
+
+        // The kept values, smallest first
+        std::vector<T> Sorted() const
+        {
+            std::vector<T> values(_heap);
+            Sort(values.begin(), values.end(), _comp);
+            return values;
+        }
+
+        // Largest value kept, the bar a new value has to pass once full
+        const T& Threshold() const { return _heap[0]; }
+        size_t Size() const { return _heap.size(); }
+        size_t K() const { return _k; }
+
+    private:
+        void SiftUp(size_t i)
+        {
+            T value = std::move(_heap[i]);
+            while (i > 0)
+            {
+                size_t parent = (i - 1) / 2;
+                if (!_comp(_heap[parent], value)) break;
+                _heap[i] = std::move(_heap[parent]);
+                i = parent;
+            }
+            _heap[i] = std::move(value);
+        }
+
+        size_t _k;
+        Compare _comp;
+        std::vector<T> _heap; // max heap under _comp
+};
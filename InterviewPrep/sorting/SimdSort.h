@@ -0,0 +1,498 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+#include "Sort.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_SORT_X86 1
+#endif
+
+// Quicksort for int32 and float with vectorized building blocks:
+// - partitioning compares a whole vector against the pivot and writes the
+//   smaller elements to the left end and the rest to the right end in one
+//   go (AVX-512 compress stores, or an AVX2 permute from a lookup table),
+//   so there is no data dependent branch per element;
+// - ranges of 64 elements or fewer are finished by a bitonic sorting
+//   network held in eight AVX2 registers.
+// The instruction set is picked at runtime; SimdLevel::Scalar falls back to
+// the templated introsort from Sort.h. NaNs are not supported (neither are
+// they by std::sort with operator<).
+
+enum class SimdLevel { Scalar, Avx2, Avx512 };
+
+inline SimdLevel DetectSimdLevel()
+{
+#ifdef SIMD_SORT_X86
+    if (__builtin_cpu_supports("avx512f")) return SimdLevel::Avx512;
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::Avx2;
+#endif
+    return SimdLevel::Scalar;
+}
+
+inline const char* SimdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+        case SimdLevel::Scalar: return "scalar";
+        case SimdLevel::Avx2: return "AVX2";
+        case SimdLevel::Avx512: return "AVX-512";
+    }
+    return "?";
+}
+
+// Ranges up to this size are left to the sorting network
+static const std::ptrdiff_t kSortNetworkSize = 64;
+
+#ifdef SIMD_SORT_X86
+
+// 8 lane AVX2 operations, one specialization per key type
+template <typename T>
+struct Avx2Ops;
+
+template <>
+struct Avx2Ops<int32_t>
+{
+    typedef __m256i Vec;
+
+    __attribute__((target("avx2"))) static Vec Load(const int32_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    __attribute__((target("avx2"))) static void Store(int32_t* p, Vec v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+    __attribute__((target("avx2"))) static Vec Set1(int32_t x) { return _mm256_set1_epi32(x); }
+    __attribute__((target("avx2"))) static Vec Min(Vec a, Vec b) { return _mm256_min_epi32(a, b); }
+    __attribute__((target("avx2"))) static Vec Max(Vec a, Vec b) { return _mm256_max_epi32(a, b); }
+    __attribute__((target("avx2"))) static Vec Permute(Vec v, __m256i idx) { return _mm256_permutevar8x32_epi32(v, idx); }
+    template <int imm>
+    __attribute__((target("avx2"))) static Vec Blend(Vec a, Vec b) { return _mm256_blend_epi32(a, b, imm); }
+    __attribute__((target("avx2"))) static __m256 AsFloat(Vec v) { return _mm256_castsi256_ps(v); }
+    __attribute__((target("avx2"))) static Vec FromFloat(__m256 v) { return _mm256_castps_si256(v); }
+
+    // Bit i set when lane i goes to the left side
+    __attribute__((target("avx2"))) static int LeftMask(Vec v, Vec pivot, bool equalLeft)
+    {
+        int less = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(pivot, v)));
+        int greater = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, pivot)));
+        return equalLeft ? (~greater & 0xFF) : less;
+    }
+
+    static int32_t Sentinel() { return std::numeric_limits<int32_t>::max(); }
+};
+
+template <>
+struct Avx2Ops<float>
+{
+    typedef __m256 Vec;
+
+    __attribute__((target("avx2"))) static Vec Load(const float* p) { return _mm256_loadu_ps(p); }
+    __attribute__((target("avx2"))) static void Store(float* p, Vec v) { _mm256_storeu_ps(p, v); }
+    __attribute__((target("avx2"))) static Vec Set1(float x) { return _mm256_set1_ps(x); }
+    __attribute__((target("avx2"))) static Vec Min(Vec a, Vec b) { return _mm256_min_ps(a, b); }
+    __attribute__((target("avx2"))) static Vec Max(Vec a, Vec b) { return _mm256_max_ps(a, b); }
+    __attribute__((target("avx2"))) static Vec Permute(Vec v, __m256i idx) { return _mm256_permutevar8x32_ps(v, idx); }
+    template <int imm>
+    __attribute__((target("avx2"))) static Vec Blend(Vec a, Vec b) { return _mm256_blend_ps(a, b, imm); }
+    __attribute__((target("avx2"))) static __m256 AsFloat(Vec v) { return v; }
+    __attribute__((target("avx2"))) static Vec FromFloat(__m256 v) { return v; }
+
+    __attribute__((target("avx2"))) static int LeftMask(Vec v, Vec pivot, bool equalLeft)
+    {
+        return equalLeft ? _mm256_movemask_ps(_mm256_cmp_ps(v, pivot, _CMP_LE_OQ))
+            : _mm256_movemask_ps(_mm256_cmp_ps(v, pivot, _CMP_LT_OQ));
+    }
+
+    static float Sentinel() { return std::numeric_limits<float>::infinity(); }
+};
+
+// For every 8-bit lane mask, the permutation that moves the lanes with their
+// bit set to the front (in order) followed by the others (in order)
+struct CompressTable
+{
+    int32_t idx[256][8];
+
+    CompressTable()
+    {
+        for (int mask = 0; mask < 256; mask++)
+        {
+            int out = 0;
+            for (int lane = 0; lane < 8; lane++) if (mask & (1 << lane)) idx[mask][out++] = lane;
+            for (int lane = 0; lane < 8; lane++) if (!(mask & (1 << lane))) idx[mask][out++] = lane;
+        }
+    }
+
+    static const CompressTable& Get()
+    {
+        static const CompressTable table;
+        return table;
+    }
+};
+
+template <typename T>
+__attribute__((target("avx2")))
+void Transpose8x8(typename Avx2Ops<T>::Vec* v)
+{
+    typedef Avx2Ops<T> Ops;
+
+    __m256 r[8], t[8];
+    for (int i = 0; i < 8; i++) r[i] = Ops::AsFloat(v[i]);
+
+    for (int i = 0; i < 8; i += 2)
+    {
+        t[i] = _mm256_unpacklo_ps(r[i], r[i + 1]);
+        t[i + 1] = _mm256_unpackhi_ps(r[i], r[i + 1]);
+    }
+    for (int i = 0; i < 8; i += 4)
+    {
+        r[i] = _mm256_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(1, 0, 1, 0));
+        r[i + 1] = _mm256_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(3, 2, 3, 2));
+        r[i + 2] = _mm256_shuffle_ps(t[i + 1], t[i + 3], _MM_SHUFFLE(1, 0, 1, 0));
+        r[i + 3] = _mm256_shuffle_ps(t[i + 1], t[i + 3], _MM_SHUFFLE(3, 2, 3, 2));
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        v[i] = Ops::FromFloat(_mm256_permute2f128_ps(r[i], r[i + 4], 0x20));
+        v[i + 4] = Ops::FromFloat(_mm256_permute2f128_ps(r[i], r[i + 4], 0x31));
+    }
+}
+
+// Sorts one bitonic vector: compare-exchange lanes 4, 2 then 1 apart
+template <typename T>
+__attribute__((target("avx2")))
+typename Avx2Ops<T>::Vec BitonicCleanVector(typename Avx2Ops<T>::Vec v)
+{
+    typedef Avx2Ops<T> Ops;
+    typename Ops::Vec p;
+
+    p = Ops::Permute(v, _mm256_setr_epi32(4, 5, 6, 7, 0, 1, 2, 3));
+    v = Ops::template Blend<0xF0>(Ops::Min(v, p), Ops::Max(v, p));
+    p = Ops::Permute(v, _mm256_setr_epi32(2, 3, 0, 1, 6, 7, 4, 5));
+    v = Ops::template Blend<0xCC>(Ops::Min(v, p), Ops::Max(v, p));
+    p = Ops::Permute(v, _mm256_setr_epi32(1, 0, 3, 2, 5, 4, 7, 6));
+    v = Ops::template Blend<0xAA>(Ops::Min(v, p), Ops::Max(v, p));
+    return v;
+}
+
+// Sorts a bitonic sequence spread over count vectors (count a power of two)
+template <typename T>
+__attribute__((target("avx2")))
+void BitonicClean(typename Avx2Ops<T>::Vec* v, int count)
+{
+    typedef Avx2Ops<T> Ops;
+
+    if (count == 1)
+    {
+        v[0] = BitonicCleanVector<T>(v[0]);
+        return;
+    }
+
+    int half = count / 2;
+    for (int i = 0; i < half; i++)
+    {
+        typename Ops::Vec lo = Ops::Min(v[i], v[i + half]);
+        v[i + half] = Ops::Max(v[i], v[i + half]);
+        v[i] = lo;
+    }
+    BitonicClean<T>(v, half);
+    BitonicClean<T>(v + half, half);
+}
+
+// Merges two sorted runs of count / 2 vectors: reversing the second run makes
+// the whole thing bitonic
+template <typename T>
+__attribute__((target("avx2")))
+void BitonicMerge(typename Avx2Ops<T>::Vec* v, int count)
+{
+    typedef Avx2Ops<T> Ops;
+
+    const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    int half = count / 2;
+    for (int i = 0; i < half / 2; i++) std::swap(v[half + i], v[count - 1 - i]);
+    for (int i = half; i < count; i++) v[i] = Ops::Permute(v[i], reverse);
+
+    BitonicClean<T>(v, count);
+}
+
+// Sorts up to 64 elements in registers. Short ranges are padded with the
+// largest key so they sort to the (discarded) end.
+template <typename T>
+__attribute__((target("avx2")))
+void SortNetwork64(T* data, std::ptrdiff_t n)
+{
+    typedef Avx2Ops<T> Ops;
+
+    T buffer[64];
+    memcpy(buffer, data, n * sizeof(T));
+    for (std::ptrdiff_t i = n; i < 64; i++) buffer[i] = Ops::Sentinel();
+
+    typename Ops::Vec v[8];
+    for (int i = 0; i < 8; i++) v[i] = Ops::Load(buffer + 8 * i);
+
+    // Optimal 19 comparator network on the columns (lane i of every register)
+    static const int network[19][2] = {
+        {0, 2}, {1, 3}, {4, 6}, {5, 7},
+        {0, 4}, {1, 5}, {2, 6}, {3, 7},
+        {0, 1}, {2, 3}, {4, 5}, {6, 7},
+        {2, 4}, {3, 5},
+        {1, 4}, {3, 6},
+        {1, 2}, {3, 4}, {5, 6}
+    };
+    for (int c = 0; c < 19; c++)
+    {
+        typename Ops::Vec lo = Ops::Min(v[network[c][0]], v[network[c][1]]);
+        v[network[c][1]] = Ops::Max(v[network[c][0]], v[network[c][1]]);
+        v[network[c][0]] = lo;
+    }
+
+    // Each register now holds one sorted column's worth of rows
+    Transpose8x8<T>(v);
+
+    for (int run = 2; run <= 8; run *= 2)
+    {
+        for (int i = 0; i < 8; i += run) BitonicMerge<T>(v + i, run);
+    }
+
+    for (int i = 0; i < 8; i++) Ops::Store(buffer + 8 * i, v[i]);
+    memcpy(data, buffer, n * sizeof(T));
+}
+
+// Places the few elements that are left once fewer than a vector remain
+// between the read pointers. All of them (plus the buffered ends) fit in the
+// gap [wl, wr) exactly.
+template <typename T>
+T* PartitionTail(const T* items, std::ptrdiff_t count, T* wl, T* wr, T pivot, bool equalLeft)
+{
+    for (std::ptrdiff_t i = 0; i < count; i++)
+    {
+        T x = items[i];
+        bool left = equalLeft ? !(pivot < x) : x < pivot;
+        if (left) *wl++ = x;
+        else *--wr = x;
+    }
+    return wl;
+}
+
+// Partitions [first, last) so that [first, mid) < pivot <= [mid, last)
+// (or <= pivot < with equalLeft) and returns mid. The first and last vector
+// are held in registers, which leaves a vector of free space at each end;
+// reading the next vector from the side with less free space keeps at
+// least a vector free on both sides, so full width stores never clobber
+// unread data.
+template <typename T>
+__attribute__((target("avx2")))
+T* PartitionAvx2(T* first, T* last, T pivot, bool equalLeft)
+{
+    typedef Avx2Ops<T> Ops;
+    const std::ptrdiff_t kLanes = 8;
+
+    if (last - first < 2 * kLanes)
+    {
+        return std::partition(first, last, [=](T x) { return equalLeft ? !(pivot < x) : x < pivot; });
+    }
+
+    const CompressTable& table = CompressTable::Get();
+    const typename Ops::Vec vpivot = Ops::Set1(pivot);
+
+    typename Ops::Vec vl = Ops::Load(first);
+    typename Ops::Vec vr = Ops::Load(last - kLanes);
+    T* l = first + kLanes;
+    T* r = last - kLanes;
+    T* wl = first;
+    T* wr = last;
+
+    while (r - l >= kLanes)
+    {
+        typename Ops::Vec v;
+        if (l - wl <= wr - r)
+        {
+            v = Ops::Load(l);
+            l += kLanes;
+        }
+        else
+        {
+            r -= kLanes;
+            v = Ops::Load(r);
+        }
+
+        int mask = Ops::LeftMask(v, vpivot, equalLeft);
+        int count = __builtin_popcount(mask);
+        v = Ops::Permute(v, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(table.idx[mask])));
+        Ops::Store(wl, v);
+        Ops::Store(wr - kLanes, v);
+        wl += count;
+        wr -= kLanes - count;
+    }
+
+    T tail[3 * kLanes];
+    std::ptrdiff_t count = r - l;
+    memcpy(tail, l, count * sizeof(T));
+    Ops::Store(tail + count, vl);
+    Ops::Store(tail + count + kLanes, vr);
+    return PartitionTail(tail, count + 2 * kLanes, wl, wr, pivot, equalLeft);
+}
+
+// 16 lane AVX-512 operations, only used by the partition kernel
+template <typename T>
+struct Avx512Ops;
+
+template <>
+struct Avx512Ops<int32_t>
+{
+    typedef __m512i Vec;
+
+    __attribute__((target("avx512f"))) static Vec Load(const int32_t* p) { return _mm512_loadu_si512(p); }
+    __attribute__((target("avx512f"))) static Vec Set1(int32_t x) { return _mm512_set1_epi32(x); }
+    __attribute__((target("avx512f"))) static __mmask16 LeftMask(Vec v, Vec pivot, bool equalLeft)
+    {
+        return equalLeft ? _mm512_cmple_epi32_mask(v, pivot) : _mm512_cmplt_epi32_mask(v, pivot);
+    }
+    __attribute__((target("avx512f"))) static void CompressStore(int32_t* p, __mmask16 mask, Vec v)
+    {
+        _mm512_mask_compressstoreu_epi32(p, mask, v);
+    }
+    __attribute__((target("avx512f"))) static void Store(int32_t* p, Vec v) { _mm512_storeu_si512(p, v); }
+};
+
+template <>
+struct Avx512Ops<float>
+{
+    typedef __m512 Vec;
+
+    __attribute__((target("avx512f"))) static Vec Load(const float* p) { return _mm512_loadu_ps(p); }
+    __attribute__((target("avx512f"))) static Vec Set1(float x) { return _mm512_set1_ps(x); }
+    __attribute__((target("avx512f"))) static __mmask16 LeftMask(Vec v, Vec pivot, bool equalLeft)
+    {
+        return equalLeft ? _mm512_cmp_ps_mask(v, pivot, _CMP_LE_OQ) : _mm512_cmp_ps_mask(v, pivot, _CMP_LT_OQ);
+    }
+    __attribute__((target("avx512f"))) static void CompressStore(float* p, __mmask16 mask, Vec v)
+    {
+        _mm512_mask_compressstoreu_ps(p, mask, v);
+    }
+    __attribute__((target("avx512f"))) static void Store(float* p, Vec v) { _mm512_storeu_ps(p, v); }
+};
+
+// Same scheme as PartitionAvx2, with compress stores writing exactly the
+// selected lanes on each side
+template <typename T>
+__attribute__((target("avx512f")))
+T* PartitionAvx512(T* first, T* last, T pivot, bool equalLeft)
+{
+    typedef Avx512Ops<T> Ops;
+    const std::ptrdiff_t kLanes = 16;
+
+    if (last - first < 2 * kLanes)
+    {
+        return std::partition(first, last, [=](T x) { return equalLeft ? !(pivot < x) : x < pivot; });
+    }
+
+    const typename Ops::Vec vpivot = Ops::Set1(pivot);
+
+    typename Ops::Vec vl = Ops::Load(first);
+    typename Ops::Vec vr = Ops::Load(last - kLanes);
+    T* l = first + kLanes;
+    T* r = last - kLanes;
+    T* wl = first;
+    T* wr = last;
+
+    while (r - l >= kLanes)
+    {
+        typename Ops::Vec v;
+        if (l - wl <= wr - r)
+        {
+            v = Ops::Load(l);
+            l += kLanes;
+        }
+        else
+        {
+            r -= kLanes;
+            v = Ops::Load(r);
+        }
+
+        __mmask16 mask = Ops::LeftMask(v, vpivot, equalLeft);
+        int count = __builtin_popcount(mask);
+        Ops::CompressStore(wl, mask, v);
+        Ops::CompressStore(wr - (kLanes - count), static_cast<__mmask16>(~mask), v);
+        wl += count;
+        wr -= kLanes - count;
+    }
+
+    T tail[3 * kLanes];
+    std::ptrdiff_t count = r - l;
+    memcpy(tail, l, count * sizeof(T));
+    Ops::Store(tail + count, vl);
+    Ops::Store(tail + count + kLanes, vr);
+    return PartitionTail(tail, count + 2 * kLanes, wl, wr, pivot, equalLeft);
+}
+
+template <typename T>
+void SimdSortLoop(T* first, T* last, int depthLimit, T* (*partition)(T*, T*, T, bool))
+{
+    while (last - first > kSortNetworkSize)
+    {
+        if (depthLimit == 0)
+        {
+            HeapSort(first, last, std::less<T>());
+            return;
+        }
+        depthLimit--;
+
+        MovePivotToFirst(first, last, std::less<T>());
+        const T pivot = *first;
+
+        T* lo = partition(first, last, pivot, false);
+        T* hi = lo;
+        if (lo == first)
+        {
+            // Nothing below the pivot: peel off the keys equal to it, they
+            // are already in their final place
+            hi = partition(first, last, pivot, true);
+            if (hi == last) return;
+        }
+
+        // Recurse into the smaller side, loop on the larger one
+        if (lo - first < last - hi)
+        {
+            SimdSortLoop(first, lo, depthLimit, partition);
+            first = hi;
+        }
+        else
+        {
+            SimdSortLoop(hi, last, depthLimit, partition);
+            last = lo;
+        }
+    }
+    if (last - first > 1) SortNetwork64(first, last - first);
+}
+
+#endif
+
+template <typename T>
+void SimdSortImpl(T* data, size_t n, SimdLevel level)
+{
+    if (n < 2) return;
+
+#ifdef SIMD_SORT_X86
+    if (level != SimdLevel::Scalar)
+    {
+        int log2n = 0;
+        while ((size_t(1) << (log2n + 1)) <= n) log2n++;
+
+        T* (*partition)(T*, T*, T, bool) = level == SimdLevel::Avx512 ? &PartitionAvx512<T> : &PartitionAvx2<T>;
+        SimdSortLoop(data, data + n, 2 * log2n, partition);
+        return;
+    }
+#endif
+    Sort(data, data + n);
+}
+
+inline void SimdSort(int32_t* data, size_t n, SimdLevel level = DetectSimdLevel())
+{
+    SimdSortImpl(data, n, level);
+}
+
+inline void SimdSort(float* data, size_t n, SimdLevel level = DetectSimdLevel())
+{
+    SimdSortImpl(data, n, level);
+}
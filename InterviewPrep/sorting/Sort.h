@@ -0,0 +1,179 @@
+#pragma once
+
+#include <functional>
+#include <iterator>
+#include <utility>
+
+// Introsort: median-of-three (ninther on large ranges) quicksort that only
+// recurses on the smaller side, switches to heapsort once the depth passes
+// 2 * log2(n), and leaves ranges under kInsertionSortThreshold to insertion
+// sort. Not stable, same contract as std::sort.
+
+// Below this size insertion sort beats another partition step. Picked with
+// the main.cpp benchmark: 16 was clearly slower on random int32 / float,
+// 24 to 48 were within run to run noise of each other.
+static const int kInsertionSortThreshold = 24;
+
+// Ranges larger than this use Tukey's ninther instead of a plain median of 3
+static const int kNintherThreshold = 128;
+
+template <typename RandomIt, typename Compare>
+void InsertionSort(RandomIt first, RandomIt last, Compare comp)
+{
+    if (first == last) return;
+
+    for (RandomIt i = first + 1; i != last; ++i)
+    {
+        auto value = std::move(*i);
+        RandomIt j = i;
+        for (; j != first && comp(value, *(j - 1)); --j)
+        {
+            *j = std::move(*(j - 1));
+        }
+        *j = std::move(value);
+    }
+}
+
+template <typename RandomIt, typename Compare>
+void SiftDown(RandomIt first, std::ptrdiff_t root, std::ptrdiff_t n, Compare comp)
+{
+    auto value = std::move(first[root]);
+    while (true)
+    {
+        std::ptrdiff_t child = 2 * root + 1;
+        if (child >= n) break;
+        if (child + 1 < n && comp(first[child], first[child + 1])) child++;
+        if (!comp(value, first[child])) break;
+
+        first[root] = std::move(first[child]);
+        root = child;
+    }
+    first[root] = std::move(value);
+}
+
+template <typename RandomIt, typename Compare>
+void HeapSort(RandomIt first, RandomIt last, Compare comp)
+{
+    std::ptrdiff_t n = last - first;
+    for (std::ptrdiff_t i = n / 2 - 1; i >= 0; i--)
+    {
+        SiftDown(first, i, n, comp);
+    }
+    for (std::ptrdiff_t i = n - 1; i > 0; i--)
+    {
+        std::swap(first[0], first[i]);
+        SiftDown(first, 0, i, comp);
+    }
+}
+
+// Returns whichever of a, b, c points at the median value
+template <typename RandomIt, typename Compare>
+RandomIt Median3(RandomIt a, RandomIt b, RandomIt c, Compare comp)
+{
+    if (comp(*a, *b))
+    {
+        if (comp(*b, *c)) return b;
+        return comp(*a, *c) ? c : a;
+    }
+    if (comp(*a, *c)) return a;
+    return comp(*b, *c) ? c : b;
+}
+
+// Swaps the chosen pivot into *first. Candidates are only read, never
+// reordered, so runs that are already sorted (or reversed and flipped by the
+// previous partition) stay that way for the levels below.
+template <typename RandomIt, typename Compare>
+void MovePivotToFirst(RandomIt first, RandomIt last, Compare comp)
+{
+    std::ptrdiff_t n = last - first;
+    RandomIt mid = first + n / 2;
+    RandomIt pivot;
+
+    if (n > kNintherThreshold)
+    {
+        std::ptrdiff_t s = n / 8;
+        pivot = Median3(
+            Median3(first + 1, first + 1 + s, first + 1 + 2 * s, comp),
+            Median3(mid - s, mid, mid + s, comp),
+            Median3(last - 1 - 2 * s, last - 1 - s, last - 1, comp),
+            comp);
+    }
+    else
+    {
+        pivot = Median3(first + 1, mid, last - 1, comp);
+    }
+    std::swap(*first, *pivot);
+}
+
+// Hoare partition of [first, last) around pivot. Every element left of the
+// returned iterator is not greater than pivot and every element from it on is
+// not less. A swap only happens once both scans stopped on an out of place
+// element; equal elements stop both scans, which keeps splits balanced when
+// there are many duplicates. The scans are unguarded: an element >= pivot has
+// to sit in the range and one <= pivot at or before first. IntroSortLoop
+// samples the pivot from the range, so a candidate >= pivot is in there, and
+// keeps the pivot itself right before the range.
+template <typename RandomIt, typename T, typename Compare>
+RandomIt HoarePartition(RandomIt first, RandomIt last, const T& pivot, Compare comp)
+{
+    while (true)
+    {
+        while (comp(*first, pivot)) ++first;
+        --last;
+        while (comp(pivot, *last)) --last;
+
+        if (!(first < last)) return first;
+
+        std::swap(*first, *last);
+        ++first;
+    }
+}
+
+template <typename RandomIt, typename Compare>
+void IntroSortLoop(RandomIt first, RandomIt last, int depthLimit, Compare comp)
+{
+    while (last - first > kInsertionSortThreshold)
+    {
+        if (depthLimit == 0)
+        {
+            HeapSort(first, last, comp);
+            return;
+        }
+        depthLimit--;
+
+        MovePivotToFirst(first, last, comp);
+        RandomIt cut = HoarePartition(first + 1, last, *first, comp);
+
+        // Recurse into the smaller side, loop on the larger one, so the
+        // stack never goes deeper than log2(n) frames
+        if (cut - first < last - cut)
+        {
+            IntroSortLoop(first, cut, depthLimit, comp);
+            first = cut;
+        }
+        else
+        {
+            IntroSortLoop(cut, last, depthLimit, comp);
+            last = cut;
+        }
+    }
+    InsertionSort(first, last, comp);
+}
+
+template <typename RandomIt, typename Compare>
+void Sort(RandomIt first, RandomIt last, Compare comp)
+{
+    std::ptrdiff_t n = last - first;
+    if (n < 2) return;
+
+    int log2n = 0;
+    while ((std::ptrdiff_t(1) << (log2n + 1)) <= n) log2n++;
+
+    IntroSortLoop(first, last, 2 * log2n, comp);
+}
+
+template <typename RandomIt>
+void Sort(RandomIt first, RandomIt last)
+{
+    Sort(first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+}
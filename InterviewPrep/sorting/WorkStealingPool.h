@@ -0,0 +1,173 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts the tasks spawned into it that have not finished yet
+struct TaskGroup
+{
+    std::atomic<int> pending { 0 };
+};
+
+// Fixed size pool where every worker owns a deque. A worker pushes and pops
+// its own tasks at the back (newest first, so it keeps working on the data
+// it just touched) and, when it runs dry, steals from the front of another
+// worker's deque, which holds the oldest and therefore largest tasks.
+//
+// The thread calling Wait counts as worker 0 and runs tasks too, so a pool
+// of N threads starts N - 1 extra threads.
+class WorkStealingPool
+{
+    public:
+        explicit WorkStealingPool(int threads) : _stop(false), _sleeping(0)
+        {
+            if (threads < 1) threads = 1;
+            for (int i = 0; i < threads; i++)
+            {
+                _queues.emplace_back(new Queue());
+            }
+            for (int i = 1; i < threads; i++)
+            {
+                _threads.emplace_back([this, i]() { WorkerLoop(i); });
+            }
+        }
+
+        ~WorkStealingPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_sleepMutex);
+                _stop = true;
+            }
+            _wake.notify_all();
+            for (std::thread& thread : _threads) thread.join();
+        }
+
+        WorkStealingPool(const WorkStealingPool&) = delete;
+        WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+        int Threads() const { return static_cast<int>(_queues.size()); }
+
+        void Spawn(TaskGroup& group, std::function<void()> task)
+        {
+            group.pending.fetch_add(1, std::memory_order_relaxed);
+
+            Queue& queue = *_queues[CurrentWorker()];
+            {
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.tasks.push_back(Task { std::move(task), &group });
+            }
+            if (_sleeping.load(std::memory_order_relaxed) > 0) _wake.notify_one();
+        }
+
+        // Runs (or steals) tasks until everything spawned into group is done
+        void Wait(TaskGroup& group)
+        {
+            int self = CurrentWorker();
+            while (group.pending.load(std::memory_order_acquire) > 0)
+            {
+                if (!RunOne(self)) std::this_thread::yield();
+            }
+        }
+
+    private:
+        struct Task
+        {
+            std::function<void()> run;
+            TaskGroup* group;
+        };
+
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        // Index of the calling thread's deque, 0 for threads outside the pool
+        int CurrentWorker() const
+        {
+            return CurrentPool() == this ? CurrentIndex() : 0;
+        }
+
+        static const WorkStealingPool*& CurrentPool()
+        {
+            static thread_local const WorkStealingPool* pool = nullptr;
+            return pool;
+        }
+
+        static int& CurrentIndex()
+        {
+            static thread_local int index = 0;
+            return index;
+        }
+
+        bool PopOwn(int self, Task& task)
+        {
+            Queue& queue = *_queues[self];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) return false;
+
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            return true;
+        }
+
+        bool Steal(int self, Task& task)
+        {
+            int count = static_cast<int>(_queues.size());
+            for (int i = 1; i < count; i++)
+            {
+                Queue& queue = *_queues[(self + i) % count];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.tasks.empty()) continue;
+
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+                return true;
+            }
+            return false;
+        }
+
+        bool RunOne(int self)
+        {
+            Task task;
+            if (!PopOwn(self, task) && !Steal(self, task)) return false;
+
+            task.run();
+            task.group->pending.fetch_sub(1, std::memory_order_release);
+            return true;
+        }
+
+        void WorkerLoop(int self)
+        {
+            CurrentPool() = this;
+            CurrentIndex() = self;
+
+            while (true)
+            {
+                if (RunOne(self)) continue;
+
+                std::unique_lock<std::mutex> lock(_sleepMutex);
+                if (_stop) return;
+
+                // The timeout covers a Spawn that raced with going to sleep
+                _sleeping++;
+                _wake.wait_for(lock, std::chrono::milliseconds(1));
+                _sleeping--;
+            }
+        }
+
+        std::vector<std::unique_ptr<Queue>> _queues;
+        std::vector<std::thread> _threads;
+
+        std::mutex _sleepMutex;
+        std::condition_variable _wake;
+        bool _stop;
+        std::atomic<int> _sleeping;
+};
@@ -1 +1 @@
-g++ -std=c++14 -g -o sorts main.cpp
+g++ -std=c++14 -O2 -g -pthread -o sorts main.cpp
@@ -1,17 +1,39 @@
+#include <math.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
+#include "../../bench/Bench.h"
+#include "ExternalSort.h"
+#include "ParallelSort.h"
+#include "RadixSort.h"
+#include "Select.h"
+#include "SimdSort.h"
+#include "Sort.h"
+
 int HoarePartition(char *arr, int lo, int hi)
 {
     const char pivot = arr[(lo + hi) / 2];
-    int i = lo, j = hi;
+    int i = lo - 1, j = hi + 1;
 
     while (true)
     {
-        if (arr[i] < pivot) i++;
-        if (arr[j] > pivot) j--;
+        // Both scans stop on an element that is on the wrong side, so only
+        // out of place pairs get swapped
+        do i++; while (arr[i] < pivot);
+        do j--; while (arr[j] > pivot);
 
-        else if (i >= j)
+        if (i >= j)
             return j;
 
         std::swap(arr[i], arr[j]);
@@ -28,8 +50,576 @@ void Quicksort(char *arr, int lo, int hi)
     Quicksort(arr, part + 1, hi);
 }
 
+enum class Distribution { Random, Sorted, Reversed, FewUnique };
+
+const char *DistributionName(Distribution dist)
+{
+    switch (dist)
+    {
+        case Distribution::Random: return "random";
+        case Distribution::Sorted: return "sorted";
+        case Distribution::Reversed: return "reversed";
+        case Distribution::FewUnique: return "few unique";
+    }
+    return "?";
+}
+
+template <typename T>
+std::vector<T> MakeData(size_t n, Distribution dist, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<T> data(n);
+    for (T &v : data)
+    {
+        v = dist == Distribution::FewUnique ? (T)(rng() % 16) : (T)(rng() % 1000000000);
+    }
+    if (dist == Distribution::Sorted) std::sort(data.begin(), data.end());
+    if (dist == Distribution::Reversed) std::sort(data.begin(), data.end(), std::greater<T>());
+    return data;
+}
+
+// With expected (std::sort of input) the output has to match it element for
+// element, which also catches lost or duplicated elements; without it only
+// the order is checked
+template <typename T, typename SortFunc>
+double TimeSort(const std::vector<T> &input, SortFunc sortFunc, bool *sorted, const std::vector<T> *expected = nullptr)
+{
+    std::vector<T> data(input);
+    auto t0 = std::chrono::steady_clock::now();
+    sortFunc(data);
+    auto t1 = std::chrono::steady_clock::now();
+    *sorted = expected ? data == *expected : std::is_sorted(data.begin(), data.end());
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+template <typename T>
+void BenchmarkSort(const char *typeName, size_t n)
+{
+    const Distribution dists[] = { Distribution::Random, Distribution::Sorted, Distribution::Reversed, Distribution::FewUnique };
+    for (Distribution dist : dists)
+    {
+        std::vector<T> input = MakeData<T>(n, dist, 5);
+
+        bool okSort = false, okStd = false;
+        double sortMs = TimeSort(input, [](std::vector<T> &v) { Sort(v.begin(), v.end()); }, &okSort);
+        double stdMs = TimeSort(input, [](std::vector<T> &v) { std::sort(v.begin(), v.end()); }, &okStd);
+
+        printf("[BENCH] %-6s n = %9zu %-10s : Sort %8.2f ms, std::sort %8.2f ms %s\n",
+            typeName, n, DistributionName(dist), sortMs, stdMs, okSort && okStd ? "" : "NOT SORTED");
+    }
+}
+
+// Per element cost of the comparison sort versus radix sort across sizes, to
+// show where radix starts to win. The sorter (and its scratch) is reused for
+// every repetition like a batch job would.
+template <typename T>
+void BenchmarkRadix(const char *typeName, RadixSorter &sorter)
+{
+    for (size_t n = 1000; n <= 10000000; n *= 10)
+    {
+        std::vector<T> input = MakeData<T>(n, Distribution::Random, 9);
+        int reps = (int)std::max<size_t>(1, 10000000 / n);
+
+        bool okSort = true, okRadix = true;
+        double sortMs = 0.0, radixMs = 0.0;
+        for (int rep = 0; rep < reps; rep++)
+        {
+            bool ok = false;
+            sortMs += TimeSort(input, [](std::vector<T> &v) { Sort(v.begin(), v.end()); }, &ok);
+            okSort &= ok;
+            radixMs += TimeSort(input, [&sorter](std::vector<T> &v) { sorter.Sort(v.data(), v.size()); }, &ok);
+            okRadix &= ok;
+        }
+
+        printf("[BENCH] %-6s n = %9zu : Sort %6.2f ns/elem, Radix %6.2f ns/elem %s\n",
+            typeName, n, sortMs * 1e6 / (reps * n), radixMs * 1e6 / (reps * n),
+            okSort && okRadix ? "" : "NOT SORTED");
+    }
+}
+
+// Keys of both signs with many repeats, and the extremes at random spots:
+// the cases the RadixKey transforms exist for
+template <typename T>
+std::vector<T> MakeSignedData(size_t n, uint32_t seed)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<T> data(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        int64_t bits = (int64_t)rng();
+        if (i % 4 == 0) data[i] = (T)(bits % 3);
+        else if (std::is_floating_point<T>::value) data[i] = (T)(bits % 2000000000) / (T)1024;
+        else data[i] = (T)bits;
+    }
+
+    const T specials[] = { std::numeric_limits<T>::lowest(), std::numeric_limits<T>::max(), std::numeric_limits<T>::min(),
+                           (T)-1, (T)0.0, (T)-0.0 };
+    for (int copy = 0; copy < 4; copy++)
+    {
+        for (T special : specials) data[rng() % n] = special;
+    }
+    return data;
+}
+
+// Radix Sort and SortPairs on mixed-sign keys against std::sort and
+// std::stable_sort. Their order is told that -0.0 goes before +0.0, as
+// RadixKey puts it; results are compared bit for bit, so the two zeros
+// must come out in that order too. Pairs have to keep ties in index order.
+template <typename T>
+bool CheckRadixSigned(const char *typeName, RadixSorter &sorter)
+{
+    auto less = [](T a, T b) { return a < b || (a == b && signbit(a) && !signbit(b)); };
+    for (size_t n : { 2, 100, 5000, 100000 })
+    {
+        std::vector<T> input = MakeSignedData<T>(n, (uint32_t)n);
+        std::vector<T> expected(input);
+        std::sort(expected.begin(), expected.end(), less);
+
+        std::vector<T> data(input);
+        sorter.Sort(data.data(), n);
+        bool ok = memcmp(data.data(), expected.data(), n * sizeof(T)) == 0;
+
+        std::vector<std::pair<T, uint32_t>> pairs(n);
+        std::vector<uint32_t> index(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            pairs[i] = std::make_pair(input[i], (uint32_t)i);
+            index[i] = (uint32_t)i;
+        }
+        std::stable_sort(pairs.begin(), pairs.end(), [&](const std::pair<T, uint32_t> &a, const std::pair<T, uint32_t> &b) {
+            return less(a.first, b.first);
+        });
+        data = input;
+        sorter.SortPairs(data.data(), index.data(), n);
+        for (size_t i = 0; i < n; i++) ok &= memcmp(&data[i], &pairs[i].first, sizeof(T)) == 0 && index[i] == pairs[i].second;
+
+        if (!ok)
+        {
+            printf("[CHECK] Radix %s n = %zu, mixed signs : wrong\n", typeName, n);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Key-index pairs: radix SortPairs versus Sort over a vector of std::pair
+void BenchmarkRadixPairs(RadixSorter &sorter, size_t n)
+{
+    std::vector<uint32_t> keys = MakeData<uint32_t>(n, Distribution::Random, 13);
+
+    std::vector<std::pair<uint32_t, uint32_t>> pairs(n);
+    for (size_t i = 0; i < n; i++) pairs[i] = std::make_pair(keys[i], (uint32_t)i);
+
+    std::vector<uint32_t> index(n);
+    for (size_t i = 0; i < n; i++) index[i] = (uint32_t)i;
+
+    auto t0 = std::chrono::steady_clock::now();
+    Sort(pairs.begin(), pairs.end());
+    auto t1 = std::chrono::steady_clock::now();
+    sorter.SortPairs(keys.data(), index.data(), n);
+    auto t2 = std::chrono::steady_clock::now();
+
+    bool same = true;
+    for (size_t i = 0; i < n; i++) same &= pairs[i].first == keys[i] && pairs[i].second == index[i];
+
+    printf("[BENCH] pairs  n = %9zu : Sort %8.2f ms, Radix SortPairs %8.2f ms %s\n", n,
+        std::chrono::duration<double, std::milli>(t1 - t0).count(),
+        std::chrono::duration<double, std::milli>(t2 - t1).count(), same ? "" : "MISMATCH");
+}
+
+// Strong scaling: same input, growing pool. Keys are few-unique pairs sorted
+// on the key only, so any scheduling dependent ordering of equal keys would
+// show up as a mismatch between thread counts. Keys are compared with
+// std::sort of the input and pairs with the input as a multiset, so a lost
+// or duplicated element shows up as well.
+void BenchmarkParallelSort(size_t n)
+{
+    std::vector<int32_t> keys = MakeData<int32_t>(n, Distribution::Random, 21);
+    std::vector<int32_t> fewKeys = MakeData<int32_t>(n, Distribution::FewUnique, 22);
+    std::vector<std::pair<int32_t, int32_t>> pairs(n);
+    for (size_t i = 0; i < n; i++) pairs[i] = std::make_pair(fewKeys[i], (int32_t)i);
+    auto byKey = [](const std::pair<int32_t, int32_t> &a, const std::pair<int32_t, int32_t> &b) { return a.first < b.first; };
+
+    std::vector<int32_t> expected(keys);
+    std::sort(expected.begin(), expected.end());
+    std::vector<std::pair<int32_t, int32_t>> expectedPairs(pairs);
+    std::sort(expectedPairs.begin(), expectedPairs.end());
+
+    bool ok = false;
+    double serialMs = TimeSort(keys, [](std::vector<int32_t> &v) { Sort(v.begin(), v.end()); }, &ok, &expected);
+    printf("[BENCH] parallel n = %zu : serial Sort %8.2f ms\n", n, serialMs);
+
+    std::vector<std::pair<int32_t, int32_t>> reference;
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (int threads = 1; ; threads = std::min(threads * 2, maxThreads))
+    {
+        WorkStealingPool pool(threads);
+        double ms = TimeSort(keys, [&pool](std::vector<int32_t> &v) { ParallelSort(v.begin(), v.end(), pool); }, &ok, &expected);
+
+        std::vector<std::pair<int32_t, int32_t>> sortedPairs(pairs);
+        ParallelSort(sortedPairs.begin(), sortedPairs.end(), byKey, pool);
+        if (reference.empty()) reference = sortedPairs;
+        std::vector<std::pair<int32_t, int32_t>> permutation(sortedPairs);
+        std::sort(permutation.begin(), permutation.end());
+        ok &= std::is_sorted(sortedPairs.begin(), sortedPairs.end(), byKey) && permutation == expectedPairs;
+
+        printf("[BENCH] parallel n = %zu, %2i threads : %8.2f ms, speedup %5.2fx vs serial %s%s\n",
+            n, threads, ms, serialMs / ms, ok ? "" : "WRONG ", sortedPairs == reference ? "" : "NOT DETERMINISTIC");
+
+        if (threads == maxThreads) break;
+    }
+}
+
+// ParallelSort against std::sort, element for element, with pools larger
+// than the machine so the block partition and its fixup run even on one core
+bool CheckParallelSort()
+{
+    for (int threads : { 2, 3, 8 })
+    {
+        WorkStealingPool pool(threads);
+        for (Distribution dist : { Distribution::Random, Distribution::FewUnique, Distribution::Reversed })
+        {
+            for (size_t n : { 0, 1, 1000, 100003, 1 << 20 })
+            {
+                std::vector<int32_t> data = MakeData<int32_t>(n, dist, (uint32_t)n);
+                std::vector<int32_t> expected(data);
+                std::sort(expected.begin(), expected.end());
+                ParallelSort(data.begin(), data.end(), pool);
+                if (data != expected)
+                {
+                    printf("[CHECK] ParallelSort %i threads n = %zu, %s : wrong\n", threads, n, DistributionName(dist));
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Same quicksort structure with scalar, AVX2 and AVX-512 building blocks.
+// Levels the CPU does not support are skipped.
+template <typename T>
+void BenchmarkSimdSort(const char *typeName, size_t n)
+{
+    const Distribution dists[] = { Distribution::Random, Distribution::FewUnique };
+    const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::Avx2, SimdLevel::Avx512 };
+    SimdLevel best = DetectSimdLevel();
+
+    for (Distribution dist : dists)
+    {
+        std::vector<T> input = MakeData<T>(n, dist, 17);
+        std::vector<T> expected(input);
+        std::sort(expected.begin(), expected.end());
+
+        double scalarMs = 0.0;
+        for (SimdLevel level : levels)
+        {
+            if (level > best) break;
+
+            bool ok = false;
+            double ms = TimeSort(input, [level](std::vector<T> &v) { SimdSort(v.data(), v.size(), level); }, &ok, &expected);
+            if (level == SimdLevel::Scalar) scalarMs = ms;
+
+            printf("[BENCH] %-6s n = %9zu %-10s : %-7s %8.2f ms, %5.2fx vs scalar %s\n",
+                typeName, n, DistributionName(dist), SimdLevelName(level), ms, scalarMs / ms, ok ? "" : "WRONG");
+        }
+    }
+}
+
+// IntroSelect against McIlroy's quicksort adversary: values are fixed only
+// when a comparison needs them, in the way that makes the pivot as bad as
+// possible. The comparison count has to stay linear in n.
+bool CheckSelectAdversary()
+{
+    for (size_t n : { 1000, 10000, 100000, 1000000 })
+    {
+        const int32_t gas = (int32_t)n;
+        std::vector<int32_t> value(n, gas), items(n);
+        for (size_t i = 0; i < n; i++) items[i] = (int32_t)i;
+
+        int32_t solid = 0, candidate = -1;
+        size_t comparisons = 0;
+        auto less = [&](int32_t x, int32_t y) {
+            comparisons++;
+            if (value[x] == gas && value[y] == gas) value[x == candidate ? x : y] = solid++;
+            if (value[x] == gas) candidate = x;
+            else if (value[y] == gas) candidate = y;
+            return value[x] < value[y];
+        };
+        IntroSelect(items.begin(), items.begin() + n / 2, items.end(), less);
+        if (comparisons > 16 * n)
+        {
+            printf("[CHECK] IntroSelect adversary n = %zu : %.1f comparisons per element\n", n, (double)comparisons / n);
+            return false;
+        }
+    }
+    return true;
+}
+
+// SimdSort at every supported level against std::sort, element for element,
+// over sizes around the vector widths and odd lengths that leave tails
+template <typename T>
+bool CheckSimdSort(const char *typeName)
+{
+    const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::Avx2, SimdLevel::Avx512 };
+    const Distribution dists[] = { Distribution::Random, Distribution::FewUnique };
+    SimdLevel best = DetectSimdLevel();
+    std::vector<size_t> sizes;
+    for (size_t n = 0; n <= 130; n++) sizes.push_back(n);
+    for (size_t n : { 1000, 4097, 12345, 100003 }) sizes.push_back(n);
+
+    for (Distribution dist : dists)
+    {
+        for (size_t n : sizes)
+        {
+            std::vector<T> input = MakeData<T>(n, dist, (uint32_t)n);
+            std::vector<T> expected(input);
+            std::sort(expected.begin(), expected.end());
+            for (SimdLevel level : levels)
+            {
+                if (level > best) break;
+                std::vector<T> data(input);
+                SimdSort(data.data(), data.size(), level);
+                if (data != expected)
+                {
+                    printf("[CHECK] SimdSort %s %s n = %zu, %s : wrong\n", SimdLevelName(level), typeName, n, DistributionName(dist));
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// IntroSelect (also with the median-of-medians pivot from the start),
+// PartialSort and StreamingTopK against a full sort, over every distribution
+// and a spread of sizes and ranks
+template <typename T>
+bool CheckSelect()
+{
+    const Distribution dists[] = { Distribution::Random, Distribution::Sorted, Distribution::Reversed, Distribution::FewUnique };
+    std::mt19937 rng(3);
+    for (Distribution dist : dists)
+    {
+        for (size_t n : { 1, 2, 5, 24, 25, 100, 1000, 100000 })
+        {
+            std::vector<T> input = MakeData<T>(n, dist, (uint32_t)n);
+            std::vector<T> sorted(input);
+            std::sort(sorted.begin(), sorted.end());
+
+            for (int trial = 0; trial < 8; trial++)
+            {
+                size_t k = trial == 0 ? 0 : trial == 1 ? n - 1 : rng() % n;
+                for (bool medianOfMedians : { false, true })
+                {
+                    std::vector<T> data(input);
+                    if (!medianOfMedians) IntroSelect(data.begin(), data.begin() + k, data.end());
+                    else IntroSelectLoop(data.begin(), data.begin() + k, data.end(), true, std::less<T>());
+
+                    bool ok = data[k] == sorted[k];
+                    for (size_t i = 0; i < k; i++) ok &= !(data[k] < data[i]);
+                    for (size_t i = k + 1; i < n; i++) ok &= !(data[i] < data[k]);
+                    if (!ok)
+                    {
+                        printf("[CHECK] IntroSelect%s n = %zu, k = %zu, %s : wrong\n", medianOfMedians ? " (median of medians)" : "", n, k, DistributionName(dist));
+                        return false;
+                    }
+                }
+
+                std::vector<T> data(input);
+                PartialSort(data.begin(), data.begin() + k, data.end());
+                StreamingTopK<T> smallest(k);
+                smallest.Push(input.begin(), input.end());
+                StreamingTopK<T, std::greater<T>> largest(k);
+                largest.Push(input.begin(), input.end());
+                std::vector<T> top = largest.Sorted();
+                if (!std::equal(data.begin(), data.begin() + k, sorted.begin()) || smallest.Sorted() != std::vector<T>(sorted.begin(), sorted.begin() + k)
+                    || !std::equal(top.begin(), top.end(), sorted.rbegin()))
+                {
+                    printf("[CHECK] top %zu of n = %zu, %s : wrong\n", k, n, DistributionName(dist));
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Per element cost of finding the median and the 100 smallest, against a
+// full Sort, as n grows. Selection should stay flat, sorting grows with log n.
+template <typename T>
+void BenchmarkSelect(const char *typeName)
+{
+    const size_t k = 100;
+    for (size_t n = 10000; n <= 10000000; n *= 10)
+    {
+        std::vector<T> input = MakeData<T>(n, Distribution::Random, 19);
+        int reps = (int)std::max<size_t>(1, 10000000 / n);
+
+        double sortNs = 0, selectNs = 0, momNs = 0, stdNs = 0, partialNs = 0, streamNs = 0;
+        bool ok = true;
+        auto nsPerElem = [&](std::chrono::steady_clock::time_point since) {
+            return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - since).count() / (reps * n);
+        };
+        std::vector<T> data;
+        for (int rep = 0; rep < reps; rep++)
+        {
+            data = input;
+            auto t = std::chrono::steady_clock::now();
+            Sort(data.begin(), data.end());
+            sortNs += nsPerElem(t);
+            const T median = data[n / 2], kth = data[k - 1];
+
+            data = input;
+            t = std::chrono::steady_clock::now();
+            IntroSelect(data.begin(), data.begin() + n / 2, data.end());
+            selectNs += nsPerElem(t);
+            ok &= data[n / 2] == median;
+
+            data = input;
+            t = std::chrono::steady_clock::now();
+            IntroSelectLoop(data.begin(), data.begin() + n / 2, data.end(), true, std::less<T>());
+            momNs += nsPerElem(t);
+            ok &= data[n / 2] == median;
+
+            data = input;
+            t = std::chrono::steady_clock::now();
+            std::nth_element(data.begin(), data.begin() + n / 2, data.end());
+            stdNs += nsPerElem(t);
+
+            data = input;
+            t = std::chrono::steady_clock::now();
+            PartialSort(data.begin(), data.begin() + k, data.end());
+            partialNs += nsPerElem(t);
+            ok &= data[k - 1] == kth;
+
+            t = std::chrono::steady_clock::now();
+            StreamingTopK<T> top(k);
+            top.Push(input.begin(), input.end());
+            streamNs += nsPerElem(t);
+            ok &= top.Threshold() == kth;
+        }
+
+        printf("[BENCH] %-6s n = %9zu : Sort %6.2f, median IntroSelect %5.2f, median of medians only %5.2f, std::nth_element %5.2f, "
+            "top %zu PartialSort %5.2f, StreamingTopK %5.2f ns/elem %s\n", typeName, n, sortNs, selectNs, momNs, stdNs,
+            k, partialNs, streamNs, ok ? "" : "WRONG");
+    }
+}
+
+// 16 byte records: an 8 byte key and the index of the record in the input
+struct ExternalRecord
+{
+    uint64_t key;
+    uint64_t index;
+
+    bool operator<(const ExternalRecord &other) const { return key < other.key; }
+};
+
+// Writes totalBytes of random records, sorts them to a second file with a
+// fraction of that as memory budget, and checks the output is a sorted
+// permutation (same count, same key sum). Files go to TMPDIR, /tmp if unset.
+void BenchmarkExternalSort(size_t totalBytes, size_t memoryBudget, bool directIO)
+{
+    const char *tmp = getenv("TMPDIR");
+    const std::string tempDir = tmp && *tmp ? tmp : "/tmp";
+    const std::string in = tempDir + "/external.in";
+    const std::string out = tempDir + "/external.out";
+    const char *inPath = in.c_str();
+    const char *outPath = out.c_str();
+    const size_t n = totalBytes / sizeof(ExternalRecord);
+
+    std::mt19937_64 rng(31);
+    uint64_t keySum = 0;
+    FILE *file = fopen(inPath, "wb");
+    if (!file) return;
+    std::vector<ExternalRecord> batch(1 << 16);
+    for (size_t written = 0; written < n; written += batch.size())
+    {
+        size_t count = std::min(batch.size(), n - written);
+        for (size_t i = 0; i < count; i++)
+        {
+            batch[i].key = rng();
+            batch[i].index = written + i;
+            keySum += batch[i].key;
+        }
+        fwrite(batch.data(), sizeof(ExternalRecord), count, file);
+    }
+    fclose(file);
+
+    ExternalSortConfig config;
+    config.memoryBudget = memoryBudget;
+    config.directIO = directIO;
+    config.tempDir = tempDir;
+    ExternalSortStats stats;
+    bool ok = ExternalSort<ExternalRecord>(inPath, outPath, config, &stats);
+
+    size_t count = 0;
+    uint64_t outSum = 0, previous = 0;
+    file = fopen(outPath, "rb");
+    if (file)
+    {
+        size_t got;
+        while ((got = fread(batch.data(), sizeof(ExternalRecord), batch.size(), file)) > 0)
+        {
+            for (size_t i = 0; i < got; i++)
+            {
+                ok &= batch[i].key >= previous;
+                previous = batch[i].key;
+                outSum += batch[i].key;
+            }
+            count += got;
+        }
+        fclose(file);
+    }
+    ok &= count == n && outSum == keySum;
+
+    printf("[BENCH] external %zu MB, budget %zu MB%s : %2i runs, %i merge passes, runs %6.2f s, merge %6.2f s, %5.2f GB/s %s\n",
+        totalBytes >> 20, memoryBudget >> 20, directIO ? ", O_DIRECT" : "", stats.runs, stats.mergePasses,
+        stats.runSeconds, stats.mergeSeconds, stats.GBps(), ok ? "" : "FAILED");
+
+    remove(inPath);
+    remove(outPath);
+}
+
+// Regression suite for bench/run.sh: one fixed size per sorter, small
+// enough to repeat
+int RunBenchSuite()
+{
+    BenchSuite suite("sorts");
+    const size_t n = 1 << 20;
+    std::vector<int32_t> input = MakeData<int32_t>(n, Distribution::Random, 5);
+    std::vector<int32_t> data;
+    auto reset = [&] { data = input; };
+
+    suite.Run("Sort int32 random", n, reset, [&] { Sort(data.begin(), data.end()); });
+    suite.Run("std::sort int32 random", n, reset, [&] { std::sort(data.begin(), data.end()); });
+
+    std::vector<int32_t> sorted = input;
+    std::sort(sorted.begin(), sorted.end());
+    suite.Run("Sort int32 sorted", n, [&] { data = sorted; }, [&] { Sort(data.begin(), data.end()); });
+
+    suite.Run("IntroSelect int32 median", n, reset, [&] { IntroSelect(data.begin(), data.begin() + n / 2, data.end()); });
+    suite.Run("PartialSort int32 top 100", n, reset, [&] { PartialSort(data.begin(), data.begin() + 100, data.end()); });
+    suite.Run("StreamingTopK int32 top 100", n, [&] {
+        StreamingTopK<int32_t> top(100);
+        top.Push(input.begin(), input.end());
+        BenchKeep(top.Threshold());
+    });
+
+    RadixSorter sorter;
+    suite.Run("Radix int32 random", n, reset, [&] { sorter.Sort(data.data(), data.size()); });
+    suite.Run("SimdSort int32 random", n, reset, [&] { SimdSort(data.data(), data.size()); });
+
+    WorkStealingPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    suite.Run("ParallelSort int32 random", n, reset, [&] { ParallelSort(data.begin(), data.end(), pool); });
+
+    return suite.Finish();
+}
+
 int main(int argc, char **argv)
 {
+    if (BenchSuite::Requested(argc, argv)) return RunBenchSuite();
+
     printf("[MAIN] Sorting data using Quicksort\n");
 
     std::vector<char> nums { 6, 22, 14, 78, 99, 30, 44, 59, 21, 17 };
@@ -48,5 +638,50 @@ int main(int argc, char **argv)
     }
     printf("\n\n");
 
+    printf("[MAIN] Sorting data using the generic introsort\n");
+    std::vector<double> reals { 3.5, -1.25, 8.0, 0.5, 2.75, -7.5, 4.0 };
+    Sort(reals.begin(), reals.end(), std::greater<double>());
+    printf("[MAIN] Doubles, descending : \n");
+    for (const double& r : reals)
+    {
+        printf(" %.2f ", r);
+    }
+    printf("\n\n");
+
+    printf("[MAIN] Selection checked against a full sort and a quicksort adversary : %s\n",
+        CheckSelect<int32_t>() && CheckSelect<float>() && CheckSelect<int64_t>() && CheckSelectAdversary() ? "OK" : "FAILED");
+
+    BenchmarkSort<int32_t>("int32", 1 << 22);
+    BenchmarkSort<float>("float", 1 << 22);
+    BenchmarkSort<int64_t>("int64", 1 << 22);
+
+    BenchmarkSelect<int32_t>("int32");
+    BenchmarkSelect<double>("double");
+
+    RadixSorter sorter;
+    printf("[MAIN] Radix sort on mixed-sign keys checked against std::sort : %s\n",
+        CheckRadixSigned<int32_t>("int32", sorter) && CheckRadixSigned<int64_t>("int64", sorter)
+        && CheckRadixSigned<float>("float", sorter) && CheckRadixSigned<double>("double", sorter) ? "OK" : "FAILED");
+    BenchmarkRadix<uint8_t>("uint8", sorter);
+    BenchmarkRadix<int32_t>("int32", sorter);
+    BenchmarkRadix<float>("float", sorter);
+    BenchmarkRadix<int64_t>("int64", sorter);
+    BenchmarkRadixPairs(sorter, 1 << 22);
+    printf("[MAIN] Radix scratch kept between calls : %zu bytes\n", sorter.ScratchBytes());
+
+    printf("[MAIN] ParallelSort checked against std::sort : %s\n", CheckParallelSort() ? "OK" : "FAILED");
+    BenchmarkParallelSort(1 << 24);
+
+    printf("[MAIN] SimdSort checked against std::sort : %s\n", CheckSimdSort<int32_t>("int32") && CheckSimdSort<float>("float") ? "OK" : "FAILED");
+    BenchmarkSimdSort<int32_t>("int32", 1 << 22);
+    BenchmarkSimdSort<float>("float", 1 << 22);
+
+    // External sort input in MB, first argument. The default is small enough
+    // for any TMPDIR; the last budget is too small for a single merge pass.
+    const size_t externalMB = std::max<long long>(1, argc > 1 ? atoll(argv[1]) : 16);
+    BenchmarkExternalSort(externalMB << 20, std::max<size_t>(1, externalMB / 8) << 20, false);
+    BenchmarkExternalSort(externalMB << 20, std::max<size_t>(1, externalMB / 8) << 20, true);
+    BenchmarkExternalSort(std::max<size_t>(1, externalMB / 4) << 20, size_t(1) << 20, false);
+
     return 0;
 }
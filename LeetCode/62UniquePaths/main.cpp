@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include <map>
 
+#include "../../bench/Bench.h"
+
 std::map<long, std::map<long, long>> cache;
 
 long uniquePathsImpl(long cm, long cn)
@@ -34,8 +36,28 @@ long uniquePaths(long m, long n)
     return uniquePathsImpl(m - 1, n - 1);
 }
 
+// A cold cache every call, so the suite times the memoized recursion itself
+int RunBenchSuite()
+{
+    BenchSuite suite("UniquePaths");
+    suite.Run("uniquePaths 30x30 cold", 30 * 30, [] { cache.clear(); }, [] {
+        long result = uniquePaths(30, 30);
+        BenchKeep(result);
+    });
+    suite.Run("uniquePaths 30x30 cached", 10000, [] {
+        for (int i = 0; i < 10000; i++)
+        {
+            long result = uniquePaths(30, 30);
+            BenchKeep(result);
+        }
+    });
+    return suite.Finish();
+}
+
 int main(int argc, char** argv)
 {
+    if (BenchSuite::Requested(argc, argv)) return RunBenchSuite();
+
     if (argc == 3)
     {
         long result = uniquePaths(atoi(argv[1]), atoi(argv[2]));
@@ -6,6 +6,9 @@
 #include <string.h>
 #include <vector>
 #include <limits>
+#include <random>
+
+#include "../../bench/Bench.h"
 
 int taille_ = 0;
 int* entiers_ = nullptr;
@@ -26,7 +29,32 @@ void supprimeEntiers(const std::vector<int>& index)
     taille_ -= local.size();
 }
 
+// Removes 256 random indices from 64K integers. supprimeEntiers moves one
+// element past the end, so the buffer keeps two spare slots.
+int RunBenchSuite() {
+    BenchSuite suite("tp1");
+    const int n = 1 << 16;
+    std::vector<int> source(n + 2), buffer(n + 2);
+    for (int i = 0; i < n; i++) source[i] = i;
+
+    std::mt19937 rng(5);
+    std::vector<int> index;
+    for (int i = 0; i < 256; i++) index.push_back(rng() % n);
+
+    suite.Run("supprimeEntiers 256 of 64K", index.size(), [&] {
+        buffer = source;
+        entiers_ = buffer.data();
+        taille_ = n;
+    }, [&] {
+        supprimeEntiers(index);
+    });
+    entiers_ = nullptr;
+    return suite.Finish();
+}
+
 int main(int argc, char** argv) {
+    if (BenchSuite::Requested(argc, argv)) return RunBenchSuite();
+
     taille_ = 10;
     entiers_ = new int[10];
     entiers_[0] = 0;
@@ -0,0 +1,385 @@
+#pragma once
+
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Header only benchmark harness shared by the exercises. A BenchSuite runs
+// named regions with warmup and repetitions, measures wall clock time and,
+// when the PMU is reachable, cycles / instructions / cache misses / branch
+// misses / dTLB load misses of the calling thread, prints a [BENCH] line per region and writes
+// the results as JSON for bench/compare to check against a baseline.
+//
+// Each exercise main starts with
+//     if (BenchSuite::Requested(argc, argv)) return RunBenchSuite();
+// so the usual output is untouched. A suite runs when BENCH_JSON names the
+// results file (bench/run.sh sets it) or when --bench is passed.
+//
+// Environment:
+//   BENCH_JSON        where to write the results, one region per line
+//   BENCH_REPETITIONS timed repetitions per region (default 15)
+//   BENCH_WARMUP      untimed repetitions before them (default 2)
+
+// Index of each counter in CounterValues
+enum BenchCounter
+{
+    kBenchCycles,
+    kBenchInstructions,
+    kBenchCacheMisses,
+    kBenchBranchMisses,
+    kBenchDtlbMisses,
+    kBenchCounterCount,
+};
+
+inline const char *BenchCounterName(int counter)
+{
+    static const char *names[kBenchCounterCount] = { "cycles", "instructions", "cache_misses", "branch_misses", "dtlb_load_misses" };
+    return names[counter];
+}
+
+// -1 where a counter could not be opened or read
+struct CounterValues
+{
+    long long value[kBenchCounterCount];
+
+    CounterValues() { for (long long &v : value) v = -1; }
+};
+
+// The hardware counters as one perf event group, so they are scheduled
+// onto the PMU together and cover the same instructions. Counts are scaled
+// up when the kernel had to multiplex the group. Without a PMU (VMs,
+// perf_event_paranoid > 2, ...) every value stays -1.
+class PerfCounters
+{
+    public:
+        PerfCounters()
+        {
+            static const uint32_t types[kBenchCounterCount] = {
+                PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+            };
+            static const uint64_t configs[kBenchCounterCount] = {
+                PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+                PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            };
+            for (int c = 0; c < kBenchCounterCount; c++)
+            {
+                perf_event_attr attr;
+                memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = types[c];
+                attr.config = configs[c];
+                attr.disabled = _leader < 0 ? 1 : 0;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+                _fd[c] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, _leader, 0);
+                if (_fd[c] < 0) continue;
+
+                // Without its id a counter cannot be found in the group read.
+                // The leader only counts once it has one too; until then the
+                // next counter tries to lead.
+                if (ioctl(_fd[c], PERF_EVENT_IOC_ID, &_id[c]) != 0)
+                {
+                    close(_fd[c]);
+                    _fd[c] = -1;
+                    continue;
+                }
+                if (_leader < 0) _leader = _fd[c];
+            }
+        }
+
+        ~PerfCounters()
+        {
+            for (int c = kBenchCounterCount - 1; c >= 0; c--)
+            {
+                if (_fd[c] >= 0) close(_fd[c]);
+            }
+        }
+
+        PerfCounters(const PerfCounters &) = delete;
+        PerfCounters &operator=(const PerfCounters &) = delete;
+
+        bool Available() const { return _leader >= 0; }
+
+        void Start()
+        {
+            if (_leader < 0) return;
+            ioctl(_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+
+        CounterValues Stop()
+        {
+            CounterValues values;
+            if (_leader < 0) return values;
+            ioctl(_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+            // nr, time enabled, time running, then (value, id) per event
+            uint64_t buffer[3 + 2 * kBenchCounterCount];
+            ssize_t got = read(_leader, buffer, sizeof(buffer));
+            if (got < (ssize_t)(3 * sizeof(uint64_t)) || buffer[2] == 0) return values;
+
+            const double scale = (double)buffer[1] / buffer[2];
+            for (uint64_t e = 0; e < buffer[0] && e < kBenchCounterCount; e++)
+            {
+                for (int c = 0; c < kBenchCounterCount; c++)
+                {
+                    if (_fd[c] >= 0 && _id[c] == buffer[4 + 2 * e]) values.value[c] = (long long)(buffer[3 + 2 * e] * scale + 0.5);
+                }
+            }
+            return values;
+        }
+
+    private:
+        int _fd[kBenchCounterCount] = { -1, -1, -1, -1, -1 };
+        uint64_t _id[kBenchCounterCount] = {};
+        int _leader = -1;
+};
+
+struct BenchOptions
+{
+    int warmup = 2;
+    int repetitions = 15;
+};
+
+// Samples of one region and the statistics reported for it
+struct BenchResult
+{
+    std::string name;
+    double items = 0.0; // work per repetition (elements, queries, rays ...), 0 if not given
+    std::vector<double> ns;
+    std::vector<CounterValues> counters;
+    bool printed = false;
+
+    // Nearest rank percentile of the wall clock samples
+    double Percentile(double p) const
+    {
+        if (ns.empty()) return 0.0;
+        std::vector<double> sorted(ns);
+        std::sort(sorted.begin(), sorted.end());
+        size_t rank = (size_t)(p * sorted.size() + 0.999999);
+        return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+    }
+
+    double Median() const { return Percentile(0.5); }
+    double P99() const { return Percentile(0.99); }
+    double Min() const { return ns.empty() ? 0.0 : *std::min_element(ns.begin(), ns.end()); }
+    double Mean() const
+    {
+        double sum = 0.0;
+        for (double v : ns) sum += v;
+        return ns.empty() ? 0.0 : sum / ns.size();
+    }
+
+    // Median of one counter over the repetitions, -1 if it was never read
+    long long Counter(int counter) const
+    {
+        std::vector<long long> values;
+        for (const CounterValues &c : counters)
+        {
+            if (c.value[counter] >= 0) values.push_back(c.value[counter]);
+        }
+        if (values.empty()) return -1;
+        std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+        return values[values.size() / 2];
+    }
+};
+
+// Keeps the compiler from dropping a result that is otherwise unused
+template <typename T>
+inline void BenchKeep(const T &value)
+{
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+class BenchSuite
+{
+    public:
+        static bool Requested(int argc, char **argv)
+        {
+            for (int i = 1; i < argc; i++)
+            {
+                if (strcmp(argv[i], "--bench") == 0) return true;
+            }
+            return getenv("BENCH_JSON") != nullptr;
+        }
+
+        explicit BenchSuite(const char *suiteName, const BenchOptions &options = BenchOptions())
+            : _suite(suiteName), _options(options)
+        {
+            if (const char *reps = getenv("BENCH_REPETITIONS")) _options.repetitions = std::max(1, atoi(reps));
+            if (const char *warmup = getenv("BENCH_WARMUP")) _options.warmup = std::max(0, atoi(warmup));
+            if (!_counters.Available())
+            {
+                printf("[BENCH] %s : hardware counters unavailable, timing only\n", suiteName);
+            }
+        }
+
+        // fn() is the timed region, items the work it does per call
+        template <typename Fn>
+        const BenchResult &Run(const char *name, double items, Fn fn)
+        {
+            return Run(name, items, [] {}, fn);
+        }
+
+        // setup() runs untimed before every call of fn(), e.g. to restore
+        // the unsorted input
+        template <typename Setup, typename Fn>
+        const BenchResult &Run(const char *name, double items, Setup setup, Fn fn)
+        {
+            for (int i = 0; i < _options.warmup; i++)
+            {
+                setup();
+                fn();
+            }
+
+            BenchResult &result = Result(name);
+            result.items = items;
+            for (int i = 0; i < _options.repetitions; i++)
+            {
+                setup();
+                _counters.Start();
+                auto t0 = std::chrono::steady_clock::now();
+                fn();
+                auto t1 = std::chrono::steady_clock::now();
+                CounterValues counters = _counters.Stop();
+                Record(result, std::chrono::duration<double, std::nano>(t1 - t0).count(), counters);
+            }
+            Print(result);
+            return result;
+        }
+
+        // Adds one sample to a region, for code timed in place by BenchRegion
+        void Record(const char *name, double ns, const CounterValues &counters, double items = 0.0)
+        {
+            BenchResult &result = Result(name);
+            if (items > 0.0) result.items = items;
+            Record(result, ns, counters);
+        }
+
+        PerfCounters &Counters() { return _counters; }
+
+        // Prints the regions only timed through BenchRegion and writes
+        // BENCH_JSON. Returns the process exit code.
+        int Finish()
+        {
+            for (BenchResult &result : _results)
+            {
+                if (!result.printed) Print(result);
+            }
+
+            const char *path = getenv("BENCH_JSON");
+            if (!path) return 0;
+            FILE *file = fopen(path, "w");
+            if (!file)
+            {
+                printf("[BENCH] Could not write %s\n", path);
+                return 1;
+            }
+
+            fprintf(file, "{\"suite\": \"%s\", \"results\": [\n", _suite.c_str());
+            for (size_t i = 0; i < _results.size(); i++)
+            {
+                const BenchResult &r = _results[i];
+                fprintf(file, "{\"name\": \"%s\", \"repetitions\": %zu, \"median_ns\": %.1f, \"p99_ns\": %.1f, \"min_ns\": %.1f, \"mean_ns\": %.1f, \"items\": %.0f",
+                    r.name.c_str(), r.ns.size(), r.Median(), r.P99(), r.Min(), r.Mean(), r.items);
+                for (int c = 0; c < kBenchCounterCount; c++)
+                {
+                    long long value = r.Counter(c);
+                    if (value >= 0) fprintf(file, ", \"%s\": %lld", BenchCounterName(c), value);
+                    else fprintf(file, ", \"%s\": null", BenchCounterName(c));
+                }
+                fprintf(file, "}%s\n", i + 1 < _results.size() ? "," : "");
+            }
+            fprintf(file, "]}\n");
+            bool ok = fclose(file) == 0;
+            printf("[BENCH] %s : %zu regions written to %s\n", _suite.c_str(), _results.size(), path);
+            return ok ? 0 : 1;
+        }
+
+    private:
+        BenchResult &Result(const char *name)
+        {
+            for (BenchResult &result : _results)
+            {
+                if (result.name == name) return result;
+            }
+            _results.emplace_back();
+            _results.back().name = name;
+            return _results.back();
+        }
+
+        void Record(BenchResult &result, double ns, const CounterValues &counters)
+        {
+            result.ns.push_back(ns);
+            result.counters.push_back(counters);
+        }
+
+        void Print(BenchResult &r) const
+        {
+            r.printed = true;
+            char perItem[48] = "";
+            if (r.items > 0.0) snprintf(perItem, sizeof(perItem), ", %8.2f ns/item", r.Median() / r.items);
+
+            char counters[128] = "";
+            long long cycles = r.Counter(kBenchCycles), instructions = r.Counter(kBenchInstructions);
+            if (cycles > 0 && instructions >= 0)
+            {
+                snprintf(counters, sizeof(counters), ", IPC %4.2f, cache misses %lld, branch misses %lld, dTLB misses %lld",
+                    (double)instructions / cycles, r.Counter(kBenchCacheMisses), r.Counter(kBenchBranchMisses), r.Counter(kBenchDtlbMisses));
+            }
+
+            // Milliseconds unless the region is too short to show in them
+            const bool us = r.Median() < 1e5;
+            const double scale = us ? 1e-3 : 1e-6;
+            printf("[BENCH] %s/%-32s : median %10.3f %s, p99 %10.3f %s (%zu reps)%s%s\n", _suite.c_str(), r.name.c_str(),
+                r.Median() * scale, us ? "us" : "ms", r.P99() * scale, us ? "us" : "ms", r.ns.size(), perItem, counters);
+        }
+
+        std::string _suite;
+        BenchOptions _options;
+        PerfCounters _counters;
+        std::deque<BenchResult> _results; // Run hands out references, they must stay put
+};
+
+// Times the enclosing scope as one sample of a region, for code that is
+// measured where it runs instead of through BenchSuite::Run. Regions do not
+// nest: the suite has a single counter group.
+class BenchRegion
+{
+    public:
+        BenchRegion(BenchSuite &suite, const char *name, double items = 0.0)
+            : _suite(suite), _name(name), _items(items)
+        {
+            _suite.Counters().Start();
+            _start = std::chrono::steady_clock::now();
+        }
+
+        ~BenchRegion()
+        {
+            auto end = std::chrono::steady_clock::now();
+            CounterValues counters = _suite.Counters().Stop();
+            _suite.Record(_name, std::chrono::duration<double, std::nano>(end - _start).count(), counters, _items);
+        }
+
+        BenchRegion(const BenchRegion &) = delete;
+        BenchRegion &operator=(const BenchRegion &) = delete;
+
+    private:
+        BenchSuite &_suite;
+        const char *_name;
+        double _items;
+        std::chrono::steady_clock::time_point _start;
+};
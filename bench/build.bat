@@ -0,0 +1 @@
+g++ -std=c++14 -O2 -g -o compare compare.cpp
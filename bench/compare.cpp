@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// Compares two result files written by BenchSuite (BENCH_JSON) region by
+// region and fails when one got slower than the threshold allows:
+//
+//     compare baseline.json current.json [--threshold 0.10] [--metric median_ns]
+//
+// Any numeric field of the results can be the metric; instructions is the
+// steadiest where hardware counters are available. Regions missing from
+// either side are listed but do not fail the comparison.
+// Exit code: 0 no regression, 1 regression, 2 bad arguments or input.
+
+struct Region
+{
+    std::string name;
+    std::map<std::string, double> values; // null fields are left out
+};
+
+// BenchSuite writes one region per line, so a line scanner is enough
+bool ReadResults(const char *path, std::vector<Region> &regions)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        printf("[COMPARE] Could not open %s\n", path);
+        return false;
+    }
+
+    char line[4096];
+    while (fgets(line, sizeof(line), file))
+    {
+        const char *name = strstr(line, "{\"name\": \"");
+        if (!name) continue;
+        name += strlen("{\"name\": \"");
+        const char *nameEnd = strchr(name, '"');
+        if (!nameEnd) continue;
+
+        Region region;
+        region.name.assign(name, nameEnd);
+        for (const char *p = strstr(nameEnd + 1, ", \""); p; p = strstr(p + 1, ", \""))
+        {
+            const char *key = p + 3;
+            const char *keyEnd = strchr(key, '"');
+            if (!keyEnd || strncmp(keyEnd, "\": ", 3) != 0) continue;
+            char *end = nullptr;
+            double value = strtod(keyEnd + 3, &end);
+            if (end != keyEnd + 3) region.values[std::string(key, keyEnd)] = value;
+        }
+        regions.push_back(region);
+    }
+    fclose(file);
+    return true;
+}
+
+const Region *Find(const std::vector<Region> &regions, const std::string &name)
+{
+    for (const Region &region : regions)
+    {
+        if (region.name == name) return &region;
+    }
+    return nullptr;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        printf("usage: compare baseline.json current.json [--threshold 0.10] [--metric median_ns]\n");
+        return 2;
+    }
+
+    double threshold = 0.10;
+    std::string metric = "median_ns";
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--threshold") == 0) threshold = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--metric") == 0) metric = argv[i + 1];
+        else
+        {
+            printf("[COMPARE] Unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    std::vector<Region> baseline, current;
+    if (!ReadResults(argv[1], baseline) || !ReadResults(argv[2], current)) return 2;
+
+    int regressions = 0, compared = 0;
+    for (const Region &now : current)
+    {
+        const Region *before = Find(baseline, now.name);
+        if (!before)
+        {
+            printf("[COMPARE] %-40s : new, no baseline\n", now.name.c_str());
+            continue;
+        }
+
+        auto b = before->values.find(metric), c = now.values.find(metric);
+        if (b == before->values.end() || c == now.values.end() || b->second <= 0.0)
+        {
+            printf("[COMPARE] %-40s : no %s on both sides\n", now.name.c_str(), metric.c_str());
+            continue;
+        }
+
+        compared++;
+        double change = c->second / b->second - 1.0;
+        bool regressed = change > threshold;
+        regressions += regressed;
+        printf("[COMPARE] %-40s : %s %14.1f -> %14.1f (%+6.1f%%) %s\n", now.name.c_str(), metric.c_str(),
+            b->second, c->second, change * 100.0, regressed ? "REGRESSION" : "");
+    }
+    for (const Region &before : baseline)
+    {
+        if (!Find(current, before.name)) printf("[COMPARE] %-40s : missing from the current run\n", before.name.c_str());
+    }
+
+    printf("[COMPARE] %d of %d regions slower than +%.0f%% on %s\n", regressions, compared, threshold * 100.0, metric.c_str());
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+#!/bin/sh
+# Builds every exercise, runs its benchmark suite and compares the results to
+# bench/baselines/<target>.json. Fails when any region regressed.
+#
+#   bench/run.sh [--update] [--threshold 0.10] [--metric median_ns] [target ...]
+#
+# --update rewrites the baselines from this run; a target without a baseline
+# gets one written and is not compared. Baselines only mean something on the
+# machine that wrote them and are not checked in. BENCH_REPETITIONS and
+# BENCH_WARMUP pass through to the suites.
+
+set -u
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+bench="$root/bench"
+out="$bench/out"
+mkdir -p "$out" "$bench/baselines"
+
+update=0
+threshold=0.10
+metric=median_ns
+selected=""
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --update) update=1 ;;
+        --threshold) threshold="$2"; shift ;;
+        --metric) metric="$2"; shift ;;
+        *) selected="$selected $1" ;;
+    esac
+    shift
+done
+
+# target | source, relative to the repo root | compiler flags
+targets="
+sorts|InterviewPrep/sorting/main.cpp|-std=c++14 -O2 -g -pthread
+segment|InterviewPrep/SegmentTree/main.cpp|-std=c++14 -O2 -g -pthread
+cputracer|D3D12RTSnippets/cpu/main.cpp|-std=c++14 -O2 -g -pthread
+tp1|LeetCode/tp1/main.cpp|-std=c++14 -O2 -g
+UniquePaths|LeetCode/62UniquePaths/main.cpp|-std=c++14 -O2 -g
+observer|second/observer.cpp|-std=c++14 -O2 -g
+singleton|second/singleton.cpp|-std=c++14 -O2 -g
+"
+
+g++ -std=c++14 -O2 -g -o "$out/compare" "$bench/compare.cpp" || exit 2
+
+failed=""
+for entry in $(echo "$targets" | tr ' ' '~'); do
+    name=${entry%%|*}
+    rest=${entry#*|}
+    source=${rest%%|*}
+    flags=$(echo "${rest#*|}" | tr '~' ' ')
+
+    if [ -n "$selected" ] && ! echo " $selected " | grep -q " $name "; then
+        continue
+    fi
+
+    echo "[RUN] $name"
+    if ! g++ $flags -o "$out/$name" "$root/$source"; then
+        failed="$failed $name(build)"
+        continue
+    fi
+    # Run from bench/out, so the images cputracer writes stay out of the tree
+    if ! (cd "$out" && BENCH_JSON="$out/$name.json" "$out/$name" > "$out/$name.log"); then
+        failed="$failed $name(run)"
+        continue
+    fi
+    grep '^\[BENCH\]' "$out/$name.log"
+
+    baseline="$bench/baselines/$name.json"
+    if [ $update -eq 1 ] || [ ! -f "$baseline" ]; then
+        cp "$out/$name.json" "$baseline"
+        echo "[RUN] $name : baseline written to bench/baselines/$name.json"
+    elif ! "$out/compare" "$baseline" "$out/$name.json" --threshold "$threshold" --metric "$metric"; then
+        failed="$failed $name"
+    fi
+done
+
+if [ -n "$failed" ]; then
+    echo "[RUN] FAILED:$failed"
+    exit 1
+fi
+echo "[RUN] OK"
@@ -2,6 +2,8 @@
 #include <vector>
 #include <algorithm>
 
+#include "../bench/Bench.h"
+
 class Observer {
     public:
         virtual ~Observer() = default;
@@ -100,8 +102,46 @@ class AwayPanel : public Observer
         MatchState* _state;
 };
 
+// Counts updates instead of printing, so notify itself is what gets timed
+class CountingPanel : public Observer
+{
+    public:
+        virtual void update() override { _updates++; }
+
+        long getUpdates() const { return _updates; }
+
+    private:
+        long _updates = 0;
+};
+
+int RunBenchSuite()
+{
+    BenchSuite suite("observer");
+    const int notifications = 10000;
+
+    MatchState state;
+    std::vector<CountingPanel> panels(64);
+    for (auto& panel : panels) state.attach(&panel);
+
+    suite.Run("notify 64 observers", notifications * panels.size(), [&] {
+        for (int i = 0; i < notifications; i++) state.updateHomeScore(1);
+    });
+    suite.Run("attach + detach 64 observers", 1000 * panels.size(), [&] {
+        for (int round = 0; round < 1000; round++)
+        {
+            for (auto& panel : panels) state.detach(&panel);
+            for (auto& panel : panels) state.attach(&panel);
+        }
+    });
+
+    BenchKeep(panels[0].getUpdates());
+    return suite.Finish();
+}
+
 int main(int argc, char** argv)
 {
+    if (BenchSuite::Requested(argc, argv)) return RunBenchSuite();
+
     MatchState state;
 
     HomePanel home(&state);
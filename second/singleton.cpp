@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <string>
 
+#include "../bench/Bench.h"
+
 class MyManager
 {
     public:
@@ -24,8 +26,22 @@ class MyManager
         std::string _val;
 };
 
+// Cost of GetInstance once the instance exists: the guard check of the
+// function local static
+int RunBenchSuite()
+{
+    BenchSuite suite("singleton");
+    const int calls = 1000000;
+    suite.Run("GetInstance", calls, [] {
+        for (int i = 0; i < calls; i++) BenchKeep(MyManager::GetInstance());
+    });
+    return suite.Finish();
+}
+
 int main(int argc, char** argv)
 {
+    if (BenchSuite::Requested(argc, argv)) return RunBenchSuite();
+
     printf("[MAIN] First call to `GetInstance` will create the instance.\n");
     printf("[MAIN] Current value in the Manager = %s.\n", MyManager::GetInstance().GetValue().c_str());
 